@@ -0,0 +1,331 @@
+//
+// 编解码微基准：直接在内存中的 segment 上调用 erasure_encode 与 merge_to_stripes，不经过数据库与存储节点
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "storj/config.h"
+#include "storj/data_processor.h"
+#include "storj/metrics.h"
+#include "storj/reram_model.h"
+
+// 每次计时处理一个 segment，包含的 stripe 数
+const int SEGMENT_STRIPES = 16;
+
+struct bench_result
+{
+    std::string backend;
+    std::string op;
+    int k;
+    int m;
+    int stripe_size;
+    int erasures;
+    int threads;
+    long long segments;
+    long long bytes;
+    double seconds;
+    double gbps;
+    // ReRAM 模型给出的吞吐，只在 reram 后端且实际调用了模型时有效
+    double modeled_gbps;
+    long long p50_ns;
+    long long p90_ns;
+    long long p99_ns;
+    long long p999_ns;
+};
+
+std::vector<int> parse_list(const char *arg)
+{
+    std::vector<int> res;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            res.push_back(std::stoi(item));
+        }
+    }
+    return res;
+}
+
+storj::config make_config(int k, int m, int stripe_size)
+{
+    storj::config cfg;
+    cfg.k = k;
+    cfg.m = m;
+    cfg.n = k + m;
+    cfg.stripe_size = stripe_size;
+    cfg.segment_size = stripe_size * SEGMENT_STRIPES;
+    cfg.file_size = cfg.segment_size;
+    cfg.erasure_share_size = 0;
+    cfg.piece_size = 0;
+    return cfg;
+}
+
+storj::segment random_segment(int length, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    storj::segment_buffer data(length);
+    for (auto &c : data)
+    {
+        c = (char)(gen() & 0xff);
+    }
+    storj::segment res(std::move(data));
+    res.length = length;
+    return res;
+}
+
+/**
+ * 编码一个 segment，按 piece index 排列 erasure shares，即 merge_to_stripes 的输入 s[y][x]
+ */
+std::vector<std::vector<storj::erasure_share>> encode_segment(storj::data_processor &dp, storj::segment s)
+{
+    const storj::config &cfg = dp.get_config();
+    std::vector<std::vector<storj::erasure_share>> res(cfg.k + cfg.m);
+    for (auto &stripe : dp.split_segment(s))
+    {
+        std::vector<storj::erasure_share> shares = dp.erasure_encode(stripe);
+        for (int y = 0; y < cfg.k + cfg.m; y++)
+        {
+            res[y].push_back(std::move(shares[y]));
+        }
+    }
+    return res;
+}
+
+/**
+ * 每个线程使用自己的 data processor 与输入，计时前复制输入，只对编码或解码计时
+ * @param decode false 时测 split_segment + erasure_encode，true 时测 merge_to_stripes
+ * @return 所有线程都正确完成时返回 true
+ */
+bool run_threads(const storj::config &cfg, bool decode, int erasures, int threads, int iterations,
+                 storj::metrics::histogram &latency, double *seconds)
+{
+    std::vector<bool> ok(threads, true);
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]
+        {
+            storj::data_processor dp(cfg);
+            const storj::segment &original = random_segment(cfg.segment_size, t + 1);
+            const auto &encoded = encode_segment(dp, original);
+            std::mt19937 gen(t + 1);
+            std::vector<int> indices(cfg.k + cfg.m);
+            for (int y = 0; y < indices.size(); y++)
+            {
+                indices[y] = y;
+            }
+            // 第一次不计时，预热缓存与 ReRAM 常驻矩阵
+            for (int i = 0; i <= iterations; i++)
+            {
+                if (!decode)
+                {
+                    storj::segment s = original;
+                    const long long t1 = storj::metrics::now_ns();
+                    for (auto &stripe : dp.split_segment(s))
+                    {
+                        dp.erasure_encode(stripe);
+                    }
+                    const long long t2 = storj::metrics::now_ns();
+                    if (i > 0)
+                    {
+                        latency.record(t2 - t1);
+                    }
+                    continue;
+                }
+                // 每次随机丢失 erasures 个 piece
+                std::vector<std::vector<storj::erasure_share>> s = encoded;
+                std::shuffle(indices.begin(), indices.end(), gen);
+                for (int e = 0; e < erasures; e++)
+                {
+                    s[indices[e]] = std::vector<storj::erasure_share>(s[indices[e]].size());
+                }
+                const long long t1 = storj::metrics::now_ns();
+                std::vector<storj::stripe> stripes = dp.merge_to_stripes(s, cfg.segment_size);
+                const long long t2 = storj::metrics::now_ns();
+                if (i > 0)
+                {
+                    latency.record(t2 - t1);
+                }
+                // 只在预热时校验，避免比较计入吞吐
+                if (i == 0 && !std::equal(original.data.begin(), original.data.end(), dp.merge_to_segment(stripes).data.begin()))
+                {
+                    ok[t] = false;
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return std::find(ok.begin(), ok.end(), false) == ok.end();
+}
+
+bench_result run(bool reram, bool decode, int k, int m, int stripe_size, int erasures, int threads, int iterations)
+{
+    const storj::config &cfg = make_config(k, m, stripe_size);
+    storj::config::reram_backend = reram;
+    storj::reram_model::instance().reset();
+    storj::metrics::histogram latency(decode ? "decode" : "encode");
+    double seconds = 0;
+    if (!run_threads(cfg, decode, erasures, threads, iterations, latency, &seconds))
+    {
+        printf("decode differs from the original segment: k %d m %d stripe %d erasures %d\n", k, m, stripe_size, erasures);
+    }
+
+    bench_result res;
+    res.backend = reram ? "reram" : "jerasure";
+    res.op = decode ? "decode" : "encode";
+    res.k = k;
+    res.m = m;
+    res.stripe_size = stripe_size;
+    res.erasures = erasures;
+    res.threads = threads;
+    res.segments = latency.get_count();
+    res.bytes = res.segments * cfg.segment_size;
+    // 吞吐按计时部分的总时间折算到所有线程，不含复制输入的时间
+    const double busy = (double)latency.get_sum() / threads;
+    res.seconds = seconds;
+    res.gbps = busy > 0 ? res.bytes / busy : 0;
+    res.modeled_gbps = -1;
+    if (reram)
+    {
+        const storj::reram_model::totals &totals = decode ? storj::reram_model::instance().decode_totals()
+                                                          : storj::reram_model::instance().encode_totals();
+        if (totals.model.latency_ns > 0)
+        {
+            // 预热的 segment 也经过了模型，按 stripe 数折算
+            const double per_stripe = totals.model.latency_ns / totals.stripes;
+            res.modeled_gbps = (double)stripe_size / per_stripe;
+        }
+    }
+    res.p50_ns = latency.percentile(0.5);
+    res.p90_ns = latency.percentile(0.9);
+    res.p99_ns = latency.percentile(0.99);
+    res.p999_ns = latency.percentile(0.999);
+    return res;
+}
+
+void print_result(const bench_result &r)
+{
+    printf("%s %s k %d m %d stripe %d erasures %d threads %d: %.3f GB/s, p50 %lld us, p99 %lld us\n", r.backend.c_str(),
+           r.op.c_str(), r.k, r.m, r.stripe_size, r.erasures, r.threads, r.gbps, r.p50_ns / 1000, r.p99_ns / 1000);
+}
+
+/**
+ * 输出结果，路径以 .json 结尾时输出 JSON，否则输出 CSV
+ */
+bool write_results(const std::string &path, const std::vector<bench_result> &results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        perror("Failed to write benchmark results");
+        return false;
+    }
+    const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (!json)
+    {
+        out << "backend,op,k,m,stripe_size,erasures,threads,segments,bytes,seconds,gbps,modeled_gbps,p50_ns,p90_ns,p99_ns,p999_ns\n";
+    }
+    else
+    {
+        out << "[";
+    }
+    const char *sep = "\n";
+    for (const auto &r : results)
+    {
+        const std::string &modeled = r.modeled_gbps < 0 ? (json ? "null" : "") : std::to_string(r.modeled_gbps);
+        if (json)
+        {
+            out << sep << "  {\"backend\": \"" << r.backend << "\", \"op\": \"" << r.op << "\", \"k\": " << r.k
+                << ", \"m\": " << r.m << ", \"stripe_size\": " << r.stripe_size << ", \"erasures\": " << r.erasures
+                << ", \"threads\": " << r.threads << ", \"segments\": " << r.segments << ", \"bytes\": " << r.bytes
+                << ", \"seconds\": " << r.seconds << ", \"gbps\": " << r.gbps << ", \"modeled_gbps\": " << modeled
+                << ", \"p50_ns\": " << r.p50_ns << ", \"p90_ns\": " << r.p90_ns << ", \"p99_ns\": " << r.p99_ns
+                << ", \"p999_ns\": " << r.p999_ns << "}";
+            sep = ",\n";
+            continue;
+        }
+        out << r.backend << "," << r.op << "," << r.k << "," << r.m << "," << r.stripe_size << "," << r.erasures << ","
+            << r.threads << "," << r.segments << "," << r.bytes << "," << r.seconds << "," << r.gbps << "," << modeled
+            << "," << r.p50_ns << "," << r.p90_ns << "," << r.p99_ns << "," << r.p999_ns << "\n";
+    }
+    if (json)
+    {
+        out << "\n]\n";
+    }
+    return true;
+}
+
+/**
+ * 用法: storj_bench_codec ks ms stripe_sizes erasures threads [iterations] [output] [reram_param_file]
+ * 前五个参数为逗号分隔的列表，遍历其笛卡尔积；丢失数超过 m 的组合跳过，丢失数为 0 时解码只拼接数据。
+ * 给出 ReRAM 参数文件时每个组合再用 ReRAM 模型测一遍
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 6)
+    {
+        puts("usage: storj_bench_codec ks ms stripe_sizes erasures threads [iterations] [output] [reram_param_file]");
+        puts("e.g.   storj_bench_codec 4,8,10 2,4 65536,131072 0,1,2 1,4 50 bench_codec.csv");
+        return 1;
+    }
+    const std::vector<int> &ks = parse_list(argv[1]);
+    const std::vector<int> &ms = parse_list(argv[2]);
+    const std::vector<int> &stripe_sizes = parse_list(argv[3]);
+    const std::vector<int> &erasure_counts = parse_list(argv[4]);
+    const std::vector<int> &thread_counts = parse_list(argv[5]);
+    const int iterations = argc > 6 ? atoi(argv[6]) : 50;
+    const std::string output = argc > 7 ? argv[7] : "bench_codec.csv";
+    std::vector<bool> backends = {false};
+    if (argc > 8)
+    {
+        storj::config::reram_param_file = argv[8];
+        backends.push_back(true);
+    }
+    // 每个 stripe 一个 span 会淹没时间线，基准只看直方图
+    storj::config::trace_spans = false;
+
+    std::vector<bench_result> results;
+    for (bool reram : backends)
+    {
+        for (int k : ks)
+        {
+            for (int m : ms)
+            {
+                for (int stripe_size : stripe_sizes)
+                {
+                    for (int threads : thread_counts)
+                    {
+                        results.push_back(run(reram, false, k, m, stripe_size, 0, threads, iterations));
+                        print_result(results.back());
+                        for (int erasures : erasure_counts)
+                        {
+                            if (erasures > m)
+                            {
+                                continue;
+                            }
+                            results.push_back(run(reram, true, k, m, stripe_size, erasures, threads, iterations));
+                            print_result(results.back());
+                        }
+                    }
+                }
+            }
+        }
+    }
+    storj::config::reram_backend = false;
+    return write_results(output, results) ? 0 : 1;
+}
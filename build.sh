@@ -0,0 +1,31 @@
+# 编译全部程序。仓库中的 Makefile 是旧的 CMake 生成文件，不含后来新增的 storj/*.cpp 与程序
+# 依赖 Jerasure、gf-complete、sqlite3 与 boost（uuid，只需头文件）；Jerasure 不在默认位置时设置 JERASURE_INCLUDE / JERASURE_LIBS
+set -e
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -pthread}
+JERASURE_INCLUDE=${JERASURE_INCLUDE:-/usr/local/include/jerasure}
+JERASURE_LIBS=${JERASURE_LIBS:--lJerasure -lgf_complete}
+
+# storj/ 下的源文件只编译一次，各程序共用
+mkdir -p build
+objs=""
+for src in storj/*.cpp
+do
+    obj=build/$(basename $src .cpp).o
+    $CXX $CXXFLAGS -I$JERASURE_INCLUDE -c $src -o $obj
+    objs="$objs $obj"
+done
+
+# 参数: 主程序源文件、输出的二进制
+link()
+{
+    $CXX $CXXFLAGS -I$JERASURE_INCLUDE $1 $objs $JERASURE_LIBS -lsqlite3 -o $2
+}
+
+link main.cpp storj_emulator
+link test_main.cpp storj_emulator_scan
+link bench_codec.cpp storj_bench_codec
+link experiment_runner.cpp storj_experiment_runner
+link catalog_bench.cpp storj_catalog_bench
+link churn_replay.cpp storj_churn_replay
+link selfcheck.cpp storj_selfcheck
@@ -0,0 +1,386 @@
+//
+// 元数据规模基准：生成只有目录、没有 piece 数据的合成 storj.db，
+// 测量扫描、按文件名查 pieces、启动与修复排序在百万、千万级 pieces 下的耗时
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sqlite3.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include "harness_util.h"
+#include "storj/config.h"
+#include "storj/data_manager.h"
+#include "storj/metrics.h"
+#include "storj/repair_queue.h"
+
+// 每个事务插入的行数
+const int ROWS_PER_TRANSACTION = 100000;
+// 合成文件的 stripe 大小与每个 segment 的 stripe 数，只影响 file 表中的数值
+const int STRIPE_SIZE = 65536;
+const int SEGMENT_STRIPES = 16;
+
+struct catalog_spec
+{
+    long long pieces;
+    double loss_rate = 0.01;
+    int segments_per_file = 16;
+    int k = 4;
+    int m = 2;
+    int n = 6;
+    int lookups = 1000;
+};
+
+struct catalog_result
+{
+    long long files = 0;
+    long long segments = 0;
+    long long pieces = 0;
+    long long db_bytes = 0;
+    double generate_s = 0;
+    double init_s = 0;
+    double scan_s = 0;
+    long long damaged_segments = 0;
+    double stream_scan_s = 0;
+    long long stream_damaged_segments = 0;
+    long long lookup_p50_ns = 0;
+    long long lookup_p99_ns = 0;
+    double sort_s = 0;
+    double queue_s = 0;
+    double sample_audit_s = 0;
+    long long sample_damaged_segments = 0;
+};
+
+long long file_bytes(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+/**
+ * 丢失模型：按 piece id 的哈希决定，同一个 piece 在各次审计中结果相同
+ */
+bool piece_available(const std::string &piece_id, double loss_rate)
+{
+    return std::hash<std::string>()(piece_id) % 1000000 >= loss_rate * 1000000;
+}
+
+std::string synthetic_file_name(long long i)
+{
+    return "synthetic_" + std::to_string(i);
+}
+
+bool exec(sqlite3 *db, const char *sql)
+{
+    if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        printf("sqlite: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 直接写入 file、segment、piece 三张表，列与 data_manager::db_insert_* 相同。
+ * pieces 轮流分配到已有的存储节点，所有行都是第 0 代、已上传完成
+ * @param db_path 已由 data_manager 建好表与存储节点的数据库
+ */
+bool generate_catalog(const std::string &db_path, const catalog_spec &spec, catalog_result *res)
+{
+    sqlite3 *db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+    {
+        perror("Failed to open catalog");
+        return false;
+    }
+    // 测的是读取路径，生成时不需要落盘
+    exec(db, "pragma synchronous = off;");
+    std::vector<std::string> nodes;
+    {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db, "select \"id\" from \"storage_node\" order by \"id\";", -1, &stmt, nullptr);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            nodes.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (nodes.size() < spec.n)
+    {
+        printf("catalog has %d storage nodes, n = %d\n", (int)nodes.size(), spec.n);
+        sqlite3_close_v2(db);
+        return false;
+    }
+
+    sqlite3_stmt *insert_file;
+    sqlite3_stmt *insert_segment;
+    sqlite3_stmt *insert_piece;
+    sqlite3_prepare_v2(db, "insert into \"file\"(\"id\", \"file_name\", \"file_size\", \"segment_size\", \"stripe_size\", \"erasure_share_size\", \"k\", \"m\", \"n\", \"max_padding_ratio\", \"status\")\n"
+                           "values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", -1, &insert_file, nullptr);
+    sqlite3_prepare_v2(db, "insert into \"segment\"(\"id\", \"index\", \"file_id\", \"length\", \"generation\")\n"
+                           "values (?, ?, ?, ?, ?);", -1, &insert_segment, nullptr);
+    sqlite3_prepare_v2(db, "insert into \"piece\"(\"id\", \"index\", \"segment_id\", \"storage_node_id\", \"generation\")\n"
+                           "values (?, ?, ?, ?, ?);", -1, &insert_piece, nullptr);
+
+    storj::config cfg;
+    cfg.k = spec.k;
+    cfg.m = spec.m;
+    cfg.n = spec.n;
+    cfg.stripe_size = STRIPE_SIZE;
+    cfg.segment_size = STRIPE_SIZE * SEGMENT_STRIPES;
+    cfg.file_size = cfg.segment_size * spec.segments_per_file;
+    cfg.erasure_share_size = STRIPE_SIZE / spec.k;
+    const long long pieces_per_file = (long long)spec.segments_per_file * spec.n;
+    res->files = std::max(1LL, spec.pieces / pieces_per_file);
+    boost::uuids::random_generator uuid_v4;
+    long long rows = 0;
+    long long next_node = 0;
+    exec(db, "begin;");
+    for (long long f = 0; f < res->files; f++)
+    {
+        const std::string &file_id = to_string(uuid_v4());
+        const std::string &file_name = synthetic_file_name(f);
+        sqlite3_bind_text(insert_file, 1, file_id.c_str(), file_id.length(), SQLITE_TRANSIENT);
+        sqlite3_bind_text(insert_file, 2, file_name.c_str(), file_name.length(), SQLITE_TRANSIENT);
+        sqlite3_bind_int(insert_file, 3, cfg.file_size);
+        sqlite3_bind_int(insert_file, 4, cfg.segment_size);
+        sqlite3_bind_int(insert_file, 5, cfg.stripe_size);
+        sqlite3_bind_int(insert_file, 6, cfg.erasure_share_size);
+        sqlite3_bind_int(insert_file, 7, cfg.k);
+        sqlite3_bind_int(insert_file, 8, cfg.m);
+        sqlite3_bind_int(insert_file, 9, cfg.n);
+        sqlite3_bind_double(insert_file, 10, cfg.max_padding_ratio);
+        sqlite3_bind_int(insert_file, 11, 1);
+        sqlite3_step(insert_file);
+        sqlite3_reset(insert_file);
+        rows++;
+        for (int s = 0; s < spec.segments_per_file; s++)
+        {
+            const std::string &segment_id = to_string(uuid_v4());
+            sqlite3_bind_text(insert_segment, 1, segment_id.c_str(), segment_id.length(), SQLITE_TRANSIENT);
+            sqlite3_bind_int(insert_segment, 2, s);
+            sqlite3_bind_text(insert_segment, 3, file_id.c_str(), file_id.length(), SQLITE_TRANSIENT);
+            sqlite3_bind_int(insert_segment, 4, cfg.segment_size);
+            sqlite3_bind_int(insert_segment, 5, 0);
+            sqlite3_step(insert_segment);
+            sqlite3_reset(insert_segment);
+            res->segments++;
+            rows++;
+            for (int p = 0; p < spec.n; p++)
+            {
+                const std::string &piece_id = to_string(uuid_v4());
+                const std::string &node_id = nodes[next_node++ % nodes.size()];
+                sqlite3_bind_text(insert_piece, 1, piece_id.c_str(), piece_id.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_int(insert_piece, 2, p);
+                sqlite3_bind_text(insert_piece, 3, segment_id.c_str(), segment_id.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_text(insert_piece, 4, node_id.c_str(), node_id.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_int(insert_piece, 5, 0);
+                sqlite3_step(insert_piece);
+                sqlite3_reset(insert_piece);
+                res->pieces++;
+                rows++;
+            }
+            if (rows >= ROWS_PER_TRANSACTION)
+            {
+                exec(db, "commit;");
+                exec(db, "begin;");
+                rows = 0;
+            }
+        }
+    }
+    const bool ok = exec(db, "commit;");
+    sqlite3_finalize(insert_file);
+    sqlite3_finalize(insert_segment);
+    sqlite3_finalize(insert_piece);
+    // 把 WAL 合并回数据库文件，数据库大小只看主文件
+    exec(db, "pragma wal_checkpoint(truncate);");
+    sqlite3_close_v2(db);
+    return ok;
+}
+
+/**
+ * 在生成的目录上依次测量：
+ * <ol>
+ * <li> init：构造 data_manager（建表、加载存储节点、回收 pending pieces）
+ * <li> scan：scan_corrupted_segments，逐文件、逐 segment 查询并审计
+ * <li> stream scan：scan_segments，按 segment id 分批扫描
+ * <li> lookup：随机文件名调用 locate_segments，即 download_file 中的有序联表查询
+ * <li> plan：sort_segments 与修复队列的入队、出队
+ * <li> sample audit：sample_audit，每个节点抽样审计，只全量审计估计丢失率超过阈值的节点
+ * </ol>
+ */
+void run_benchmark(const std::string &work_dir, const catalog_spec &spec, catalog_result *res)
+{
+    const std::string &db_path = work_dir + "storj.db";
+    auto start = std::chrono::steady_clock::now();
+    storj::data_manager manager(db_path, work_dir + "storage_nodes/");
+    res->init_s = seconds_since(start);
+    manager.set_synthetic_audit([&spec](const storj::piece &p)
+                                { return piece_available(to_string(p.id), spec.loss_rate); });
+
+    // scan_corrupted_segments 每个文件输出一行，不计入耗时
+    std::streambuf *out = std::cout.rdbuf(nullptr);
+    start = std::chrono::steady_clock::now();
+    auto tuple = manager.scan_corrupted_segments();
+    res->scan_s = seconds_since(start);
+    std::cout.rdbuf(out);
+    std::vector<std::string> &segment_ids = std::get<0>(tuple);
+    res->damaged_segments = segment_ids.size();
+    printf("scan: %lld damaged segments, %.3f s\n", res->damaged_segments, res->scan_s);
+
+    start = std::chrono::steady_clock::now();
+    manager.scan_segments([res](const std::string &, int, int)
+                          { res->stream_damaged_segments++; });
+    res->stream_scan_s = seconds_since(start);
+    printf("stream scan: %lld damaged segments, %.3f s\n", res->stream_damaged_segments, res->stream_scan_s);
+
+    storj::metrics::histogram &latency = storj::metrics::instance().get_histogram("catalog.locate_segments");
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<long long> pick(0, res->files - 1);
+    for (int i = 0; i < spec.lookups; i++)
+    {
+        const std::string &filename = synthetic_file_name(pick(gen));
+        const long long t1 = storj::metrics::now_ns();
+        const auto &segments = manager.locate_segments(filename);
+        latency.record(storj::metrics::now_ns() - t1);
+        if (segments.size() != spec.segments_per_file)
+        {
+            printf("lookup %s: %d segments, expected %d\n", filename.c_str(), (int)segments.size(), spec.segments_per_file);
+        }
+    }
+    res->lookup_p50_ns = latency.percentile(0.5);
+    res->lookup_p99_ns = latency.percentile(0.99);
+    printf("lookup: p50 %lld us, p99 %lld us\n", res->lookup_p50_ns / 1000, res->lookup_p99_ns / 1000);
+
+    std::vector<std::string> ids = segment_ids;
+    start = std::chrono::steady_clock::now();
+    storj::data_manager::sort_segments(segment_ids, std::get<1>(tuple), std::get<2>(tuple));
+    res->sort_s = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    {
+        storj::repair_queue queue(std::max(1, (int)ids.size()));
+        for (int i = 0; i < ids.size(); i++)
+        {
+            queue.push(ids[i], storj::data_manager::segment_weight(std::get<1>(tuple)[i], std::get<2>(tuple)[i]));
+        }
+        queue.close();
+        std::string segment_id;
+        while (queue.pop(&segment_id))
+        {
+        }
+    }
+    res->queue_s = seconds_since(start);
+    printf("plan: sort %.3f s, repair queue %.3f s\n", res->sort_s, res->queue_s);
+
+    // 扫描循环中先于全量扫描的一轮抽样
+    start = std::chrono::steady_clock::now();
+    res->sample_damaged_segments = manager.sample_audit().size();
+    res->sample_audit_s = seconds_since(start);
+    printf("sample audit: %lld damaged segments, %.3f s\n", res->sample_damaged_segments, res->sample_audit_s);
+}
+
+/**
+ * 追加一行结果，文件为空时先写表头
+ */
+bool append_result(const std::string &path, const catalog_spec &spec, const catalog_result &r)
+{
+    const bool header = file_bytes(path) == 0;
+    std::ofstream out(path, std::ios::app);
+    if (!out)
+    {
+        perror("Failed to write catalog benchmark results");
+        return false;
+    }
+    if (header)
+    {
+        out << "backend,files,segments,pieces,loss_rate,k,m,n,db_bytes,generate_s,init_s,scan_s,damaged_segments,"
+               "stream_scan_s,stream_damaged_segments,lookups,lookup_p50_ns,lookup_p99_ns,sort_s,queue_s,sample_audit_s,"
+               "sample_damaged_segments\n";
+    }
+    out << "sqlite," << r.files << "," << r.segments << "," << r.pieces << "," << spec.loss_rate << "," << spec.k << ","
+        << spec.m << "," << spec.n << "," << r.db_bytes << "," << r.generate_s << "," << r.init_s << "," << r.scan_s
+        << "," << r.damaged_segments << "," << r.stream_scan_s << "," << r.stream_damaged_segments << ","
+        << spec.lookups << "," << r.lookup_p50_ns << "," << r.lookup_p99_ns << "," << r.sort_s << "," << r.queue_s
+        << "," << r.sample_audit_s << "," << r.sample_damaged_segments << "\n";
+    return true;
+}
+
+/**
+ * 用法: storj_catalog_bench work_dir pieces [loss_rate] [segments_per_file] [k] [m] [n] [lookups] [output]
+ * 在 work_dir 中重新生成约 pieces 个 pieces 的目录，不写任何 piece 数据；
+ * 审计由 loss_rate 的合成丢失模型给出，结果追加到 output
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        puts("usage: storj_catalog_bench work_dir pieces [loss_rate] [segments_per_file] [k] [m] [n] [lookups] [output]");
+        puts("e.g.   storj_catalog_bench catalog 10000000 0.01 16 4 2 6 1000 catalog_bench.csv");
+        return 1;
+    }
+    std::string work_dir = argv[1];
+    if (work_dir.back() != '/')
+    {
+        work_dir += "/";
+    }
+    catalog_spec spec;
+    spec.pieces = atoll(argv[2]);
+    if (argc > 3)
+    {
+        spec.loss_rate = atof(argv[3]);
+    }
+    if (argc > 4)
+    {
+        spec.segments_per_file = std::max(1, atoi(argv[4]));
+    }
+    if (argc > 7)
+    {
+        spec.k = atoi(argv[5]);
+        spec.m = atoi(argv[6]);
+        spec.n = atoi(argv[7]);
+    }
+    if (argc > 8)
+    {
+        spec.lookups = atoi(argv[8]);
+    }
+    const std::string output = argc > 9 ? argv[9] : "catalog_bench.csv";
+    // 每次查询一个 span 会占满内存
+    storj::config::trace_spans = false;
+    storj::config::metrics_file = "metrics_catalog.json";
+
+    // 每次重新生成，避免混入上次的规模
+    const std::string &db_path = work_dir + "storj.db";
+    mkdir(work_dir.c_str(), 0755);
+    remove(db_path.c_str());
+    remove((db_path + "-wal").c_str());
+    remove((db_path + "-shm").c_str());
+    {
+        // 建表与存储节点
+        storj::data_manager manager(db_path, work_dir + "storage_nodes/");
+    }
+
+    catalog_result res;
+    auto start = std::chrono::steady_clock::now();
+    if (!generate_catalog(db_path, spec, &res))
+    {
+        return 1;
+    }
+    res.generate_s = seconds_since(start);
+    res.db_bytes = file_bytes(db_path);
+    printf("generate: %lld files, %lld segments, %lld pieces, %lld bytes, %.3f s\n", res.files, res.segments,
+           res.pieces, res.db_bytes, res.generate_s);
+
+    run_benchmark(work_dir, spec, &res);
+    printf("init: %.3f s\n", res.init_s);
+    storj::metrics::instance().dump(storj::config::metrics_file);
+    return append_result(output, spec, res) ? 0 : 1;
+}
@@ -0,0 +1,634 @@
+//
+// 节点流失回放：按时间戳回放节点离线、恢复与数据丢失事件，修复服务同时运行，
+// 记录修复积压、修复流量、修复耗时分布与最终的数据丢失，代替 remove_piece.py 清空一个节点后循环扫描的做法
+//
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sqlite3.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "harness_util.h"
+#include "storj/config.h"
+#include "storj/data_manager.h"
+#include "storj/metrics.h"
+
+// 修复队列容量，与 main.cpp 相同
+const int REPAIR_QUEUE_CAPACITY = 1024;
+// 回放期间记录时间线的间隔 (ms)
+const int SAMPLE_INTERVAL_MS = 100;
+
+/**
+ * 回放的一个事件，node 为节点在按 id 排序后的序号
+ * down：节点离线，数据保留；up：节点恢复在线；fail：节点上的数据全部丢失，在线状态不变
+ */
+struct trace_event
+{
+    long long time_ms;
+    int node;
+    std::string kind;
+};
+
+/**
+ * 合成事件序列的参数，按轮生成：每轮每个在线节点以 failure_rate 的概率离开，
+ * 其中 permanent_fraction 为数据丢失 (fail)，其余离线后按指数分布的时长恢复
+ */
+struct churn_spec
+{
+    long long duration_ms = 20000;
+    long long round_ms = 1000;
+    double failure_rate = storj::config::failure_rate;
+    double permanent_fraction = 0.2;
+    long long mean_downtime_ms = 3000;
+    unsigned seed = 1;
+};
+
+// 因节点离线或数据丢失而缺少 pieces、尚未修复的 segment
+struct degraded_segment
+{
+    long long since_ms;
+    std::set<int> down_nodes;
+    std::set<int> failed_nodes;
+};
+
+struct replay_result
+{
+    int events = 0;
+    int down_events = 0;
+    int fail_events = 0;
+    double replay_s = 0;
+    int repair_rounds = 0;
+    long long repaired_segments = 0;
+    // 节点恢复在线后不再缺少 pieces、未经修复的 segment 数
+    long long recovered_segments = 0;
+    long long repair_read_bytes = 0;
+    long long repair_write_bytes = 0;
+    long long max_backlog = 0;
+    long long max_unavailable = 0;
+    long long unavailable_at_end = 0;
+    long long lost_segments = 0;
+    int lost_files = 0;
+};
+
+/**
+ * 回放过程中的共享状态，事件线程、修复线程与采样共同访问
+ */
+struct replay_state
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, degraded_segment> degraded;
+    std::chrono::steady_clock::time_point start;
+    int tolerance;
+
+    long long now_ms() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * 缺少的 pieces 超过 n - k 个的 segment 数，假设同一 segment 的 pieces 在不同节点上
+     */
+    long long unavailable()
+    {
+        long long count = 0;
+        for (const auto &pair : degraded)
+        {
+            std::set<int> missing = pair.second.down_nodes;
+            missing.insert(pair.second.failed_nodes.begin(), pair.second.failed_nodes.end());
+            if (missing.size() > tolerance)
+            {
+                count++;
+            }
+        }
+        return count;
+    }
+};
+
+/**
+ * 每行: time_ms node down|up|fail，# 之后为注释，按时间排序后返回
+ */
+std::vector<trace_event> load_trace(const std::string &path)
+{
+    std::vector<trace_event> res;
+    std::ifstream in(path);
+    if (!in)
+    {
+        perror("Failed to open failure trace");
+        return res;
+    }
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        trace_event e;
+        if (!(iss >> e.time_ms >> e.node >> e.kind) || (e.kind != "down" && e.kind != "up" && e.kind != "fail"))
+        {
+            if (line.find_first_not_of(" \t\r") != std::string::npos)
+            {
+                printf("failure trace line %d: expected time_ms node down|up|fail\n", line_number);
+            }
+            continue;
+        }
+        res.push_back(e);
+    }
+    std::stable_sort(res.begin(), res.end(), [](const trace_event &a, const trace_event &b)
+                     { return a.time_ms < b.time_ms; });
+    return res;
+}
+
+/**
+ * synthetic[:duration_ms[:round_ms[:failure_rate[:permanent_fraction[:mean_downtime_ms[:seed]]]]]]
+ */
+churn_spec parse_synthetic(const std::string &arg)
+{
+    churn_spec spec;
+    std::vector<std::string> fields;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ':'))
+    {
+        fields.push_back(item);
+    }
+    if (fields.size() > 1 && !fields[1].empty())
+    {
+        spec.duration_ms = std::stoll(fields[1]);
+    }
+    if (fields.size() > 2 && !fields[2].empty())
+    {
+        spec.round_ms = std::max(1LL, std::stoll(fields[2]));
+    }
+    if (fields.size() > 3 && !fields[3].empty())
+    {
+        spec.failure_rate = std::stod(fields[3]);
+    }
+    if (fields.size() > 4 && !fields[4].empty())
+    {
+        spec.permanent_fraction = std::stod(fields[4]);
+    }
+    if (fields.size() > 5 && !fields[5].empty())
+    {
+        spec.mean_downtime_ms = std::stoll(fields[5]);
+    }
+    if (fields.size() > 6 && !fields[6].empty())
+    {
+        spec.seed = std::stoul(fields[6]);
+    }
+    return spec;
+}
+
+std::vector<trace_event> synthetic_trace(const churn_spec &spec, int nodes)
+{
+    std::vector<trace_event> res;
+    std::mt19937 gen(spec.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::exponential_distribution<double> downtime(1.0 / std::max(1LL, spec.mean_downtime_ms));
+    // 离线节点恢复的时间，-1 表示在线
+    std::vector<long long> back_at(nodes, -1);
+    for (long long t = 0; t < spec.duration_ms; t += spec.round_ms)
+    {
+        for (int node = 0; node < nodes; node++)
+        {
+            if (back_at[node] >= 0 && back_at[node] <= t)
+            {
+                back_at[node] = -1;
+            }
+            if (back_at[node] >= 0 || uniform(gen) >= spec.failure_rate)
+            {
+                continue;
+            }
+            if (uniform(gen) < spec.permanent_fraction)
+            {
+                res.push_back({t, node, "fail"});
+                continue;
+            }
+            back_at[node] = t + std::max(1LL, (long long)downtime(gen));
+            res.push_back({t, node, "down"});
+            // 在回放结束后才恢复的节点保持离线
+            if (back_at[node] < spec.duration_ms)
+            {
+                res.push_back({back_at[node], node, "up"});
+            }
+            else
+            {
+                back_at[node] = spec.duration_ms;
+            }
+        }
+    }
+    std::stable_sort(res.begin(), res.end(), [](const trace_event &a, const trace_event &b)
+                     { return a.time_ms < b.time_ms; });
+    return res;
+}
+
+bool write_trace(const std::string &path, const std::vector<trace_event> &events)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        perror("Failed to write failure trace");
+        return false;
+    }
+    out << "# time_ms node down|up|fail\n";
+    for (const auto &e : events)
+    {
+        out << e.time_ms << " " << e.node << " " << e.kind << "\n";
+    }
+    return true;
+}
+
+/**
+ * 删除节点目录中的全部 piece 文件，保留目录本身，与 remove_piece.py 相同
+ */
+void wipe_node(const std::string &node_path)
+{
+    DIR *dir = opendir(node_path.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            remove((node_path + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * 节点上当前代 pieces 所属的 segments
+ */
+std::vector<std::string> segments_on_node(sqlite3 *db, const std::string &node_id)
+{
+    std::vector<std::string> res;
+    const char *sql_select = "select \"p\".\"segment_id\"\n"
+                             "from \"piece\" \"p\"\n"
+                             "         join \"segment\" \"s\" on \"s\".\"id\" = \"p\".\"segment_id\" and \"s\".\"generation\" = \"p\".\"generation\"\n"
+                             "where \"p\".\"storage_node_id\" = ?;";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        res.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/**
+ * 在目录中执行一个事件，并更新受影响的 segments
+ */
+void apply_event(const trace_event &e, storj::data_manager &manager, sqlite3 *db, const std::vector<std::string> &nodes,
+                 const std::string &node_root, replay_state &state, replay_result &res)
+{
+    const std::string &node_id = nodes[e.node];
+    if (e.kind == "up")
+    {
+        manager.set_node_online(node_id, true);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (auto it = state.degraded.begin(); it != state.degraded.end();)
+        {
+            it->second.down_nodes.erase(e.node);
+            if (it->second.down_nodes.empty() && it->second.failed_nodes.empty())
+            {
+                res.recovered_segments++;
+                it = state.degraded.erase(it);
+                continue;
+            }
+            ++it;
+        }
+        return;
+    }
+    if (e.kind == "down")
+    {
+        manager.set_node_online(node_id, false);
+        res.down_events++;
+    }
+    else
+    {
+        wipe_node(node_root + node_id);
+        res.fail_events++;
+    }
+    const std::vector<std::string> &segment_ids = segments_on_node(db, node_id);
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const auto &segment_id : segment_ids)
+    {
+        auto it = state.degraded.find(segment_id);
+        if (it == state.degraded.end())
+        {
+            it = state.degraded.emplace(segment_id, degraded_segment{e.time_ms}).first;
+        }
+        if (e.kind == "down")
+        {
+            it->second.down_nodes.insert(e.node);
+        }
+        else
+        {
+            it->second.failed_nodes.insert(e.node);
+        }
+    }
+}
+
+/**
+ * 按时间回放事件，修复服务每隔 repair_interval_ms 抽样审计并修复一轮。
+ * 事件回放完后继续修复，直到积压中只剩无法修复的 segments，或者超过 grace_ms
+ */
+void replay(const std::vector<trace_event> &events, storj::data_manager &manager, const std::string &db_path,
+            const std::vector<std::string> &nodes, const std::string &node_root, int repair_interval_ms,
+            replay_state &state, replay_result &res, std::ostream &timeline)
+{
+    static storj::metrics::histogram &time_to_repair = storj::metrics::instance().get_histogram("churn.time_to_repair");
+    storj::metrics::counter &read_bytes = storj::metrics::instance().get_counter("piece_read.bytes");
+    storj::metrics::counter &write_bytes = storj::metrics::instance().get_counter("piece_write.bytes");
+    const long long read_base = read_bytes.get();
+    const long long write_base = write_bytes.get();
+
+    sqlite3 *db;
+    sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+    sqlite3_busy_timeout(db, 5000);
+
+    state.start = std::chrono::steady_clock::now();
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool stop = false;
+    std::thread repairer([&]
+                         {
+                             while (true)
+                             {
+                                 manager.sample_and_repair(REPAIR_QUEUE_CAPACITY, [&](const std::string &segment_id)
+                                                           {
+                                                               std::lock_guard<std::mutex> lock(state.mutex);
+                                                               res.repaired_segments++;
+                                                               auto it = state.degraded.find(segment_id);
+                                                               if (it != state.degraded.end())
+                                                               {
+                                                                   time_to_repair.record((state.now_ms() - it->second.since_ms) * 1000000);
+                                                                   state.degraded.erase(it);
+                                                               }
+                                                           });
+                                 std::unique_lock<std::mutex> lock(stop_mutex);
+                                 res.repair_rounds++;
+                                 if (stop_cv.wait_for(lock, std::chrono::milliseconds(repair_interval_ms), [&]
+                                                      { return stop; }))
+                                 {
+                                     break;
+                                 }
+                             }
+                         });
+
+    timeline << "time_ms,online_nodes,failed_nodes,backlog_segments,unavailable_segments,repaired_segments,"
+                "recovered_segments,repair_read_bytes,repair_write_bytes\n";
+    std::set<int> offline;
+    std::set<int> failed;
+    const auto sample = [&]
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        const long long backlog = state.degraded.size();
+        const long long unavailable = state.unavailable();
+        res.max_backlog = std::max(res.max_backlog, backlog);
+        res.max_unavailable = std::max(res.max_unavailable, unavailable);
+        timeline << state.now_ms() << "," << nodes.size() - offline.size() << "," << failed.size() << "," << backlog
+                 << "," << unavailable << "," << res.repaired_segments << "," << res.recovered_segments << ","
+                 << read_bytes.get() - read_base << "," << write_bytes.get() - write_base << "\n";
+        return std::make_pair(backlog, unavailable);
+    };
+
+    for (const auto &e : events)
+    {
+        while (state.now_ms() < e.time_ms)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min((long long)SAMPLE_INTERVAL_MS, e.time_ms - state.now_ms())));
+            sample();
+        }
+        if (e.node < 0 || e.node >= nodes.size())
+        {
+            printf("failure trace: node %d out of range\n", e.node);
+            continue;
+        }
+        apply_event(e, manager, db, nodes, node_root, state, res);
+        res.events++;
+        if (e.kind == "down")
+        {
+            offline.insert(e.node);
+        }
+        else if (e.kind == "up")
+        {
+            offline.erase(e.node);
+        }
+        else
+        {
+            failed.insert(e.node);
+        }
+        sample();
+    }
+
+    // 积压中只剩缺少超过 n - k 个 pieces 的 segments 时，继续修复也无法恢复
+    const long long grace_ms = std::max(5000LL, 10LL * repair_interval_ms);
+    const long long deadline = state.now_ms() + grace_ms;
+    while (state.now_ms() < deadline)
+    {
+        const auto &counts = sample();
+        if (counts.first == counts.second)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_INTERVAL_MS));
+    }
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stop = true;
+    }
+    stop_cv.notify_all();
+    repairer.join();
+    sample();
+    res.replay_s = seconds_since(state.start);
+    res.repair_read_bytes = read_bytes.get() - read_base;
+    res.repair_write_bytes = write_bytes.get() - write_base;
+    sqlite3_close_v2(db);
+}
+
+/**
+ * 用法: storj_churn_replay trace [files] [file_size] [segment_size] [stripe_size] [k] [m] [n] [repair_interval_ms] [output] [work_dir]
+ * trace 为事件文件 (time_ms node down|up|fail)，
+ * 或 synthetic[:duration_ms[:round_ms[:failure_rate[:permanent_fraction[:mean_downtime_ms[:seed]]]]]]，
+ * 由 config::failure_rate（给出时覆盖）按轮生成。
+ * 输出 output_trace.txt（回放的事件）、output_timeline.csv（积压随时间的变化），结果追加到 output_summary.csv
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        puts("usage: storj_churn_replay trace [files] [file_size] [segment_size] [stripe_size] [k] [m] [n] [repair_interval_ms] [output] [work_dir]");
+        puts("trace: file with lines 'time_ms node down|up|fail', or");
+        puts("       synthetic[:duration_ms[:round_ms[:failure_rate[:permanent_fraction[:mean_downtime_ms[:seed]]]]]]");
+        return 1;
+    }
+    const std::string trace_arg = argv[1];
+    const int files = argc > 2 ? std::max(1, atoi(argv[2])) : 4;
+    storj::config cfg;
+    cfg.file_size = argc > 3 ? atoi(argv[3]) : 1 << 20;
+    cfg.segment_size = argc > 4 ? atoi(argv[4]) : 1 << 18;
+    cfg.stripe_size = argc > 5 ? atoi(argv[5]) : 1 << 16;
+    cfg.k = argc > 6 ? atoi(argv[6]) : 4;
+    cfg.m = argc > 7 ? atoi(argv[7]) : 2;
+    cfg.n = argc > 8 ? atoi(argv[8]) : 6;
+    cfg.erasure_share_size = 0;
+    cfg.piece_size = 0;
+    const int repair_interval_ms = argc > 9 ? atoi(argv[9]) : 1000;
+    const std::string output = argc > 10 ? argv[10] : "churn";
+    std::string work_dir = argc > 11 ? argv[11] : "churn";
+    if (work_dir.back() != '/')
+    {
+        work_dir += "/";
+    }
+    // fail 事件直接删除节点目录中的文件，日志存储的内存索引不会随之更新
+    storj::config::log_structured_store = false;
+    storj::config::trace_spans = false;
+    storj::config::metrics_file = "metrics_churn.json";
+
+    // 每次使用新的目录与数据库
+    remove_tree(work_dir);
+    if (mkdir(work_dir.c_str(), 0755) == -1)
+    {
+        perror("Failed to create churn directory");
+        return 1;
+    }
+    const std::string &db_path = work_dir + "storj.db";
+    const std::string &node_root = work_dir + "storage_nodes/";
+    storj::data_manager manager(db_path, node_root);
+
+    // 节点按 id 排序，事件中的节点序号与此对应
+    std::vector<std::string> nodes;
+    {
+        sqlite3 *db;
+        sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db, "select \"id\" from \"storage_node\" order by \"id\";", -1, &stmt, nullptr);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            nodes.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close_v2(db);
+    }
+
+    std::vector<trace_event> events;
+    if (trace_arg.compare(0, 9, "synthetic") == 0)
+    {
+        const churn_spec &spec = parse_synthetic(trace_arg);
+        // 修复优先级按同一失效率估计
+        storj::config::failure_rate = spec.failure_rate;
+        events = synthetic_trace(spec, nodes.size());
+    }
+    else
+    {
+        events = load_trace(trace_arg);
+    }
+    write_trace(output + "_trace.txt", events);
+
+    std::vector<std::string> inputs;
+    for (int i = 0; i < files; i++)
+    {
+        const std::string &input = work_dir + "datatest_" + std::to_string(i) + ".txt";
+        if (!create_file(input, cfg.file_size, i + 1))
+        {
+            return 1;
+        }
+        manager.upload_file(input, cfg);
+        inputs.push_back(input);
+    }
+    manager.wait_pending_uploads();
+
+    replay_state state;
+    state.tolerance = cfg.n - cfg.k;
+    replay_result res;
+    std::ofstream timeline(output + "_timeline.csv", std::ios::trunc);
+    replay(events, manager, db_path, nodes, node_root, repair_interval_ms, state, res, timeline);
+
+    // 仍然离线的节点上的数据暂时不可用；全部恢复在线后仍无法解码的才是丢失
+    const int k = cfg.k;
+    manager.scan_segments([&](const std::string &, int, int r)
+                          {
+                              if (r < k)
+                              {
+                                  res.unavailable_at_end++;
+                              }
+                          });
+    for (const auto &node_id : nodes)
+    {
+        manager.set_node_online(node_id, true);
+    }
+    manager.scan_segments([&](const std::string &, int, int r)
+                          {
+                              if (r < k)
+                              {
+                                  res.lost_segments++;
+                              }
+                          });
+    for (const auto &input : inputs)
+    {
+        if (!same_as_file(manager.download_file(input), input, cfg.file_size))
+        {
+            res.lost_files++;
+        }
+    }
+
+    const storj::metrics::histogram &ttr = storj::metrics::instance().get_histogram("churn.time_to_repair");
+    printf("churn replay: %d events (%d down, %d fail) in %.3f s, %d repair rounds\n", res.events, res.down_events,
+           res.fail_events, res.replay_s, res.repair_rounds);
+    printf("repaired %lld segments, %lld recovered by nodes returning, repair traffic read %lld bytes, write %lld bytes\n",
+           res.repaired_segments, res.recovered_segments, res.repair_read_bytes, res.repair_write_bytes);
+    printf("time to repair: p50 %lld ms, p99 %lld ms, max %lld ms; max backlog %lld, max unavailable %lld\n",
+           ttr.percentile(0.5) / 1000000, ttr.percentile(0.99) / 1000000, ttr.get_max() / 1000000, res.max_backlog,
+           res.max_unavailable);
+    printf("unavailable at end %lld segments, lost %lld segments, %d of %d files differ: %s\n", res.unavailable_at_end,
+           res.lost_segments, res.lost_files, files, res.lost_files == 0 ? "Same" : "!!! DATA LOSS !!!");
+
+    const std::string &summary_path = output + "_summary.csv";
+    const bool header = std::ifstream(summary_path).peek() == std::ifstream::traits_type::eof();
+    std::ofstream summary(summary_path, std::ios::app);
+    if (!summary)
+    {
+        perror("Failed to write churn summary");
+        return 1;
+    }
+    if (header)
+    {
+        summary << "trace,files,file_size,segment_size,stripe_size,k,m,n,repair_interval_ms,events,down_events,"
+                   "fail_events,replay_s,repair_rounds,repaired_segments,recovered_segments,repair_read_bytes,"
+                   "repair_write_bytes,ttr_count,ttr_p50_ms,ttr_p90_ms,ttr_p99_ms,ttr_max_ms,max_backlog,"
+                   "max_unavailable,unavailable_at_end,lost_segments,lost_files\n";
+    }
+    summary << trace_arg << "," << files << "," << cfg.file_size << "," << cfg.segment_size << "," << cfg.stripe_size
+            << "," << cfg.k << "," << cfg.m << "," << cfg.n << "," << repair_interval_ms << "," << res.events << ","
+            << res.down_events << "," << res.fail_events << "," << res.replay_s << "," << res.repair_rounds << ","
+            << res.repaired_segments << "," << res.recovered_segments << "," << res.repair_read_bytes << ","
+            << res.repair_write_bytes << "," << ttr.get_count() << "," << ttr.percentile(0.5) / 1000000.0 << ","
+            << ttr.percentile(0.9) / 1000000.0 << "," << ttr.percentile(0.99) / 1000000.0 << ","
+            << ttr.get_max() / 1000000.0 << "," << res.max_backlog << "," << res.max_unavailable << ","
+            << res.unavailable_at_end << "," << res.lost_segments << "," << res.lost_files << "\n";
+    storj::metrics::instance().dump(storj::config::metrics_file);
+    return 0;
+}
@@ -0,0 +1,293 @@
+//
+// 进程内的实验驱动：按参数表逐个配置上传、下载、注入故障、扫描修复，结果汇总到一张表，
+// 代替 wait.sh / total_run.sh 每个配置重新启动进程、删表、删目录、解析日志的做法
+//
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "harness_util.h"
+#include "storj/config.h"
+#include "storj/data_manager.h"
+#include "storj/memory.h"
+#include "storj/metrics.h"
+#include "storj/thread_pool.h"
+
+/**
+ * 参数表的一行，前 6 列与 total_run.sh 的参数相同
+ */
+struct experiment
+{
+    int line;
+    int file_size;
+    int segment_size;
+    int stripe_size;
+    int k;
+    int m;
+    int n;
+    // 上传后清空的存储节点数，与 remove_piece.py 相同，只选择存有 pieces 的节点
+    int failed_nodes = 1;
+    int repetitions = 1;
+};
+
+struct experiment_result
+{
+    experiment e;
+    int repetition;
+    double upload_s = 0;
+    double download_s = 0;
+    double repair_s = 0;
+    // 第一轮修复的 segments，即注入故障后损坏且可修复的
+    int corrupted_segments = 0;
+    int repaired_segments = 0;
+    int scan_rounds = 0;
+    bool verified = false;
+    bool verified_after_repair = false;
+    long long peak_memory_bytes = 0;
+};
+
+std::mutex print_mutex;
+
+/**
+ * 每行: file_size segment_size stripe_size k m n [failed_nodes] [repetitions]，# 之后为注释
+ */
+std::vector<experiment> parse_spec(const std::string &path)
+{
+    std::vector<experiment> res;
+    std::ifstream in(path);
+    if (!in)
+    {
+        perror("Failed to open experiment spec");
+        return res;
+    }
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        experiment e;
+        e.line = line_number;
+        if (!(iss >> e.file_size >> e.segment_size >> e.stripe_size >> e.k >> e.m >> e.n))
+        {
+            if (line.find_first_not_of(" \t\r") != std::string::npos)
+            {
+                printf("experiment spec line %d: expected file_size segment_size stripe_size k m n\n", line_number);
+            }
+            continue;
+        }
+        iss >> e.failed_nodes >> e.repetitions;
+        res.push_back(e);
+    }
+    return res;
+}
+
+/**
+ * 清空 count 个存有 pieces 的节点目录
+ */
+int fail_nodes(const std::string &node_root, int count, unsigned seed)
+{
+    std::vector<std::string> nodes;
+    DIR *root = opendir(node_root.c_str());
+    if (root == nullptr)
+    {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(root)) != nullptr)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        const std::string &node = node_root + entry->d_name;
+        DIR *dir = opendir(node.c_str());
+        if (dir == nullptr)
+        {
+            continue;
+        }
+        struct dirent *piece;
+        while ((piece = readdir(dir)) != nullptr && piece->d_name[0] == '.')
+        {
+        }
+        if (piece != nullptr)
+        {
+            nodes.push_back(node);
+        }
+        closedir(dir);
+    }
+    closedir(root);
+    std::sort(nodes.begin(), nodes.end());
+    std::shuffle(nodes.begin(), nodes.end(), std::mt19937(seed));
+    int failed = 0;
+    for (int i = 0; i < count && i < nodes.size(); i++)
+    {
+        remove_tree(nodes[i]);
+        mkdir(nodes[i].c_str(), 0755);
+        failed++;
+    }
+    return failed;
+}
+
+/**
+ * 在独立的目录中运行一次实验，结束后删除该目录
+ * @param root 本次实验的目录，以 / 结尾
+ */
+experiment_result run_experiment(const experiment &e, int repetition, const std::string &root, bool keep)
+{
+    experiment_result res;
+    res.e = e;
+    res.repetition = repetition;
+    storj::memory::operation op("experiment");
+    remove_tree(root);
+    if (mkdir(root.c_str(), 0755) == -1)
+    {
+        perror("Failed to create experiment directory");
+        return res;
+    }
+    const std::string &input = root + "datatest_2.txt";
+    const unsigned seed = e.line * 1000 + repetition;
+    if (!create_file(input, e.file_size, seed))
+    {
+        return res;
+    }
+
+    storj::config cfg;
+    cfg.file_size = e.file_size;
+    cfg.segment_size = e.segment_size;
+    cfg.stripe_size = e.stripe_size;
+    cfg.k = e.k;
+    cfg.m = e.m;
+    cfg.n = e.n;
+    cfg.erasure_share_size = 0;
+    cfg.piece_size = 0;
+    {
+        storj::data_manager manager(root + "storj.db", root + "storage_nodes/");
+        auto start = std::chrono::steady_clock::now();
+        manager.upload_file(input, cfg);
+        res.upload_s = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        res.verified = same_as_file(manager.download_file(input), input, e.file_size);
+        res.download_s = seconds_since(start);
+
+        // 注入故障后扫描修复，直到一轮没有修复任何 segment
+        fail_nodes(root + "storage_nodes/", e.failed_nodes, seed);
+        start = std::chrono::steady_clock::now();
+        while (res.scan_rounds < 10)
+        {
+            // 先抽样审计，只全量审计丢失率超过阈值的节点，一轮没有修复任何 segment 时结束
+            const int repaired = manager.sample_and_repair(1024);
+            res.scan_rounds++;
+            if (res.scan_rounds == 1)
+            {
+                res.corrupted_segments = repaired;
+            }
+            res.repaired_segments += repaired;
+            if (repaired == 0)
+            {
+                break;
+            }
+        }
+        res.repair_s = seconds_since(start);
+        res.verified_after_repair = same_as_file(manager.download_file(input), input, e.file_size);
+    }
+    res.peak_memory_bytes = op.peak();
+    if (!keep)
+    {
+        remove_tree(root);
+    }
+    return res;
+}
+
+bool write_results(const std::string &path, const std::vector<experiment_result> &results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        perror("Failed to write experiment results");
+        return false;
+    }
+    out << "line,file_size,segment_size,stripe_size,k,m,n,failed_nodes,repetition,upload_s,upload_MBps,download_s,"
+           "download_MBps,corrupted_segments,repaired_segments,scan_rounds,repair_s,verified,verified_after_repair,"
+           "peak_memory_bytes\n";
+    for (const auto &r : results)
+    {
+        const double mb = r.e.file_size / 1024.0 / 1024.0;
+        out << r.e.line << "," << r.e.file_size << "," << r.e.segment_size << "," << r.e.stripe_size << "," << r.e.k
+            << "," << r.e.m << "," << r.e.n << "," << r.e.failed_nodes << "," << r.repetition << "," << r.upload_s
+            << "," << (r.upload_s > 0 ? mb / r.upload_s : 0) << "," << r.download_s << ","
+            << (r.download_s > 0 ? mb / r.download_s : 0) << "," << r.corrupted_segments << "," << r.repaired_segments
+            << "," << r.scan_rounds << "," << r.repair_s << "," << r.verified << "," << r.verified_after_repair << ","
+            << r.peak_memory_bytes << "\n";
+    }
+    return true;
+}
+
+/**
+ * 用法: storj_experiment_runner spec [results.csv] [jobs] [work_dir] [keep]
+ * jobs 个配置并行运行，每次实验使用 work_dir 下独立的数据库与存储节点目录；keep 非 0 时保留这些目录
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        puts("usage: storj_experiment_runner spec [results.csv] [jobs] [work_dir] [keep]");
+        puts("spec line: file_size segment_size stripe_size k m n [failed_nodes] [repetitions]");
+        return 1;
+    }
+    const std::vector<experiment> &experiments = parse_spec(argv[1]);
+    const std::string output = argc > 2 ? argv[2] : "experiment_results.csv";
+    const int jobs = argc > 3 ? std::max(1, atoi(argv[3])) : 1;
+    std::string work_dir = argc > 4 ? argv[4] : "experiments";
+    const bool keep = argc > 5 && atoi(argv[5]) != 0;
+    if (work_dir.back() != '/')
+    {
+        work_dir += "/";
+    }
+    mkdir(work_dir.c_str(), 0755);
+    // 实验可能很长，时间线只会占满内存
+    storj::config::trace_spans = false;
+    storj::config::metrics_file = "metrics_experiments.json";
+
+    std::vector<std::pair<experiment, int>> runs;
+    for (const auto &e : experiments)
+    {
+        for (int repetition = 0; repetition < e.repetitions; repetition++)
+        {
+            runs.emplace_back(e, repetition);
+        }
+    }
+    std::vector<experiment_result> results(runs.size());
+    {
+        storj::thread_pool pool(jobs);
+        for (int i = 0; i < runs.size(); i++)
+        {
+            pool.submit([&, i]
+            {
+                const experiment &e = runs[i].first;
+                const std::string &root = work_dir + std::to_string(e.line) + "_" + std::to_string(runs[i].second) + "/";
+                results[i] = run_experiment(e, runs[i].second, root, keep);
+                std::lock_guard<std::mutex> lock(print_mutex);
+                printf("experiment line %d repetition %d: upload %.3f s, download %.3f s, repair %d segments %.3f s, %s\n",
+                       e.line, runs[i].second, results[i].upload_s, results[i].download_s,
+                       results[i].repaired_segments, results[i].repair_s,
+                       results[i].verified && results[i].verified_after_repair ? "Same" : "!!! DIFFERENT !!!");
+            });
+        }
+    }
+    storj::metrics::instance().dump(storj::config::metrics_file);
+    return write_results(output, results) ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+//
+// 实验程序（experiment_runner、catalog_bench、churn_replay）与 selfcheck 共用的文件与计时工具
+//
+
+#ifndef STORJ_EMULATOR_HARNESS_UTIL_H
+#define STORJ_EMULATOR_HARNESS_UTIL_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <ftw.h>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "storj/file.h"
+
+inline double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+/**
+ * 删除目录及其中的全部文件，不存在时忽略
+ */
+inline void remove_tree(const std::string &path)
+{
+    nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * 按块写入随机数据，不在内存中保留整个文件
+ */
+inline bool create_file(const std::string &path, long size, unsigned seed)
+{
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd == -1)
+    {
+        perror("Failed to create file");
+        return false;
+    }
+    std::mt19937 gen(seed);
+    std::vector<char> buf(1 << 20);
+    for (long offset = 0; offset < size; offset += buf.size())
+    {
+        const long n = std::min((long)buf.size(), size - offset);
+        for (long i = 0; i < n; i++)
+        {
+            buf[i] = (char)(gen() & 0xff);
+        }
+        if (write(fd, buf.data(), n) != n)
+        {
+            perror("Failed to write file");
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * 逐个 segment 与源文件比较
+ */
+inline bool same_as_file(const storj::file &f, const std::string &path, long size)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Failed to open file");
+        return false;
+    }
+    std::vector<char> buf;
+    long offset = 0;
+    bool same = true;
+    for (const auto &segment : f.segments)
+    {
+        buf.resize(segment.data.size());
+        if (pread(fd, buf.data(), buf.size(), offset) != (long)buf.size() || !std::equal(buf.begin(), buf.end(), segment.data.begin()))
+        {
+            same = false;
+            break;
+        }
+        offset += buf.size();
+    }
+    close(fd);
+    return same && offset == size;
+}
+
+
+#endif //STORJ_EMULATOR_HARNESS_UTIL_H
@@ -1,62 +1,69 @@
 # coding = utf-8
-import time
-config_dict = {
-    'file_size' : 1
-
-}
-
-
-total_txt = ''
-with open('/home/qwe/Desktop/Re_storj/storjtest/Storj_local/test_data.txt', 'r') as f:
-    total_txt =  f.read()
-    f.close()
-
-
-
-value_array = []
-value_header = []
-
-print("parse begin !!!1")
-total_line = total_txt.strip().split('\n') 
-for index in range(len(total_line)):
-    # print(total_line[index].split(":"))
-    # now_line = total_line[index].split(":")
-    if index == 2:
-         now_line = total_line[index].split(",")
-         print(now_line)
-         for item in now_line:
-             now_split = item.split(":")
-             print(now_split[0].strip(), now_split[1].strip())
-             value_array.append(now_split[1].strip())
-             value_header.append(now_split[0].strip())
-
-    if index == 3 or index == 5 or index == 7  or index == 10 or index == 11:
-        now_line = total_line[index].split(":")
-        print(now_line[0].strip(), now_line[1].strip() + ' ns')
-        
-        value_array.append(now_line[1].strip())
-        value_header.append(now_line[0].strip())
-    
-    if index == 4 or index == 6 or index == 8 or index == 9 or index == 12:
-        now_line = total_line[index].split(":")
-        print(now_line[0].strip(), now_line[1].strip())
-
-        value_array.append(now_line[1].strip())
-        value_header.append(now_line[0].strip())
-print(value_array)
-print(value_header)
-
-# add the value_arry to csv
-
-with open('./test_data.csv', 'aw') as f:
-    f.write(','.join(value_array) + '\n')
-    f.close()
-    # two delete it ! unuse
+# 读取程序输出的计数器与直方图，按指标名取值，追加一行到 test_data.csv
+# 用法: python read_log.py file_size segment_size stripe_size k m n
+# storj_emulator 输出 metrics.json（上传 + 下载），storj_emulator_scan 输出 metrics_scan.json（扫描修复）
+import json
+import os
+import sys
+
+config_names = ['file_size', 'segment_size', 'stripe_size', 'k', 'm', 'n']
+
+# (文件, 直方图)，单位 ns
+phases = [
+    ('metrics.json', 'split_segment'),
+    ('metrics.json', 'encode'),
+    ('metrics.json', 'merge_to_pieces'),
+    ('metrics.json', 'piece_write'),
+    ('metrics.json', 'piece_read'),
+    ('metrics.json', 'decode'),
+    ('metrics.json', 'db.select_pieces_by_segment'),
+    ('metrics_scan.json', 'repair.split_piece'),
+    ('metrics_scan.json', 'repair.decode'),
+    ('metrics_scan.json', 'repair.encode'),
+    ('metrics_scan.json', 'repair.merge_to_pieces'),
+    ('metrics_scan.json', 'repair.total'),
+]
+
+# (文件, 列名, 字节数计数器, 直方图)，吞吐 (MB/s) = 字节数 / 直方图的总时间
+throughputs = [
+    ('metrics.json', 'encode', 'encode.bytes', 'encode'),
+    ('metrics.json', 'decode', 'decode.bytes', 'decode'),
+    ('metrics_scan.json', 'repair', 'repair.bytes', 'repair.total'),
+]
 
-    # file_size , segment_size, stripe_size , k, m, n
 
-    # piece to erasure time
+def load(path):
+    if not os.path.exists(path):
+        print('missing ' + path)
+        return {'counters': {}, 'histograms': {}}
+    with open(path, 'r') as f:
+        return json.load(f)
 
-    # Stripe Decode time
 
-    # stripe 
+metrics = {path: load(path) for path in set(p for p, _ in phases)}
+
+config_values = sys.argv[1:7]
+value_header = config_names[:len(config_values)]
+value_array = list(config_values)
+for path, name in phases:
+    h = metrics[path]['histograms'].get(name, {})
+    for field in ['count', 'sum', 'mean', 'p50', 'p99']:
+        value_header.append(name + '.' + field)
+        value_array.append(str(h.get(field, '')))
+for path, column, bytes_name, histogram_name in throughputs:
+    value_header.append(column + ' MB/s')
+    total_ns = metrics[path]['histograms'].get(histogram_name, {}).get('sum', 0)
+    if total_ns > 0:
+        value_array.append(str(metrics[path]['counters'].get(bytes_name, 0) / 1024.0 / 1024.0 / (total_ns / 1e9)))
+    else:
+        value_array.append('')
+
+for header, value in zip(value_header, value_array):
+    print(header, value)
+
+# 首次写入时加表头
+write_header = not os.path.exists('./test_data.csv')
+with open('./test_data.csv', 'a') as f:
+    if write_header:
+        f.write(','.join(value_header) + '\n')
+    f.write(','.join(value_array) + '\n')
@@ -0,0 +1,3 @@
+# 编解码微基准，前五个参数为逗号分隔的列表：k、m、stripe 大小、丢失的 piece 数、线程数
+# 第 6 个参数为每个组合计时的 segment 数，第 7 个为输出文件（.csv 或 .json），给出第 8 个参数（reram.conf）时同时测 ReRAM 模型
+./storj_bench_codec ${1:-4,8,10,20} ${2:-2,4} ${3:-65536,131072} ${4:-0,1,2} ${5:-1,4} ${6:-50} ${7:-bench_codec.csv} $8
@@ -0,0 +1,3 @@
+# 元数据规模基准：在工作目录中生成合成目录（只有数据库记录，没有 piece 数据），测量扫描、查找与修复排序
+# 参数: 工作目录、piece 数、丢失率、每个文件的 segment 数、k、m、n、查找次数、结果文件（追加一行）
+./storj_catalog_bench ${1:-catalog} ${2:-1000000} ${3:-0.01} ${4:-16} ${5:-4} ${6:-2} ${7:-6} ${8:-1000} ${9:-catalog_bench.csv}
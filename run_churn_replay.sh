@@ -0,0 +1,3 @@
+# 节点流失回放：按事件文件 (time_ms node down|up|fail) 或合成序列回放节点离线、恢复与数据丢失，修复服务同时运行
+# 参数: 事件文件或 synthetic:时长ms:每轮ms:失效率:数据丢失比例:平均离线ms:种子、文件数、file_size segment_size stripe_size k m n、修复间隔ms、输出前缀
+./storj_churn_replay ${1:-synthetic:20000:1000:0.01:0.2:3000:1} ${2:-4} ${3:-1048576} ${4:-262144} ${5:-65536} ${6:-4} ${7:-2} ${8:-6} ${9:-1000} ${10:-churn}
@@ -0,0 +1,3 @@
+# 在一个进程中运行参数表中的全部实验，结果汇总到一张表
+# 参数: 参数表 (默认 experiments.txt)、结果文件、并行运行的实验数、工作目录（每次实验一个子目录，结束后删除）
+./storj_experiment_runner ${1:-experiments.txt} ${2:-experiment_results.csv} ${3:-1} ${4:-experiments}
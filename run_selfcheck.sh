@@ -0,0 +1,3 @@
+# 自检：日志存储截断与压缩后的重放、范围读取、segment 失败后的续传，全部通过时退出码为 0
+# 参数: 工作目录（每次清空重建）
+./storj_selfcheck ${1:-selfcheck}
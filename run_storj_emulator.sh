@@ -3,4 +3,4 @@
 # drop 所有table
 python remove_table.py
 # run main程序
-./storj_emulator $1 $2 $3 $4 $5 $6
+./storj_emulator $1 $2 $3 $4 $5 $6 $7
@@ -0,0 +1,347 @@
+//
+// 自检程序：在工作目录中检查日志存储的截断重放、压缩后重放、范围读取与上传会话在 segment 失败后的续传，
+// 全部通过时返回 0，任一项失败时返回 1
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <functional>
+#include <sqlite3.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "harness_util.h"
+#include "storj/config.h"
+#include "storj/data_manager.h"
+#include "storj/log_store.h"
+
+/**
+ * 日志存储中第 i 个 piece 第 version 次写入的内容，长度随 i 变化
+ */
+std::string piece_data(int i, int version)
+{
+    std::string data(2000 + i * 37 % 3000, 0);
+    for (size_t j = 0; j < data.size(); j++)
+    {
+        data[j] = (char)(i * 131 + version * 17 + j);
+    }
+    return data;
+}
+
+std::string piece_name(int i)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "selfcheck-piece-%020d", i);
+    return name;
+}
+
+/**
+ * 检查 piece 的内容；expected 为空时 piece 应当不存在
+ */
+bool check_piece(const storj::log_store &store, int i, const std::string &expected)
+{
+    storj::piece_buffer data;
+    const bool found = store.read_all(piece_name(i), data);
+    if (expected.empty())
+    {
+        return !found;
+    }
+    return found && std::string(data.begin(), data.end()) == expected && store.verify(piece_name(i));
+}
+
+/**
+ * 写入时崩溃：截掉日志末尾记录的一部分，重放应当丢弃该记录并截断日志，之前的记录与之后的追加都可读
+ */
+bool check_log_truncation(const std::string &dir)
+{
+    const int count = 20;
+    {
+        storj::log_store store(dir, 64L * 1024 * 1024, 0.5);
+        for (int i = 0; i < count; i++)
+        {
+            const std::string &data = piece_data(i, 0);
+            if (!store.append(piece_name(i), data.data(), data.size()))
+            {
+                return false;
+            }
+        }
+    }
+    const std::string &path = dir + "/log_000001.log";
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1 || truncate(path.c_str(), st.st_size - 100) == -1)
+    {
+        perror("selfcheck: Failed to truncate log");
+        return false;
+    }
+    {
+        storj::log_store store(dir, 64L * 1024 * 1024, 0.5);
+        for (int i = 0; i < count - 1; i++)
+        {
+            if (!check_piece(store, i, piece_data(i, 0)))
+            {
+                printf("log truncation: piece %d lost\n", i);
+                return false;
+            }
+        }
+        if (!check_piece(store, count - 1, ""))
+        {
+            puts("log truncation: torn record replayed");
+            return false;
+        }
+        const std::string &data = piece_data(count - 1, 1);
+        store.append(piece_name(count - 1), data.data(), data.size());
+    }
+    storj::log_store store(dir, 64L * 1024 * 1024, 0.5);
+    return check_piece(store, count - 1, piece_data(count - 1, 1));
+}
+
+/**
+ * 覆盖与删除产生垃圾后压缩，压缩前后与重新打开后的内容都应一致，删除的 piece 不会复活
+ */
+bool check_compaction(const std::string &dir)
+{
+    const int count = 300;
+    std::vector<std::string> expected(count);
+    {
+        // 小日志，写入分布在多个日志中
+        storj::log_store store(dir, 128L * 1024, 0.3);
+        for (int i = 0; i < count; i++)
+        {
+            expected[i] = piece_data(i, 0);
+            store.append(piece_name(i), expected[i].data(), expected[i].size());
+        }
+        for (int i = 0; i < count; i += 3)
+        {
+            store.remove(piece_name(i));
+            expected[i].clear();
+        }
+        for (int i = 1; i < count; i += 3)
+        {
+            expected[i] = piece_data(i, 1);
+            store.append(piece_name(i), expected[i].data(), expected[i].size());
+        }
+        const int compacted = store.compact();
+        printf("compaction: %d logs compacted\n", compacted);
+        if (compacted == 0)
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (!check_piece(store, i, expected[i]))
+            {
+                printf("compaction: piece %d differs after compaction\n", i);
+                return false;
+            }
+        }
+    }
+    storj::log_store store(dir, 128L * 1024, 0.3);
+    for (int i = 0; i < count; i++)
+    {
+        if (!check_piece(store, i, expected[i]))
+        {
+            printf("compaction: piece %d differs after replay\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * 读取整个源文件
+ */
+std::string read_source(const std::string &path)
+{
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return data;
+    }
+    char buf[1 << 16];
+    long n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        data.append(buf, n);
+    }
+    close(fd);
+    return data;
+}
+
+storj::config make_config(long size)
+{
+    storj::config cfg;
+    cfg.file_size = size;
+    cfg.segment_size = 65536;
+    cfg.stripe_size = 16384;
+    cfg.erasure_share_size = 0;
+    cfg.piece_size = 0;
+    cfg.k = 4;
+    cfg.m = 2;
+    cfg.n = 6;
+    return cfg;
+}
+
+/**
+ * 跨 segment 边界、文件末尾与打包小文件的范围读取，与源文件比较
+ */
+bool check_read_range(storj::data_manager &manager, const std::string &work_dir)
+{
+    const std::string &path = work_dir + "range.dat";
+    const long size = 5 * 65536 + 1234;
+    storj::config cfg = make_config(size);
+    if (!create_file(path, size, 11))
+    {
+        return false;
+    }
+    manager.upload_file(path, cfg);
+    const std::string &small = work_dir + "range_small.dat";
+    storj::config small_cfg = make_config(3000);
+    small_cfg.pack_small_files = true;
+    if (!create_file(small, 3000, 12))
+    {
+        return false;
+    }
+    manager.upload_file(small, small_cfg);
+    manager.flush_packs();
+
+    const std::string &data = read_source(path);
+    const long ranges[][2] = {{0, 100}, {65536 - 10, 20}, {100000, 150000}, {size - 50, 500}, {0, size}};
+    for (const auto &range : ranges)
+    {
+        const std::vector<char> &res = manager.read_range(path, range[0], range[1]);
+        const std::string &expected = data.substr(range[0], range[1]);
+        if (std::string(res.begin(), res.end()) != expected)
+        {
+            printf("read range: [%ld, +%ld) differs, %d bytes read\n", range[0], range[1], (int)res.size());
+            return false;
+        }
+    }
+    const std::vector<char> &res = manager.read_range(small, 1000, 500);
+    if (std::string(res.begin(), res.end()) != read_source(small).substr(1000, 500))
+    {
+        puts("read range: packed object differs");
+        return false;
+    }
+    return manager.read_range(path, size + 10, 10).empty();
+}
+
+/**
+ * 存储节点 id，来自数据库
+ */
+std::vector<std::string> node_ids(const std::string &db_path)
+{
+    std::vector<std::string> res;
+    sqlite3 *db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return res;
+    }
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "select \"id\" from \"storage_node\";", -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            res.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return res;
+}
+
+/**
+ * 上传会话在第一个 segment 提交后让全部节点离线，之后的 segment 失败；
+ * 节点恢复后续传应完成上传，下载内容与源文件一致，会话结束
+ */
+bool check_resume(storj::data_manager &manager, const std::string &work_dir, const std::string &db_path)
+{
+    const std::string &path = work_dir + "resume.dat";
+    const long size = 6 * 65536 + 777;
+    storj::config cfg = make_config(size);
+    if (!create_file(path, size, 13))
+    {
+        return false;
+    }
+    const std::vector<std::string> &nodes = node_ids(db_path);
+    const std::string &session_id = manager.begin_upload(path, cfg);
+    if (session_id.empty())
+    {
+        return false;
+    }
+    // 第一个 segment 提交后注入失败；节点加上延迟，让续传不会在注入之前全部完成
+    std::atomic<bool> finished(false);
+    std::thread injector([&] {
+        while (!finished && manager.uploaded_segments(session_id).empty())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (const auto &node : nodes)
+        {
+            manager.set_node_online(node, false);
+        }
+    });
+    for (const auto &node : nodes)
+    {
+        manager.set_node_delay(node, 5);
+    }
+    const bool first = manager.resume_upload(session_id);
+    finished = true;
+    injector.join();
+    const int committed = manager.uploaded_segments(session_id).size();
+    printf("resume: first attempt %s, %d segments committed\n", first ? "completed" : "failed", committed);
+    for (const auto &node : nodes)
+    {
+        manager.set_node_delay(node, 0);
+        manager.set_node_online(node, true);
+    }
+    if (first || !manager.download_file(path).segments.empty())
+    {
+        puts("resume: failed segment did not stop the upload");
+        return false;
+    }
+    if (!manager.resume_upload(session_id))
+    {
+        puts("resume: upload not completed after nodes came back");
+        return false;
+    }
+    return same_as_file(manager.download_file(path), path, size) && manager.uploaded_segments(session_id).empty() &&
+           !manager.resume_upload(session_id);
+}
+
+int main(int argc, char **argv)
+{
+    std::string work_dir = argc > 1 ? argv[1] : "selfcheck";
+    if (work_dir.back() != '/')
+    {
+        work_dir += "/";
+    }
+    storj::config::trace_spans = false;
+    storj::config::metrics_file = work_dir + "metrics_selfcheck.json";
+    remove_tree(work_dir);
+    mkdir(work_dir.c_str(), 0755);
+
+    int failed = 0;
+    auto run = [&](const char *name, const std::function<bool()> &check) {
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = check();
+        printf("%-24s %s (%.3f s)\n", name, ok ? "OK" : "FAILED", seconds_since(start));
+        failed += ok ? 0 : 1;
+    };
+    run("log truncation replay", [&] { return check_log_truncation(work_dir + "log_truncation"); });
+    run("compaction replay", [&] { return check_compaction(work_dir + "log_compaction"); });
+    {
+        const std::string &db_path = work_dir + "storj.db";
+        storj::data_manager manager(db_path, work_dir + "storage_nodes/");
+        run("read range", [&] { return check_read_range(manager, work_dir); });
+        run("resume after failure", [&] { return check_resume(manager, work_dir, db_path); });
+    }
+    printf("selfcheck: %d failed\n", failed);
+    return failed == 0 ? 0 : 1;
+}
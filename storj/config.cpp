@@ -1,11 +1,31 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#include "config.h"
-
-double storj::config::failure_rate = 0.5;
-int storj::config::total_nodes = 100;
-double storj::config::min_churn_per_round = 1e-10;
-
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#include "config.h"
+
+double storj::config::failure_rate = 0.5;
+int storj::config::total_nodes = 100;
+double storj::config::min_churn_per_round = 1e-10;
+long long storj::config::segment_cache_size = 256LL * 1024 * 1024;
+bool storj::config::log_structured_store = false;
+long storj::config::log_file_size = 64L * 1024 * 1024;
+double storj::config::log_compact_ratio = 0.5;
+bool storj::config::durable_writes = false;
+int storj::config::group_commit_size = 64;
+int storj::config::upload_threads = 16;
+int storj::config::read_connections = 8;
+int storj::config::pending_timeout_ms = 60000;
+bool storj::config::repair_on_read = false;
+int storj::config::audit_sample_size = 16;
+int storj::config::audit_deep_sample_size = 2;
+double storj::config::audit_loss_threshold = 0.02;
+double storj::config::audit_confidence_z = 1.96;
+bool storj::config::reram_backend = false;
+std::string storj::config::reram_param_file = "reram.conf";
+std::string storj::config::metrics_file = "metrics.json";
+bool storj::config::trace_spans = true;
+std::string storj::config::trace_file = "trace.json";
+long long storj::config::memory_budget = 0;
+
 storj::config::config() = default;
\ No newline at end of file
@@ -1,37 +1,94 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#ifndef STORJ_EMULATOR_CONFIG_H
-#define STORJ_EMULATOR_CONFIG_H
-
-
-namespace storj
-{
-    struct config
-    {
-        int file_size;
-        int segment_size;
-        int stripe_size;
-        int erasure_share_size;
-        int piece_size;
-        int k;
-        int m;
-        int n;
-
-        
-
-        // n -> < 
-
-        static double failure_rate;
-        static int total_nodes;
-        static double min_churn_per_round;
-
-        config();
-        void set_erasure_share_size(int n) {
-            erasure_share_size = n;
-        }
-    };
-}
-
-#endif //STORJ_EMULATOR_CONFIG_H
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#ifndef STORJ_EMULATOR_CONFIG_H
+#define STORJ_EMULATOR_CONFIG_H
+
+
+#include <string>
+
+namespace storj
+{
+    struct config
+    {
+        int file_size;
+        int segment_size;
+        int stripe_size;
+        int erasure_share_size;
+        int piece_size;
+        int k;
+        int m;
+        int n;
+
+        // 小文件打包：小于 segment_size 的文件追加到共享 segment 中
+        bool pack_small_files = false;
+        // 共享 segment 打开超过该时长 (ms) 后由后台线程封装编码，封装失败时同样间隔后重试
+        int pack_timeout_ms = 1000;
+        // 小文件先写入数据库的 staged_object 表再返回，封装前崩溃时重启后重新打包；
+        // 关闭时封装前只存在于内存，需要持久化时调用 flush_packs()
+        bool stage_small_files = true;
+        // stripe 对齐补 0 占实际数据的比例上限，据此选择 packetsize；
+        // 小于 0 表示基线版本的布局（packetsize 8，整个 stripe_size 补齐到 k * w * packetsize * sizeof(long)），用于迁移的旧文件
+        double max_padding_ratio = 0.05;
+        // 每个 segment 写完该数量的 pieces 即确认，其余 pieces 后台完成；0 表示等待全部 n 个
+        int upload_quorum = 0;
+        // 长尾上传：多编码并上传该数量的 pieces，保留最先写完的 n 个
+        int long_tail_extra = 0;
+
+
+        // n -> < 
+
+        static double failure_rate;
+        static int total_nodes;
+        static double min_churn_per_round;
+        // 解码后 segment 缓存的容量 (bytes)，0 表示关闭
+        static long long segment_cache_size;
+        // 每个 storage node 的 pieces 追加写入日志文件，而不是一个 piece 一个文件
+        static bool log_structured_store;
+        // 单个日志文件的大小上限 (bytes)
+        static long log_file_size;
+        // 日志中已删除数据占比达到该值时压缩
+        static double log_compact_ratio;
+        // 持久化写入：pieces 按组 fdatasync 落盘后才提交数据库事务
+        static bool durable_writes;
+        // 组提交攒批的 piece 数
+        static int group_commit_size;
+        // 并行上传 pieces 的线程数
+        static int upload_threads;
+        // 保留的空闲只读数据库连接数
+        static int read_connections;
+        // 未写入目录的 pending piece 超过该时长 (ms) 视为崩溃遗留，由清理回收
+        static int pending_timeout_ms;
+        // 降级读取解码出整个 segment 后，顺便补齐缺失的 pieces
+        static bool repair_on_read;
+        // 抽样审计：每轮每个节点审计的 piece 数
+        static int audit_sample_size;
+        // 其中读出全部数据校验 CRC 的 piece 数，仅日志存储支持
+        static int audit_deep_sample_size;
+        // 节点丢失率的置信下界超过该值时全量审计该节点
+        static double audit_loss_threshold;
+        // 置信区间的正态分位数
+        static double audit_confidence_z;
+
+        // 编解码由 ReRAM 模型完成，同时实测 Jerasure 作对照
+        static bool reram_backend;
+        // ReRAM 模型的参数文件
+        static std::string reram_param_file;
+        // 计数器与直方图的输出文件，以 .csv 结尾时输出 CSV，否则输出 JSON
+        static std::string metrics_file;
+        // 记录 trace span，开销很小，默认开启
+        static bool trace_spans;
+        // Chrome trace-event 格式的时间线输出文件
+        static std::string trace_file;
+        // 同时处理中的 segments 预估占用的内存上限 (bytes)，超出时新的 segment 等待，0 表示不限制
+        static long long memory_budget;
+
+        config();
+        void set_erasure_share_size(int n) {
+            erasure_share_size = n;
+        }
+    };
+}
+
+#endif //STORJ_EMULATOR_CONFIG_H
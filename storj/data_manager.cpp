@@ -1,1033 +1,3839 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#include <algorithm>
-#include <fcntl.h>
-#include <sqlite3.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <iostream>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
-#include <fstream>
-#include "config.h"
-#include "data_manager.h"
-#include "data_processor.h"
-#include "file.h"
-#include "time.h"
-using namespace storj;
-
-data_manager::data_manager()
-{
-    init();
-}
-
-data_manager::~data_manager()
-{
-    // 关闭数据库
-    sqlite3_close_v2(sql);
-}
-
-void data_manager::init()
-{
-    // 初始化数据库
-    init_db();
-    // 初始化存储节点
-    init_storage_nodes();
-}
-
-long gettimens()
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    return ts.tv_sec * 1000000000 + ts.tv_nsec;
-}
-
-void data_manager::init_db()
-{
-    const char *sql_create_table_file = "create table if not exists \"file\"\n"
-                                        "(\n"
-                                        "    \"id\"                 varchar(64) primary key not null,\n"
-                                        "    \"file_name\"          varchar(255)            not null,\n"
-                                        "    \"file_size\"          int(11)                 not null,\n"
-                                        "    \"segment_size\"       int(11)                 not null,\n"
-                                        "    \"stripe_size\"        int(11)                 not null,\n"
-                                        "    \"erasure_share_size\" int(11)                 not null,\n"
-                                        "    \"k\"                  int(11)                 not null,\n"
-                                        "    \"m\"                  int(11)                 not null,\n"
-                                        "    \"n\"                  int(11)                 not null\n"
-                                        ");";
-    const char *sql_create_table_segment = "create table if not exists \"segment\"\n"
-                                           "(\n"
-                                           "    \"id\"      varchar(64) primary key not null,\n"
-                                           "    \"index\"   int(11)                 not null,\n"
-                                           "    \"file_id\" varchar(64)             not null\n"
-                                           ");";
-    const char *sql_create_table_piece = "create table if not exists \"piece\"\n"
-                                         "(\n"
-                                         "    \"id\"              varchar(64) primary key not null,\n"
-                                         "    \"index\"           int(11)                 not null,\n"
-                                         "    \"segment_id\"      varchar(64)             not null,\n"
-                                         "    \"storage_node_id\" int(11)                 not null\n"
-                                         ");";
-    const char *sql_create_table_storage_node = "create table if not exists \"storage_node\"\n"
-                                                "(\n"
-                                                "    \"id\" varchar(64) primary key not null\n"
-                                                ");";
-    // 打开数据库
-    sqlite3_open_v2("storj.db", &sql, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_SHAREDCACHE, nullptr);
-    std::cout << "drop table !!!! \n"
-              << std::endl;
-    // sqlite3_exec(sql, "drop table file;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table segment;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table piece;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table storage_node;", nullptr, nullptr, nullptr);
-
-    sqlite3_exec(sql, sql_create_table_file, nullptr, nullptr, nullptr);
-    sqlite3_exec(sql, sql_create_table_segment, nullptr, nullptr, nullptr);
-    sqlite3_exec(sql, sql_create_table_piece, nullptr, nullptr, nullptr);
-
-    sqlite3_exec(sql, sql_create_table_storage_node, nullptr, nullptr, nullptr);
-}
-
-void data_manager::init_storage_nodes()
-{
-    // 添加数据库记录
-    int node_count;
-    {
-        const char *sql_select = "select count(1)\n"
-                                 "from \"storage_node\";";
-        sqlite3_stmt *stmt;
-        sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr);
-        sqlite3_step(stmt);
-        node_count = sqlite3_column_int(stmt, 0);
-        sqlite3_finalize(stmt);
-    }
-    // 补足节点数量
-    for (int i = node_count; i < storage_node_num; i++)
-    {
-        boost::uuids::random_generator uuid_v4;
-        const std::string &node_id = to_string(uuid_v4());
-        const char *sql_insert = "insert into \"storage_node\"(\"id\")\n"
-                                 "values (?);";
-        sqlite3_stmt *stmt;
-        sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
-        sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
-    }
-    // 查出所有节点，加入到 set 中
-    {
-        boost::uuids::string_generator sg;
-        const char *sql_select = "select \"id\"\n"
-                                 "from \"storage_node\";";
-        sqlite3_stmt *stmt;
-        sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr);
-        while (sqlite3_step(stmt) == SQLITE_ROW)
-        {
-            const boost::uuids::uuid &node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
-            storage_nodes.emplace(node_id);
-        }
-        sqlite3_finalize(stmt);
-    }
-    // 创建目录
-    mkdir(storage_node_base_path.c_str(), 0755);
-    for (const auto &node : storage_nodes)
-    {
-        mkdir(get_storage_node_path(node).c_str(), 0755);
-    }
-}
-
-std::string data_manager::get_storage_node_path(const storage_node &node)
-{
-    return get_storage_node_path(to_string(node.id));
-}
-
-std::string data_manager::get_storage_node_path(const std::string &node_id)
-{
-    return storage_node_base_path + node_id;
-}
-
-std::string data_manager::get_piece_path(const std::string &node_id, const std::string &piece_id)
-{
-    return get_storage_node_path(node_id) + "/" + piece_id;
-}
-
-std::string data_manager::get_piece_path(const std::string &piece_id)
-{
-    const piece &piece = db_select_piece(piece_id);
-    return get_piece_path(to_string(piece.storage_node_id), piece_id);
-}
-
-void data_manager::db_insert_file(const file &f)
-{
-    const std::string &file_id = to_string(f.id);
-    const char *sql_insert = "insert into \"file\"(\"id\", \"file_name\", \"file_size\", \"segment_size\", \"stripe_size\", \"erasure_share_size\", \"k\", \"m\", \"n\")\n"
-                             "values (?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
-    sqlite3_bind_text(stmt, 2, f.name.c_str(), f.name.length(), nullptr);
-    sqlite3_bind_int(stmt, 3, f.cfg.file_size);
-    sqlite3_bind_int(stmt, 4, f.cfg.segment_size);
-    sqlite3_bind_int(stmt, 5, f.cfg.stripe_size);
-    sqlite3_bind_int(stmt, 6, f.cfg.erasure_share_size);
-    sqlite3_bind_int(stmt, 7, f.cfg.k);
-    sqlite3_bind_int(stmt, 8, f.cfg.m);
-    sqlite3_bind_int(stmt, 9, f.cfg.n);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_insert_segment(const segment &s)
-{
-    const std::string &segment_id = to_string(s.id);
-    const std::string &file_id = to_string(s.file_id);
-    const char *sql_insert = "insert into \"segment\"(\"id\", \"index\", \"file_id\")\n"
-                             "values (?, ?, ?);";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
-    sqlite3_bind_int(stmt, 2, s.index);
-    sqlite3_bind_text(stmt, 3, file_id.c_str(), file_id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_insert_erasure_share(const erasure_share &es)
-{
-    const std::string &erasure_share_id = to_string(es.id);
-    const std::string &stripe_id = to_string(es.stripe_id);
-    const std::string &piece_id = to_string(es.piece_id);
-    const char *sql_insert = "insert into \"erasure_share\"(\"id\", \"x_index\", \"y_index\", \"stripe_id\", \"piece_id\")\n"
-                             "values (?, ?, ?, ?, ?);";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, piece_id.c_str(), erasure_share_id.length(), nullptr);
-    sqlite3_bind_int(stmt, 2, es.x_index);
-    sqlite3_bind_int(stmt, 3, es.y_index);
-    sqlite3_bind_text(stmt, 4, stripe_id.c_str(), stripe_id.length(), nullptr);
-    sqlite3_bind_text(stmt, 5, piece_id.c_str(), piece_id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_insert_piece(const piece &p)
-{
-    const std::string &piece_id = to_string(p.id);
-    const std::string &segment_id = to_string(p.segment_id);
-    const std::string &storage_node_id = to_string(p.storage_node_id);
-    const char *sql_insert = "insert into \"piece\"(\"id\", \"index\", \"segment_id\", \"storage_node_id\")\n"
-                             "values (?, ?, ?, ?);";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, piece_id.c_str(), piece_id.length(), nullptr);
-    sqlite3_bind_int(stmt, 2, p.index);
-    sqlite3_bind_text(stmt, 3, segment_id.c_str(), segment_id.length(), nullptr);
-    sqlite3_bind_text(stmt, 4, storage_node_id.c_str(), storage_node_id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_stmt_select_file(sqlite3_stmt *stmt, file *file)
-{
-    boost::uuids::string_generator sg;
-    file->id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
-    file->name = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
-    file->cfg.file_size = sqlite3_column_int(stmt, 2);
-    file->cfg.segment_size = sqlite3_column_int(stmt, 3);
-    file->cfg.stripe_size = sqlite3_column_int(stmt, 4);
-    file->cfg.erasure_share_size = sqlite3_column_int(stmt, 5);
-    file->cfg.k = sqlite3_column_int(stmt, 6);
-    file->cfg.m = sqlite3_column_int(stmt, 7);
-    file->cfg.n = sqlite3_column_int(stmt, 8);
-}
-
-file data_manager::db_select_file_by_id(const std::string &id)
-{
-    file res;
-    const char *sql_select = "select *\n"
-                             "from \"file\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        return res;
-    }
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    if (sqlite3_step(stmt) != SQLITE_ROW)
-    {
-        return res;
-    }
-    db_stmt_select_file(stmt, &res);
-    sqlite3_finalize(stmt);
-    return res;
-}
-
-file data_manager::db_select_file_by_name(const std::string &filename)
-{
-    file res;
-    const char *sql_select = "select *\n"
-                             "from \"file\"\n"
-                             "where \"file_name\" = ?;";
-    sqlite3_stmt *stmt;
-    if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        return res;
-    }
-    sqlite3_bind_text(stmt, 1, filename.c_str(), filename.length(), nullptr);
-    if (sqlite3_step(stmt) != SQLITE_ROW)
-    {
-        // res.id = boost::uuids::nil;
-        return res;
-    }
-    db_stmt_select_file(stmt, &res);
-    sqlite3_finalize(stmt);
-    return res;
-}
-
-segment data_manager::db_select_segment(const std::string &id)
-{
-    boost::uuids::string_generator sg;
-    segment res;
-    const char *sql_select = "select *\n"
-                             "from \"segment\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        return res;
-    }
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    sqlite3_step(stmt);
-    res.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
-    res.index = sqlite3_column_int(stmt, 1);
-    res.file_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
-    sqlite3_finalize(stmt);
-    return res;
-}
-
-piece data_manager::db_select_piece(const std::string &id)
-{
-    boost::uuids::string_generator sg;
-    piece res;
-    const char *sql_select = "select *\n"
-                             "from \"piece\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        return res;
-    }
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    sqlite3_step(stmt);
-    res.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
-    res.index = sqlite3_column_int(stmt, 1);
-    res.segment_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
-    res.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 3)));
-    sqlite3_finalize(stmt);
-    return res;
-}
-
-void data_manager::db_remove_file_by_id(const std::string &id)
-{
-    const char *sql_remove = "delete\n"
-                             "from \"file\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_remove_file_by_name(const std::string &name)
-{
-    const char *sql_remove = "delete\n"
-                             "from \"file\"\n"
-                             "where \"name\" = ?;";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, name.c_str(), name.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_remove_segment(const std::string &id)
-{
-    const char *sql_remove = "delete\n"
-                             "from \"segment\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::db_remove_piece(const std::string &id)
-{
-    const char *sql_remove = "delete\n"
-                             "from \"piece\"\n"
-                             "where \"id\" = ?;";
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void data_manager::upload_piece(const piece &p, const storage_node &node)
-{
-    const std::string &piece_path = get_piece_path(to_string(node.id), to_string(p.id));
-    // 创建文件
-    int fd = open(piece_path.c_str(), O_CREAT | O_EXCL | O_RDWR);
-    if (fd == -1)
-    {
-        perror("upload piece: Failed to open file");
-        return;
-    }
-    // 写内容
-    const int unit = 16 << 10;
-    for (int i = 0; i < p.data.size(); i += unit)
-    {
-        int n = std::min(unit, (int)p.data.size() - i);
-        if (write(fd, p.data.data() + i, n) <= 0)
-        {
-            perror("upload piece: Failed to write file");
-            return;
-        }
-    }
-    // 关闭文件
-    close(fd);
-}
-
-piece data_manager::download_piece(const std::string &piece_id)
-{
-    piece piece = db_select_piece(piece_id);
-    const std::string &piece_path = get_piece_path(to_string(piece.storage_node_id), to_string(piece.id));
-    // 创建文件
-    int fd = open(piece_path.c_str(), O_RDONLY);
-    if (fd == -1)
-    {
-        perror("download piece: Failed to open file");
-        return piece;
-    }
-    // 读内容
-    const int unit = 16 << 10;
-    char buf[unit];
-    int i = 0;
-    int n;
-    while ((n = read(fd, buf, unit)) > 0)
-    {
-        piece.data.insert(piece.data.end(), buf, buf + n);
-        i += n;
-    }
-    // 关闭文件
-    close(fd);
-    return piece;
-}
-
-void data_manager::remove_piece(const std::string &piece_id)
-{
-    const std::string &path = get_piece_path(piece_id);
-    if (remove(path.c_str()) == -1)
-    {
-        perror("remove piece: Failed to remove piece file");
-        db_remove_piece(piece_id);
-        return;
-    }
-    db_remove_piece(piece_id);
-}
-
-bool data_manager::audit_piece(const std::string &piece_id)
-{
-    piece piece = db_select_piece(piece_id);
-    const std::string &piece_path = get_piece_path(to_string(piece.storage_node_id), to_string(piece.id));
-    int fd = open(piece_path.c_str(), O_RDONLY);
-    if (fd <= 0)
-    {
-        return false;
-    }
-    close(fd);
-    return true;
-}
-
-/**
- * 以指定 (k, m, n) 等配置上传指定文件
- * <ol>
- * <li> 读取 file 内容，切割成 segments
- * <li> 遍历 segments，切割成 stripes
- * <li> 遍历 stripes，纠删编码为 erasure shares
- * <li> 组合 erasure shares，拼接成 pieces
- * <li> pieces 分发到各个 storage nodes
- * </ol>
- * @param filename 文件名
- * @param cfg 配置
- */
-void data_manager::upload_file(const std::string &filename, config &cfg)
-{
-
-    // 判断是否有同名文件
-    std::cout << filename << std::endl;
-    const file &record = db_select_file_by_name(filename);
-    std::cout << record.id << std::endl;
-    std::cout << record.name << std::endl;
-    if (record.name == filename)
-    {
-        puts("存在同名文件，无法上传");
-        return;
-    }
-
-    try
-    {
-        // 开始数据库事务
-        sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
-
-        data_processor dp(cfg);
-
-        // 随机生成 ID，记录数据对应关系到数据库
-        boost::uuids::random_generator uuid_v4;
-        file file(filename, cfg);
-        file.id = uuid_v4();
-        db_insert_file(file);
-
-        // 读文件，切割成 segment 并遍历
-        std::vector<segment> segments = dp.split_file(file);
-        for (int segment_index = 0; segment_index < segments.size(); segment_index++)
-        {
-            // printf("segment index: %d\n", segment_index);
-            segment &segment = segments[segment_index];
-            // segment id
-            segment.id = uuid_v4();
-            segment.index = segment_index;
-            segment.file_id = file.id;
-            db_insert_segment(segment);
-            // 切割成 stripes 并遍历
-            // puts("split segment");
-            std::vector<stripe> stripes = dp.split_segment(segment);
-            std::vector<std::vector<erasure_share>> s;
-            s.reserve(stripes.size());
-            for (auto &stripe : stripes)
-            {
-                // 编码成 erasure shares，该数组为纵向
-                std::vector<erasure_share> shares = dp.erasure_encode(stripe);
-                s.emplace_back(shares);
-            }
-
-            // erasure shares 横向合并成 pieces
-            // puts("merge to pieces");
-            std::vector<piece> pieces = dp.merge_to_pieces(s);
-            for (int piece_index = 0; piece_index < pieces.size(); piece_index++)
-            {
-                piece &piece = pieces[piece_index];
-                // piece id
-                piece.id = uuid_v4();
-                piece.index = piece_index;
-                piece.segment_id = segment.id;
-                for (auto &share : piece.erasure_shares)
-                {
-                    share.piece_id = piece.id;
-                }
-            }
-
-            // 上传 pieces 到各个存储节点
-            auto piece = pieces.begin();
-            auto storage_node = storage_nodes.begin();
-            while (piece != pieces.end())
-            {
-                piece->storage_node_id = storage_node->id;
-                upload_piece(*piece, *storage_node);
-                // printf("upload piece id: %s\n", to_string(piece->id).c_str());
-                db_insert_piece(*piece);
-                piece++;
-                storage_node++;
-                // 遍历到最后一个存储节点后，从第一个重新开始遍历
-                if (storage_node == storage_nodes.end())
-                {
-                    storage_node = storage_nodes.begin();
-                }
-            }
-        }
-    }
-    catch (int e)
-    {
-        // 出现异常，回滚数据库
-        perror("Failed to upload file");
-        sqlite3_exec(sql, "rollback;", nullptr, nullptr, nullptr);
-        return;
-    }
-    // 提交事务
-    sqlite3_exec(sql, "commit;", nullptr, nullptr, nullptr);
-    puts("Upload file: Commit!!");
-}
-
-/**
- * 下载指定文件
- * <ol>
- * <li> 读取数据库，得到 file 元数据
- * <li> 查询 file 对应的 segments
- * <li> 以 segment 为单位，查询对应的 pieces 元数据
- * <li> 从相应的 storage nodes 下载得到 pieces
- * <li> 解析 pieces 为 erasure shares
- * <li> erasure shares 纠删解码成 stripes
- * <li> stripes 拼接成 segments
- * <li> segments 拼接成 file
- * </ol>
- * @param filename 文件名
- * @return 文件
- */
-file data_manager::download_file(const std::string &filename)
-{
-
-    // 从数据库中查出对应的 file 数据
-    file file = db_select_file_by_name(filename);
-    data_processor dp(file.cfg);
-
-    // 从数据库中有序查出对应的 piece 数据
-    // 建立 segment id 到 pieces 的映射
-    boost::uuids::string_generator sg;
-    std::vector<std::pair<std::string, std::vector<piece>>> segment_id_to_pieces;
-    {
-        const char *sql_select = "select \"p\".\"id\",\n"
-                                 "       \"sn\".\"id\",\n"
-                                 "       \"s\".\"id\"\n"
-                                 "from \"file\" \"f\"\n"
-                                 "         left join \"segment\" \"s\" on \"f\".\"id\" = \"s\".\"file_id\"\n"
-                                 "         left join \"piece\" \"p\" on \"s\".\"id\" = \"p\".\"segment_id\"\n"
-                                 "         left join \"storage_node\" \"sn\" on \"sn\".\"id\" = \"p\".\"storage_node_id\"\n"
-                                 "where \"f\".\"file_name\" = ?\n"
-                                 "order by \"s\".\"index\", \"p\".\"index\";";
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-        {
-            return file;
-        }
-        sqlite3_bind_text(stmt, 1, filename.c_str(), filename.length(), nullptr);
-        std::vector<piece> pieces;
-        std::string last_segment_id;
-        while (sqlite3_step(stmt) == SQLITE_ROW)
-        {
-            piece p;
-            p.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
-            p.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 1)));
-            p.segment_id = sg(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
-            pieces.push_back(p);
-            const std::string &segment_id = to_string(p.segment_id);
-            if (last_segment_id != segment_id)
-            {
-                last_segment_id = segment_id;
-                segment_id_to_pieces.emplace_back(segment_id, std::vector<piece>(0));
-            }
-            segment_id_to_pieces.back().second.push_back(p);
-        }
-        sqlite3_finalize(stmt);
-    }
-    printf("segment num: %d\n", segment_id_to_pieces.size());
-
-    // 遍历映射表，以 segment 为单位处理 piece
-    std::vector<segment> segments;
-    for (auto &pair : segment_id_to_pieces)
-    {
-        const std::string &segment_id = pair.first;
-        std::vector<piece> &pieces = pair.second;
-        // 从相应的 storage node 下载 piece data
-        for (auto &piece : pieces)
-        {
-            const std::string &piece_id = to_string(piece.id);
-            // printf("download piece id: %s\n", piece_id.c_str());
-            piece.data = std::move(download_piece(piece_id).data);
-        }
-
-        // 遍历 pieces
-        // 由于数据库查询 piece 时已经排序，此二维数组 erasure share 有序
-        puts("split piece");
-        std::vector<std::vector<erasure_share>> s;
-        for (auto &piece : pieces)
-        {
-            // piece 拆分成 erasure share（横向）
-            std::vector<erasure_share> shares = dp.split_piece(piece);
-            // std::vector<erasure_share> shares;
-            s.emplace_back(shares);
-        }
-
-        puts("merge to stripes");
-        // erasure share decode，纵向拼接成 stripe，赋值元数据
-        std::vector<stripe> stripes = dp.merge_to_stripes(s);
-        // std::cout << stripes.size() << std::endl;
-        // for (const auto c : stripes[0].data) std::cout << c << " ";
-        // std::cout << std::endl;
-        // puts("merge to segment");
-        //  stripe 拼接成 segment，查询出 segment 元数据
-        segment segment = db_select_segment(segment_id);
-        segment.data = std::move(dp.merge_to_segment(stripes).data);
-        // for (const auto c : segment.data) std::cout << c << " ";
-        // std::cout << std::endl;
-        segments.emplace_back(segment);
-    }
-
-    // puts("merge to file");
-    //  segment 拼接成 file
-    // std::cout << segments.size() << std::endl;
-    // for (const auto c : segments[0].data) std::cout << c << " ";
-    // std::cout << std::endl;
-    file.segments = segments;
-
-    return file;
-}
-
-/**
- * 扫描需要修复的 segments
- * @return segment ids, ks, rs
- */
-std::tuple<std::vector<std::string>, std::vector<int>, std::vector<int>, std::unordered_map<std::string, int>> data_manager::scan_corrupted_segments()
-{
-    std::cout << "begin scan" << std::endl;
-    std::vector<std::string> segments_to_repair;
-    std::vector<int> ks;
-    std::vector<int> rs;
-    std::unordered_map<std::string, int> file_corrupted_segment_size;
-
-    // 查询并遍历所有 file
-    std::vector<file> files;
-    {
-        const char *sql_select = "select *\n"
-                                 "from \"file\";";
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-        {
-            return {};
-        }
-        while (sqlite3_step(stmt) == SQLITE_ROW)
-        {
-            file file;
-            db_stmt_select_file(stmt, &file);
-            files.emplace_back(file);
-        }
-        sqlite3_finalize(stmt);
-    }
-    std::cout << "file size :" << files.size() << std::endl;
-    for (const auto &file : files)
-    {
-        int now_file_segments_corrupted_size = 0;
-        // 查询每个 file 对应的 segments
-        std::vector<std::string> segment_ids;
-        {
-            const char *sql_select = "select \"p\".\"id\"\n"
-                                     "from \"file\" \"s\"\n"
-                                     "         left join \"segment\" \"p\" on \"s\".\"id\" = \"p\".\"file_id\"\n"
-                                     "where \"s\".\"id\" = ? \n"
-                                     "order by \"p\".\"index\";";
-            sqlite3_stmt *stmt;
-            const std::string &file_id = to_string(file.id);
-            // std::cout << boost::uuids::to_string(file.id).c_str() << " "<< to_string(file.id).length()<< std::endl;
-            if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-            {
-                continue;
-            }
-            sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
-            // std::cout << sqlite3_expanded_sql(stmt) << std::endl;
-            while (sqlite3_step(stmt) == SQLITE_ROW)
-            {
-                const std::string &segment_id = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
-                segment_ids.emplace_back(segment_id);
-            }
-            sqlite3_finalize(stmt);
-        }
-        // 以 segment 为单位，查询所有对应的 piece
-        std::cout << "segment size : " << segment_ids.size() << std::endl;
-        for (const auto &segment_id : segment_ids)
-        {
-            std::vector<std::string> piece_ids;
-            const char *sql_select = "select \"p\".\"id\"\n"
-                                     "from \"segment\" \"s\"\n"
-                                     "         left join \"piece\" \"p\" on \"s\".\"id\" = \"p\".\"segment_id\"\n"
-                                     "where \"s\".\"id\" = ?;";
-            sqlite3_stmt *stmt;
-            if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-            {
-                continue;
-            }
-            sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
-            while (sqlite3_step(stmt) == SQLITE_ROW)
-            {
-                piece_ids.emplace_back(std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))));
-            }
-            sqlite3_finalize(stmt);
-            // 审计 piece
-            // std::cout << piece_ids.size() << std::endl;
-            int count = 0;
-            for (const auto &piece_id : piece_ids)
-            {
-                if (audit_piece(piece_id))
-                {
-                    count++;
-                }
-            }
-            // std::cout << "count size " << count << std::endl;
-            // 当剩余 piece 数小于 m 时，将 segment id 和缺失的 piece id 加入到结果中
-            // k = 5 , m = 2 n = 7
-            if (count < file.cfg.n)
-            {
-                now_file_segments_corrupted_size++;
-                segments_to_repair.emplace_back(segment_id);
-                ks.emplace_back(file.cfg.k);
-                rs.emplace_back(count);
-            }
-        }
-        file_corrupted_segment_size.emplace(to_string(file.id), now_file_segments_corrupted_size);
-    }
-    return std::make_tuple(segments_to_repair, ks, rs, file_corrupted_segment_size);
-}
-
-/**
- * 以 segment 为单位修复，步骤：
- * <ol>
- * <li> 查询对应的 file 配置 (k, m, n)
- * <li> 查询对应的 pieces
- * <li> 下载剩余的 pieces
- * <li> pieces 解析为 erasure shares
- * <li> erasure shares 恢复成 stripes
- * <li> stripes 重新纠删编码成 erasure shares
- * <li> erasure shares 合并成 pieces
- * <li> pieces 分发到各个 storage nodes
- * </ol>
- * @param segment_id
- */
-void data_manager::repair_segment(const std::string &segment_id)
-{
-    long total_repair = 0;
-    long duration1 = 0;
-    long duration2 = 0;
-    long duration3 = 0;
-    long duration4 = 0;
-    try
-    {
-        // 开始数据库事务
-        sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
-
-        // 查询对应的文件配置
-        const segment &segment = db_select_segment(segment_id);
-        const file &file = db_select_file_by_id(to_string(segment.file_id));
-        data_processor dp(file.cfg);
-        boost::uuids::random_generator uuid_v4;
-        boost::uuids::string_generator sg;
-        // 有序查询所有对应的 piece
-        std::vector<std::string> piece_ids;
-        {
-            const char *sql_select = "select \"p\".\"id\"\n"
-                                     "from \"segment\" \"s\"\n"
-                                     "         left join \"piece\" \"p\" on \"s\".\"id\" = \"p\".\"segment_id\"\n"
-                                     "where \"s\".\"id\" = ?\n"
-                                     "order by \"p\".\"index\";";
-            sqlite3_stmt *stmt;
-            if (sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
-            {
-                return;
-            }
-            sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
-            while (sqlite3_step(stmt) == SQLITE_ROW)
-            {
-                piece_ids.emplace_back(std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))));
-            }
-            sqlite3_finalize(stmt);
-        }
-
-        // 下载剩余的 pieces
-        std::vector<std::vector<erasure_share>> s;
-        std::vector<piece> pieces;
-        // double totol
-        // t1 t2
-        long t1, t2;
-
-        for (const auto &piece_id : piece_ids)
-        {
-            piece piece = download_piece(piece_id);
-            // 跳过无效 piece
-            if (piece.id.is_nil())
-            {
-                continue;
-            }
-            pieces.emplace_back(piece);
-            // piece 拆分成 erasure share（横向）
-            // clock() t1
-            t1 = gettimens();
-            std::vector<erasure_share> shares = dp.split_piece(piece);
-            s.emplace_back(shares);
-            // clock() t2
-            t2 = gettimens();
-            duration1 += t2 - t1;
-            // total += t2-t2
-        }
-        // part1 !!! log
-        std::ofstream mycout("test_data.txt", std::ios::app);
-
-        mycout << "new Segment !!!!!! " << segment_id << std::endl;
-        mycout << "file_size: " << file.cfg.file_size << " bytes, segment_size : " << file.cfg.segment_size << " bytes, stripe_size: " << file.cfg.stripe_size << " byte, k: " << file.cfg.k << ", m :" << file.cfg.m << ", n :" << file.cfg.n << std::endl;
-        mycout << "Part1 piece to erasure:" << duration1 << std::endl;
-        total_repair += duration1;
-        //	std::cout << "part 1 !" << du << std::endl;
-        long t3, t4;
-
-        // erasure shares 恢复成 stripes，计算并修复数据
-        // std::vector<stripe> stripes = dp.repair_stripes_from_erasure_shares(s);
-        // clock_t  start,stop;
-        t3 = gettimens();
-        // t1 -- decoder
-        std::vector<stripe> stripes = dp.merge_to_stripes(s);
-        t4 = gettimens();
-        duration2 = (t4 - t3);
-        // std::ofstream mycout("test_data.txt",std::ios::app);
-        mycout << "Part2 erasure to stripe: " << duration2 << std::endl;
-        mycout << "decode  thoughput for one segment  is : " << (double)((file.cfg.segment_size / 1024.0 / 1024.0) * 1000000000.0) / duration2 << " MB / s" << std::endl;
-
-        total_repair += duration2;
-
-        //	std::cout << "part 2" << du << std::endl;
-        /// log 2 !!!!!!!
-        // t2
-        // total += t2 - t1 (part 2)
-        s.clear();
-        //   stop = clock();
-        //	duration = ((double)(stop-start))/CLOCK_TAI;
-        //	std::ofstream mycout("test_data.txt",std::ios::app);
-        //	mycout<<"Stripe Repair time:"<<duration<<std::endl;
-        // 新 stripes 处理成 pieces
-        s.reserve(stripes.size());
-        // decode 部分 total_2
-        // t1
-        long t5, t6;
-        long t5_t6_total = 0;
-
-        for (auto &stripe : stripes)
-        {
-            t5 = gettimens();
-            // 编码成 erasure shares，该数组为纵向
-            // t11
-            std::vector<erasure_share> shares = dp.erasure_encode(stripe);
-            // t22 单独记录
-            s.emplace_back(shares);
-            t6 = gettimens();
-            duration3 += t6 - t5;
-            t5_t6_total += t6 - t5;
-            // mycout << "Stripe encode"<<t6 - t5<<std::endl;
-            // !!! log self
-        }
-        mycout << "Part3 Inner log encode :" << duration3 << std::endl;
-        mycout << "encode  thoughput for one segment  is : " << (double)((file.cfg.segment_size / 1024.0 / 1024.0) * 1000000000.0) / duration3 << " MB / s" << std::endl;
-        mycout << "encode  thoughput for one stripe agv  is : " << (double)((file.cfg.segment_size / 1024.0 / 1024.0) * 1000000000.0) / t5_t6_total << " MB / s" << std::endl;
-
-        total_repair += duration3;
-
-        // std::cout << "part 3 " << du << std::endl;
-        //  log !!!! du
-        //
-        long t7, t8;
-        // t2
-        // total_2 += t2 - t1 (part 3)
-
-        // erasure shares 横向合并成 pieces
-        //
-        // total_3
-        // t1
-        t7 = gettimens();
-        std::vector<piece> pieces_new = dp.merge_to_pieces(s);
-        // t2
-        t8 = gettimens();
-        // total_3 += t2 -t1
-        duration4 = t8 - t7;
-        mycout << "Part 4 Merge to piece :" << duration4 << std::endl;
-        total_repair += duration4;
-        mycout << "Total segment repair time :" << total_repair << std::endl;
-        mycout << "The repair thougout is : " << (double)((double)((file.cfg.segment_size / 1024.0 / 1024.0) * 1000000000.0) / total_repair) << " MB / s" << std::endl;
-        mycout.close();
-        // !! log
-        for (int i = 0; i < pieces_new.size(); i++)
-        {
-            piece &piece = pieces_new[i];
-            // piece id
-            piece.id = uuid_v4();
-            piece.index = i;
-            piece.segment_id = segment.id;
-        }
-
-        // 上传 pieces 到各个存储节点
-        auto piece = pieces_new.begin();
-        auto storage_node = storage_nodes.begin();
-        while (piece != pieces_new.end())
-        {
-            piece->storage_node_id = storage_node->id;
-            upload_piece(*piece, *storage_node);
-            db_insert_piece(*piece);
-            piece++;
-            storage_node++;
-            // 遍历到最后一个存储节点后，从第一个重新开始遍历
-            if (storage_node == storage_nodes.end())
-            {
-                storage_node = storage_nodes.begin();
-            }
-        }
-        // stop=clock();
-
-        //     duration=((double)(stop-start))/CLOCK_TAI;
-
-        //     std::cout<<"Total repair "<<duration<<std::endl;
-        // 删除数据库中的旧的 piece 和 storage nodes 中的 pieces
-        for (const auto &piece_id : piece_ids)
-        {
-            remove_piece(piece_id);
-        }
-    }
-    catch (int e)
-    {
-        perror("Failed to repair segment");
-        sqlite3_exec(sql, "rollback;", nullptr, nullptr, nullptr);
-    }
-    sqlite3_exec(sql, "commit;", nullptr, nullptr, nullptr);
-    puts("Repair segment: Commit");
-}
-
-void data_manager::sort_segments(std::vector<std::string> &segment_ids, std::vector<int> &ks, std::vector<int> &rs)
-{
-    if (segment_ids.size() != ks.size() || segment_ids.size() != rs.size())
-    {
-        return;
-    }
-    // 记录 segment id 与 k, r 的对应关系
-    std::unordered_map<std::string, std::pair<int, int>> map;
-    for (int i = 0; i < segment_ids.size(); i++)
-    {
-        map.emplace(segment_ids[i], std::make_pair(ks[i], rs[i]));
-    }
-
-    // 评分函数
-    const auto &weight = [=](const int k, const int r)
-    {
-        double churn_per_round = config::failure_rate * config::total_nodes;
-        if (churn_per_round < config::min_churn_per_round)
-        {
-            churn_per_round = config::min_churn_per_round;
-        }
-        double p = double(config::total_nodes - r) / config::total_nodes;
-        double mean = double(r - k + 1) * p / (1 - p);
-        return mean / churn_per_round;
-    };
-
-    // 排序规则
-    const auto &less = [=](const std::string &a, const std::string &b)
-    {
-        const std::pair<int, int> &p1 = map.at(a);
-        const std::pair<int, int> &p2 = map.at(b);
-        return weight(p1.first, p1.second) < weight(p2.first, p2.second);
-    };
-
-    // 排序
-    std::sort(segment_ids.begin(), segment_ids.end(), less);
-
-    // 重新赋值 ks, rs
-    for (int i = 0; i < segment_ids.size(); i++)
-    {
-        const auto &pair = map[segment_ids[i]];
-        ks[i] = pair.first;
-        rs[i] = pair.second;
-    }
-}
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <random>
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <fstream>
+#include "config.h"
+#include "data_manager.h"
+#include "data_processor.h"
+#include "file.h"
+#include "memory.h"
+#include "metrics.h"
+#include "time.h"
+#include "trace.h"
+using namespace storj;
+
+data_manager::data_manager() : data_manager("storj.db", "./storage_nodes/")
+{}
+
+/**
+ * @param db_path 数据库文件
+ * @param storage_node_base_path 存储节点目录的根目录，不存在时创建（只创建最后一级）
+ */
+data_manager::data_manager(const std::string &db_path, const std::string &storage_node_base_path) : storage_node_base_path(storage_node_base_path.empty() || storage_node_base_path.back() == '/' ? storage_node_base_path : storage_node_base_path + "/"), db_path(db_path), readers(db_path, config::read_connections), cache(config::segment_cache_size), durable(config::group_commit_size), uploads(config::upload_threads), auditor(config::audit_loss_threshold, config::audit_confidence_z)
+{
+    init();
+}
+
+data_manager::~data_manager()
+{
+    // 停止后台封装线程，封装仍在打开的共享 segment
+    if (sealer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(sealer_mutex);
+            sealer_stop = true;
+        }
+        sealer_cv.notify_all();
+        sealer.join();
+    }
+    flush_packs();
+    for (const auto &pack : sealing_packs)
+    {
+        for (const auto &object : pack->objects)
+        {
+            if (object.first.cfg.stage_small_files)
+            {
+                printf("Failed to seal packed segment, object kept in staging: %s\n", object.first.name.c_str());
+            }
+            else
+            {
+                printf("Failed to seal packed segment, lost object: %s\n", object.first.name.c_str());
+            }
+        }
+    }
+    // 等待后台上传的 pieces 完成并写入目录
+    wait_pending_uploads();
+    // 已没有读取，回收修复替换下来的旧 pieces
+    epochs.reclaim();
+    // 停止后台压缩线程
+    if (compactor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(compactor_mutex);
+            compactor_stop = true;
+        }
+        compactor_cv.notify_all();
+        compactor.join();
+    }
+    // 关闭数据库
+    sqlite3_close_v2(sql);
+}
+
+void data_manager::init()
+{
+    // 初始化数据库
+    init_db();
+    // 初始化存储节点
+    init_storage_nodes();
+    // 回收上次运行崩溃时遗留的 pending pieces
+    sweep_pending(0);
+    // 上次运行暂存但未封装的小文件重新打包
+    restage_objects();
+    // 共享 segment 超时后由后台线程封装，无需等待下一次上传或下载
+    sealer = std::thread(&data_manager::seal_packs_on_timer, this);
+}
+
+void data_manager::init_db()
+{
+    const char *sql_create_table_file = "create table if not exists \"file\"\n"
+                                        "(\n"
+                                        "    \"id\"                 varchar(64) primary key not null,\n"
+                                        "    \"file_name\"          varchar(255)            not null,\n"
+                                        "    \"file_size\"          int(11)                 not null,\n"
+                                        "    \"segment_size\"       int(11)                 not null,\n"
+                                        "    \"stripe_size\"        int(11)                 not null,\n"
+                                        "    \"erasure_share_size\" int(11)                 not null,\n"
+                                        "    \"k\"                  int(11)                 not null,\n"
+                                        "    \"m\"                  int(11)                 not null,\n"
+                                        "    \"n\"                  int(11)                 not null,\n"
+                                        "    \"max_padding_ratio\"  real                    not null,\n"
+                                        "    \"status\"             int(11)                 not null default 1\n"
+                                        ");";
+    const char *sql_create_table_segment = "create table if not exists \"segment\"\n"
+                                           "(\n"
+                                           "    \"id\"         varchar(64) primary key not null,\n"
+                                           "    \"index\"      int(11)                 not null,\n"
+                                           "    \"file_id\"    varchar(64)             not null,\n"
+                                           "    \"length\"     int(11)                 not null,\n"
+                                           "    \"generation\" int(11)                 not null default 0\n"
+                                           ");";
+    const char *sql_create_table_piece = "create table if not exists \"piece\"\n"
+                                         "(\n"
+                                         "    \"id\"              varchar(64) primary key not null,\n"
+                                         "    \"index\"           int(11)                 not null,\n"
+                                         "    \"segment_id\"      varchar(64)             not null,\n"
+                                         "    \"storage_node_id\" int(11)                 not null,\n"
+                                         "    \"generation\"      int(11)                 not null default 0\n"
+                                         ");";
+    const char *sql_create_table_storage_node = "create table if not exists \"storage_node\"\n"
+                                                "(\n"
+                                                "    \"id\" varchar(64) primary key not null\n"
+                                                ");";
+    const char *sql_create_table_packed_object = "create table if not exists \"packed_object\"\n"
+                                                 "(\n"
+                                                 "    \"file_id\"    varchar(64) primary key not null,\n"
+                                                 "    \"segment_id\" varchar(64)             not null,\n"
+                                                 "    \"offset\"     int(11)                 not null,\n"
+                                                 "    \"length\"     int(11)                 not null\n"
+                                                 ");";
+    const char *sql_create_table_upload_session = "create table if not exists \"upload_session\"\n"
+                                                  "(\n"
+                                                  "    \"id\"              varchar(64) primary key not null,\n"
+                                                  "    \"file_id\"         varchar(64)             not null,\n"
+                                                  "    \"upload_quorum\"   int(11)                 not null,\n"
+                                                  "    \"long_tail_extra\" int(11)                 not null\n"
+                                                  ");";
+    // 打包后尚未封装的小文件，封装提交时在同一事务中删除
+    const char *sql_create_table_staged_object = "create table if not exists \"staged_object\"\n"
+                                                 "(\n"
+                                                 "    \"file_id\"            varchar(64) primary key not null,\n"
+                                                 "    \"file_name\"          varchar(255)            not null,\n"
+                                                 "    \"segment_size\"       int(11)                 not null,\n"
+                                                 "    \"stripe_size\"        int(11)                 not null,\n"
+                                                 "    \"erasure_share_size\" int(11)                 not null,\n"
+                                                 "    \"piece_size\"         int(11)                 not null,\n"
+                                                 "    \"k\"                  int(11)                 not null,\n"
+                                                 "    \"m\"                  int(11)                 not null,\n"
+                                                 "    \"n\"                  int(11)                 not null,\n"
+                                                 "    \"max_padding_ratio\"  real                    not null,\n"
+                                                 "    \"pack_timeout_ms\"    int(11)                 not null,\n"
+                                                 "    \"upload_quorum\"      int(11)                 not null,\n"
+                                                 "    \"long_tail_extra\"    int(11)                 not null,\n"
+                                                 "    \"data\"               blob                    not null\n"
+                                                 ");";
+    // 打开数据库
+    sqlite3_open_v2(db_path.c_str(), &sql, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr);
+    // WAL 模式下只读连接与写连接可以并发
+    sqlite3_exec(sql, "pragma journal_mode = wal;", nullptr, nullptr, nullptr);
+    sqlite3_busy_timeout(sql, 5000);
+    std::cout << "drop table !!!! \n"
+              << std::endl;
+    // sqlite3_exec(sql, "drop table file;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table segment;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table piece;", nullptr, nullptr, nullptr);sqlite3_exec(sql, "drop table storage_node;", nullptr, nullptr, nullptr);
+
+    // 表结构版本记录在 user_version 中，0 为基线版本的表或空库
+    const int schema_version = 1;
+    int version = 0;
+    {
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(sql, "pragma user_version;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (version > schema_version)
+    {
+        printf("init db: %s has schema version %d, this build supports up to %d\n", db_path.c_str(), version, schema_version);
+        throw -1;
+    }
+
+    sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_file, nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_segment, nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_piece, nullptr, nullptr, nullptr);
+
+    sqlite3_exec(sql, sql_create_table_storage_node, nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_packed_object, nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_upload_session, nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, sql_create_table_staged_object, nullptr, nullptr, nullptr);
+
+    // 版本 0 -> 1：为基线版本的表补上新增的列，已存在的列跳过
+    if (version < 1)
+    {
+        auto has_column = [this](const char *table, const char *column)
+        {
+            sqlite3_stmt *stmt;
+            const std::string &sql_info = std::string("pragma table_info(\"") + table + "\");";
+            bool found = false;
+            if (sqlite3_prepare_v2(sql, sql_info.c_str(), -1, &stmt, nullptr) == SQLITE_OK)
+            {
+                while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+                {
+                    found = strcmp(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)), column) == 0;
+                }
+            }
+            sqlite3_finalize(stmt);
+            return found;
+        };
+        auto add_column = [&](const char *table, const char *column, const char *definition)
+        {
+            if (has_column(table, column))
+            {
+                return false;
+            }
+            const std::string &sql_alter = std::string("alter table \"") + table + "\" add column \"" + column + "\" " + definition + ";";
+            char *err = nullptr;
+            if (sqlite3_exec(sql, sql_alter.c_str(), nullptr, nullptr, &err) != SQLITE_OK)
+            {
+                printf("init db: Failed to add %s.%s: %s\n", table, column, err == nullptr ? "" : err);
+                sqlite3_free(err);
+                sqlite3_exec(sql, "rollback;", nullptr, nullptr, nullptr);
+                throw -1;
+            }
+            printf("init db: added column %s.%s\n", table, column);
+            return true;
+        };
+        // 基线版本的文件按旧布局编码，以负的补 0 比例标记
+        add_column("file", "max_padding_ratio", "real not null default -1");
+        add_column("file", "status", "int(11) not null default 1");
+        // 基线版本的 segment 都补 0 到 segment_size，实际长度按文件大小计算
+        if (add_column("segment", "length", "int(11) not null default 0"))
+        {
+            sqlite3_exec(sql, "update \"segment\"\n"
+                              "set \"length\" = (select min(\"f\".\"segment_size\", \"f\".\"file_size\" - \"segment\".\"index\" * \"f\".\"segment_size\")\n"
+                              "                  from \"file\" \"f\"\n"
+                              "                  where \"f\".\"id\" = \"segment\".\"file_id\");",
+                         nullptr, nullptr, nullptr);
+        }
+        add_column("segment", "generation", "int(11) not null default 0");
+        add_column("piece", "generation", "int(11) not null default 0");
+    }
+    sqlite3_exec(sql, ("pragma user_version = " + std::to_string(schema_version) + ";").c_str(), nullptr, nullptr, nullptr);
+    if (sqlite3_exec(sql, "commit;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        printf("init db: Failed to initialize %s: %s\n", db_path.c_str(), sqlite3_errmsg(sql));
+        sqlite3_exec(sql, "rollback;", nullptr, nullptr, nullptr);
+        throw -1;
+    }
+    // 按文件查 segments、按 segment 查当前代 pieces 时使用
+    sqlite3_exec(sql, "create index if not exists \"segment_file_id\" on \"segment\" (\"file_id\", \"index\");", nullptr, nullptr, nullptr);
+    sqlite3_exec(sql, "create index if not exists \"piece_segment_id\" on \"piece\" (\"segment_id\", \"generation\");", nullptr, nullptr, nullptr);
+    // 审计按节点查 pieces 时使用
+    sqlite3_exec(sql, "create index if not exists \"piece_storage_node_id\" on \"piece\" (\"storage_node_id\", \"generation\");", nullptr, nullptr, nullptr);
+    // 下载时按文件名查找
+    sqlite3_exec(sql, "create index if not exists \"file_name\" on \"file\" (\"file_name\", \"status\");", nullptr, nullptr, nullptr);
+}
+
+void data_manager::init_storage_nodes()
+{
+    // 添加数据库记录
+    int node_count;
+    {
+        const char *sql_select = "select count(1)\n"
+                                 "from \"storage_node\";";
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr);
+        sqlite3_step(stmt);
+        node_count = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    // 补足节点数量
+    for (int i = node_count; i < storage_node_num; i++)
+    {
+        boost::uuids::random_generator uuid_v4;
+        const std::string &node_id = to_string(uuid_v4());
+        const char *sql_insert = "insert into \"storage_node\"(\"id\")\n"
+                                 "values (?);";
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    // 查出所有节点，加入到 set 中
+    {
+        boost::uuids::string_generator sg;
+        const char *sql_select = "select \"id\"\n"
+                                 "from \"storage_node\";";
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(sql, sql_select, -1, &stmt, nullptr);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const boost::uuids::uuid &node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+            storage_nodes.emplace(node_id);
+        }
+        sqlite3_finalize(stmt);
+    }
+    // 创建目录
+    mkdir(storage_node_base_path.c_str(), 0755);
+    for (const auto &node : storage_nodes)
+    {
+        mkdir(get_storage_node_path(node).c_str(), 0755);
+    }
+    // 打开各节点的日志存储，重放日志重建索引
+    if (config::log_structured_store)
+    {
+        for (const auto &node : storage_nodes)
+        {
+            const std::string &node_id = to_string(node.id);
+            log_stores[node_id] = std::make_unique<log_store>(get_storage_node_path(node_id), config::log_file_size, config::log_compact_ratio);
+        }
+        compactor = std::thread(&data_manager::compact_logs, this);
+    }
+}
+
+log_store *data_manager::get_log_store(const std::string &node_id)
+{
+    auto it = log_stores.find(node_id);
+    return it == log_stores.end() ? nullptr : it->second.get();
+}
+
+/**
+ * 后台线程：周期性压缩各节点的日志，回收已删除 pieces 的空间
+ */
+void data_manager::compact_logs()
+{
+    std::unique_lock<std::mutex> lock(compactor_mutex);
+    while (!compactor_cv.wait_for(lock, std::chrono::seconds(1), [this] { return compactor_stop; }))
+    {
+        lock.unlock();
+        for (auto &pair : log_stores)
+        {
+            pair.second->compact();
+        }
+        lock.lock();
+    }
+}
+
+data_manager::db_write_lock::db_write_lock(data_manager &dm) : dm(dm)
+{
+    dm.writer_mutex.lock();
+    outer = dm.writer_thread.load() != std::this_thread::get_id();
+    if (outer)
+    {
+        dm.writer_thread = std::this_thread::get_id();
+    }
+}
+
+data_manager::db_write_lock::~db_write_lock()
+{
+    if (outer)
+    {
+        dm.writer_thread = std::thread::id();
+    }
+    dm.writer_mutex.unlock();
+}
+
+/**
+ * 借用一个查询连接：当前线程持有写锁时使用写连接，否则从只读连接池中借出
+ */
+sqlite_pool::connection data_manager::db_read()
+{
+    if (writer_thread.load() == std::this_thread::get_id())
+    {
+        return sqlite_pool::connection(nullptr, sql);
+    }
+    return readers.acquire();
+}
+
+std::shared_mutex &data_manager::segment_lock(const std::string &segment_id)
+{
+    return segment_locks[std::hash<std::string>()(segment_id) % segment_lock_shards];
+}
+
+std::string data_manager::get_storage_node_path(const storage_node &node)
+{
+    return get_storage_node_path(to_string(node.id));
+}
+
+std::string data_manager::get_storage_node_path(const std::string &node_id)
+{
+    return storage_node_base_path + node_id;
+}
+
+std::string data_manager::get_piece_path(const std::string &node_id, const std::string &piece_id)
+{
+    return get_storage_node_path(node_id) + "/" + piece_id;
+}
+
+std::string data_manager::get_piece_path(const std::string &piece_id)
+{
+    const piece &piece = db_select_piece(piece_id);
+    return get_piece_path(to_string(piece.storage_node_id), piece_id);
+}
+
+/**
+ * 尚未写入目录的 piece 文件路径，发布时重命名为正式路径
+ */
+std::string data_manager::get_pending_path(const std::string &node_id, const std::string &piece_id)
+{
+    return get_piece_path(node_id, piece_id) + ".pending";
+}
+
+/**
+ * 打开 piece 文件。目录已提交但尚未重命名的 piece 从 pending 路径读取
+ * @return 文件描述符，不存在时返回 -1
+ */
+int data_manager::open_piece(const piece &p)
+{
+    const std::string &node_id = to_string(p.storage_node_id);
+    const std::string &piece_id = to_string(p.id);
+    int fd = open(get_piece_path(node_id, piece_id).c_str(), O_RDONLY);
+    if (fd == -1 && errno == ENOENT)
+    {
+        fd = open(get_pending_path(node_id, piece_id).c_str(), O_RDONLY);
+    }
+    return fd;
+}
+
+void data_manager::db_insert_file(const file &f, int status)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_file");
+    metrics::scoped_timer timer(latency);
+    const std::string &file_id = to_string(f.id);
+    const char *sql_insert = "insert into \"file\"(\"id\", \"file_name\", \"file_size\", \"segment_size\", \"stripe_size\", \"erasure_share_size\", \"k\", \"m\", \"n\", \"max_padding_ratio\", \"status\")\n"
+                             "values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 2, f.name.c_str(), f.name.length(), nullptr);
+    sqlite3_bind_int(stmt, 3, f.cfg.file_size);
+    sqlite3_bind_int(stmt, 4, f.cfg.segment_size);
+    sqlite3_bind_int(stmt, 5, f.cfg.stripe_size);
+    sqlite3_bind_int(stmt, 6, f.cfg.erasure_share_size);
+    sqlite3_bind_int(stmt, 7, f.cfg.k);
+    sqlite3_bind_int(stmt, 8, f.cfg.m);
+    sqlite3_bind_int(stmt, 9, f.cfg.n);
+    sqlite3_bind_double(stmt, 10, f.cfg.max_padding_ratio);
+    sqlite3_bind_int(stmt, 11, status);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_insert_segment(const segment &s)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_segment");
+    metrics::scoped_timer timer(latency);
+    const std::string &segment_id = to_string(s.id);
+    const std::string &file_id = to_string(s.file_id);
+    const char *sql_insert = "insert into \"segment\"(\"id\", \"index\", \"file_id\", \"length\", \"generation\")\n"
+                             "values (?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 2, s.index);
+    sqlite3_bind_text(stmt, 3, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 4, s.length);
+    sqlite3_bind_int(stmt, 5, s.generation);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_insert_erasure_share(const erasure_share &es)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_erasure_share");
+    metrics::scoped_timer timer(latency);
+    const std::string &erasure_share_id = to_string(es.id);
+    const std::string &stripe_id = to_string(es.stripe_id);
+    const std::string &piece_id = to_string(es.piece_id);
+    const char *sql_insert = "insert into \"erasure_share\"(\"id\", \"x_index\", \"y_index\", \"stripe_id\", \"piece_id\")\n"
+                             "values (?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, piece_id.c_str(), erasure_share_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 2, es.x_index);
+    sqlite3_bind_int(stmt, 3, es.y_index);
+    sqlite3_bind_text(stmt, 4, stripe_id.c_str(), stripe_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 5, piece_id.c_str(), piece_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_insert_piece(const piece &p)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_piece");
+    metrics::scoped_timer timer(latency);
+    const std::string &piece_id = to_string(p.id);
+    const std::string &segment_id = to_string(p.segment_id);
+    const std::string &storage_node_id = to_string(p.storage_node_id);
+    const char *sql_insert = "insert into \"piece\"(\"id\", \"index\", \"segment_id\", \"storage_node_id\", \"generation\")\n"
+                             "values (?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, piece_id.c_str(), piece_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 2, p.index);
+    sqlite3_bind_text(stmt, 3, segment_id.c_str(), segment_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 4, storage_node_id.c_str(), storage_node_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 5, p.generation);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_insert_packed_object(const std::string &file_id, const std::string &segment_id, int offset, int length)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_packed_object");
+    metrics::scoped_timer timer(latency);
+    const char *sql_insert = "insert into \"packed_object\"(\"file_id\", \"segment_id\", \"offset\", \"length\")\n"
+                             "values (?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 2, segment_id.c_str(), segment_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 3, offset);
+    sqlite3_bind_int(stmt, 4, length);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+/**
+ * 记录上传会话，以及续传时需要沿用、但不属于文件布局的上传参数
+ */
+void data_manager::db_insert_upload_session(const std::string &session_id, const file &f)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_upload_session");
+    metrics::scoped_timer timer(latency);
+    const std::string &file_id = to_string(f.id);
+    const char *sql_insert = "insert into \"upload_session\"(\"id\", \"file_id\", \"upload_quorum\", \"long_tail_extra\")\n"
+                             "values (?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, session_id.c_str(), session_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 2, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 3, f.cfg.upload_quorum);
+    sqlite3_bind_int(stmt, 4, f.cfg.long_tail_extra);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+/**
+ * 暂存打包的小文件及其配置，在自动提交的事务中落盘
+ * @return 是否写入成功
+ */
+bool data_manager::db_insert_staged_object(const file &object, const std::vector<char> &data)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.insert_staged_object");
+    metrics::scoped_timer timer(latency);
+    const std::string &file_id = to_string(object.id);
+    const config &cfg = object.cfg;
+    const char *sql_insert = "insert into \"staged_object\"(\"file_id\", \"file_name\", \"segment_size\", \"stripe_size\", \"erasure_share_size\", \"piece_size\", \"k\", \"m\", \"n\", \"max_padding_ratio\", \"pack_timeout_ms\", \"upload_quorum\", \"long_tail_extra\", \"data\")\n"
+                             "values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_insert, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_bind_text(stmt, 2, object.name.c_str(), object.name.length(), nullptr);
+    sqlite3_bind_int(stmt, 3, cfg.segment_size);
+    sqlite3_bind_int(stmt, 4, cfg.stripe_size);
+    sqlite3_bind_int(stmt, 5, cfg.erasure_share_size);
+    sqlite3_bind_int(stmt, 6, cfg.piece_size);
+    sqlite3_bind_int(stmt, 7, cfg.k);
+    sqlite3_bind_int(stmt, 8, cfg.m);
+    sqlite3_bind_int(stmt, 9, cfg.n);
+    sqlite3_bind_double(stmt, 10, cfg.max_padding_ratio);
+    sqlite3_bind_int(stmt, 11, cfg.pack_timeout_ms);
+    sqlite3_bind_int(stmt, 12, cfg.upload_quorum);
+    sqlite3_bind_int(stmt, 13, cfg.long_tail_extra);
+    sqlite3_bind_blob(stmt, 14, data.data(), data.size(), nullptr);
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+void data_manager::db_stmt_select_file(sqlite3_stmt *stmt, file *file)
+{
+    boost::uuids::string_generator sg;
+    file->id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+    file->name = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+    file->cfg.file_size = sqlite3_column_int(stmt, 2);
+    file->cfg.segment_size = sqlite3_column_int(stmt, 3);
+    file->cfg.stripe_size = sqlite3_column_int(stmt, 4);
+    file->cfg.erasure_share_size = sqlite3_column_int(stmt, 5);
+    file->cfg.k = sqlite3_column_int(stmt, 6);
+    file->cfg.m = sqlite3_column_int(stmt, 7);
+    file->cfg.n = sqlite3_column_int(stmt, 8);
+    file->cfg.max_padding_ratio = sqlite3_column_double(stmt, 9);
+}
+
+file data_manager::db_select_file_by_id(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_file_by_id");
+    metrics::scoped_timer timer(latency);
+    file res;
+    const char *sql_select = "select *\n"
+                             "from \"file\"\n"
+                             "where \"id\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        return res;
+    }
+    db_stmt_select_file(stmt, &res);
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+file data_manager::db_select_file_by_name(const std::string &filename)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_file_by_name");
+    metrics::scoped_timer timer(latency);
+    file res;
+    // 只查已上传完成的文件
+    const char *sql_select = "select *\n"
+                             "from \"file\"\n"
+                             "where \"file_name\" = ?\n"
+                             "  and \"status\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, filename.c_str(), filename.length(), nullptr);
+    sqlite3_bind_int(stmt, 2, file_complete);
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        // res.id = boost::uuids::nil;
+        sqlite3_finalize(stmt);
+        return res;
+    }
+    db_stmt_select_file(stmt, &res);
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+segment data_manager::db_select_segment(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_segment");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    segment res;
+    const char *sql_select = "select *\n"
+                             "from \"segment\"\n"
+                             "where \"id\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        return res;
+    }
+    res.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+    res.index = sqlite3_column_int(stmt, 1);
+    res.file_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
+    res.length = sqlite3_column_int(stmt, 3);
+    res.generation = sqlite3_column_int(stmt, 4);
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+std::vector<segment> data_manager::db_select_segments_by_file(const std::string &file_id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_segments_by_file");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    std::vector<segment> res;
+    const char *sql_select = "select \"id\", \"index\", \"file_id\", \"length\", \"generation\"\n"
+                             "from \"segment\"\n"
+                             "where \"file_id\" = ?\n"
+                             "order by \"index\";";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        segment s;
+        s.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+        s.index = sqlite3_column_int(stmt, 1);
+        s.file_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
+        s.length = sqlite3_column_int(stmt, 3);
+        s.generation = sqlite3_column_int(stmt, 4);
+        res.push_back(s);
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+piece data_manager::db_select_piece(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_piece");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    piece res;
+    const char *sql_select = "select *\n"
+                             "from \"piece\"\n"
+                             "where \"id\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    // 已被修复替换的 piece 不存在，返回 nil id
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        return res;
+    }
+    res.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+    res.index = sqlite3_column_int(stmt, 1);
+    res.segment_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
+    res.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 3)));
+    res.generation = sqlite3_column_int(stmt, 4);
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+std::vector<piece> data_manager::db_select_pieces_by_segment(const std::string &segment_id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_pieces_by_segment");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    std::vector<piece> res;
+    // 只返回 segment 当前代的 pieces
+    const char *sql_select = "select \"p\".\"id\", \"p\".\"index\", \"p\".\"segment_id\", \"p\".\"storage_node_id\", \"p\".\"generation\"\n"
+                             "from \"piece\" \"p\"\n"
+                             "         join \"segment\" \"s\" on \"s\".\"id\" = \"p\".\"segment_id\" and \"s\".\"generation\" = \"p\".\"generation\"\n"
+                             "where \"p\".\"segment_id\" = ?\n"
+                             "order by \"p\".\"index\";";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        piece p;
+        p.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+        p.index = sqlite3_column_int(stmt, 1);
+        p.segment_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
+        p.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 3)));
+        p.generation = sqlite3_column_int(stmt, 4);
+        res.push_back(p);
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/**
+ * 查询存放在指定节点上的当前代 pieces
+ * @param sample_size 大于 0 时随机抽取该数量，否则返回全部。
+ * 抽样在节点的索引上按随机位置取行，不对全部行排序；抽到的旧代 pieces 跳过，结果可能略少于 sample_size
+ */
+std::vector<piece> data_manager::db_select_pieces_by_node(const std::string &node_id, int sample_size)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_pieces_by_node");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    std::vector<piece> res;
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    auto read_piece_row = [&]
+    {
+        piece p;
+        p.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+        p.index = sqlite3_column_int(stmt, 1);
+        p.segment_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 2)));
+        p.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 3)));
+        p.generation = sqlite3_column_int(stmt, 4);
+        res.push_back(p);
+    };
+    if (sample_size <= 0)
+    {
+        const char *sql_select = "select \"p\".\"id\", \"p\".\"index\", \"p\".\"segment_id\", \"p\".\"storage_node_id\", \"p\".\"generation\"\n"
+                                 "from \"piece\" \"p\"\n"
+                                 "         join \"segment\" \"s\" on \"s\".\"id\" = \"p\".\"segment_id\" and \"s\".\"generation\" = \"p\".\"generation\"\n"
+                                 "where \"p\".\"storage_node_id\" = ?;";
+        if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return res;
+        }
+        sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            read_piece_row();
+        }
+        sqlite3_finalize(stmt);
+        return res;
+    }
+
+    // 只读索引统计该节点的行数并选出随机位置
+    const char *sql_count = "select count(*)\n"
+                            "from \"piece\"\n"
+                            "where \"storage_node_id\" = ?;";
+    if (sqlite3_prepare_v2(db, sql_count, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
+    const int count = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    if (count == 0)
+    {
+        return res;
+    }
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::set<int> offsets;
+    if (count <= sample_size)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            offsets.insert(i);
+        }
+    }
+    else
+    {
+        while (offsets.size() < sample_size)
+        {
+            offsets.insert(std::uniform_int_distribution<int>(0, count - 1)(rng));
+        }
+    }
+
+    // 沿索引走一遍，取出选中位置的 rowid
+    std::vector<sqlite3_int64> rowids;
+    const char *sql_rowid = "select \"rowid\"\n"
+                            "from \"piece\"\n"
+                            "where \"storage_node_id\" = ?;";
+    if (sqlite3_prepare_v2(db, sql_rowid, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, node_id.c_str(), node_id.length(), nullptr);
+    auto offset = offsets.begin();
+    for (int i = 0; offset != offsets.end() && sqlite3_step(stmt) == SQLITE_ROW; i++)
+    {
+        if (i == *offset)
+        {
+            rowids.push_back(sqlite3_column_int64(stmt, 0));
+            offset++;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    const char *sql_select = "select \"p\".\"id\", \"p\".\"index\", \"p\".\"segment_id\", \"p\".\"storage_node_id\", \"p\".\"generation\"\n"
+                             "from \"piece\" \"p\"\n"
+                             "         join \"segment\" \"s\" on \"s\".\"id\" = \"p\".\"segment_id\" and \"s\".\"generation\" = \"p\".\"generation\"\n"
+                             "where \"p\".\"rowid\" = ?;";
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    // 随机打乱，前 audit_deep_sample_size 个做深度审计
+    std::shuffle(rowids.begin(), rowids.end(), rng);
+    for (const auto rowid : rowids)
+    {
+        sqlite3_bind_int64(stmt, 1, rowid);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            read_piece_row();
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+bool data_manager::db_select_packed_object(const std::string &file_id, std::string *segment_id, int *offset, int *length)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_packed_object");
+    metrics::scoped_timer timer(latency);
+    const char *sql_select = "select \"segment_id\", \"offset\", \"length\"\n"
+                             "from \"packed_object\"\n"
+                             "where \"file_id\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    *segment_id = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    *offset = sqlite3_column_int(stmt, 1);
+    *length = sqlite3_column_int(stmt, 2);
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+bool data_manager::db_select_upload_session(const std::string &session_id, std::string *file_id, int *upload_quorum, int *long_tail_extra)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_upload_session");
+    metrics::scoped_timer timer(latency);
+    const char *sql_select = "select \"file_id\", \"upload_quorum\", \"long_tail_extra\"\n"
+                             "from \"upload_session\"\n"
+                             "where \"id\" = ?;";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, session_id.c_str(), session_id.length(), nullptr);
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    *file_id = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+    *upload_quorum = sqlite3_column_int(stmt, 1);
+    *long_tail_extra = sqlite3_column_int(stmt, 2);
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+/**
+ * 读取全部暂存的小文件，用于重启后重新打包
+ */
+std::vector<std::pair<file, std::vector<char>>> data_manager::db_select_staged_objects()
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.select_staged_objects");
+    metrics::scoped_timer timer(latency);
+    boost::uuids::string_generator sg;
+    std::vector<std::pair<file, std::vector<char>>> res;
+    const char *sql_select = "select \"file_id\", \"file_name\", \"segment_size\", \"stripe_size\", \"erasure_share_size\", \"piece_size\", \"k\", \"m\", \"n\", \"max_padding_ratio\", \"pack_timeout_ms\", \"upload_quorum\", \"long_tail_extra\", \"data\"\n"
+                             "from \"staged_object\";";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        config cfg;
+        cfg.segment_size = sqlite3_column_int(stmt, 2);
+        cfg.stripe_size = sqlite3_column_int(stmt, 3);
+        cfg.erasure_share_size = sqlite3_column_int(stmt, 4);
+        cfg.piece_size = sqlite3_column_int(stmt, 5);
+        cfg.k = sqlite3_column_int(stmt, 6);
+        cfg.m = sqlite3_column_int(stmt, 7);
+        cfg.n = sqlite3_column_int(stmt, 8);
+        cfg.max_padding_ratio = sqlite3_column_double(stmt, 9);
+        cfg.pack_timeout_ms = sqlite3_column_int(stmt, 10);
+        cfg.upload_quorum = sqlite3_column_int(stmt, 11);
+        cfg.long_tail_extra = sqlite3_column_int(stmt, 12);
+        cfg.pack_small_files = true;
+        cfg.stage_small_files = true;
+        const char *blob = reinterpret_cast<const char *>(sqlite3_column_blob(stmt, 13));
+        std::vector<char> data(blob, blob + sqlite3_column_bytes(stmt, 13));
+        cfg.file_size = data.size();
+        file object(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)), cfg);
+        object.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+        res.emplace_back(object, std::move(data));
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+void data_manager::db_remove_file_by_id(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_file_by_id");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"file\"\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_file_by_name(const std::string &name)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_file_by_name");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"file\"\n"
+                             "where \"name\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_segment(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_segment");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"segment\"\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_piece(const std::string &id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_piece");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"piece\"\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, id.c_str(), id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_pieces_by_generation(const std::string &segment_id, int generation)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_pieces_by_generation");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"piece\"\n"
+                             "where \"segment_id\" = ?\n"
+                             "  and \"generation\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, segment_id.c_str(), segment_id.length(), nullptr);
+    sqlite3_bind_int(stmt, 2, generation);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_update_segment_generation(const std::string &segment_id, int generation)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.update_segment_generation");
+    metrics::scoped_timer timer(latency);
+    const char *sql_update = "update \"segment\"\n"
+                             "set \"generation\" = ?\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_update, -1, &stmt, nullptr);
+    sqlite3_bind_int(stmt, 1, generation);
+    sqlite3_bind_text(stmt, 2, segment_id.c_str(), segment_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_update_piece_generation(const std::string &piece_id, int generation)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.update_piece_generation");
+    metrics::scoped_timer timer(latency);
+    const char *sql_update = "update \"piece\"\n"
+                             "set \"generation\" = ?\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_update, -1, &stmt, nullptr);
+    sqlite3_bind_int(stmt, 1, generation);
+    sqlite3_bind_text(stmt, 2, piece_id.c_str(), piece_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+/**
+ * 提交当前事务，调用方持有 db_write_lock
+ */
+void data_manager::db_commit()
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.commit");
+    metrics::scoped_timer timer(latency);
+    sqlite3_exec(sql, "commit;", nullptr, nullptr, nullptr);
+}
+
+void data_manager::db_update_file_status(const std::string &file_id, int status)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.update_file_status");
+    metrics::scoped_timer timer(latency);
+    const char *sql_update = "update \"file\"\n"
+                             "set \"status\" = ?\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_update, -1, &stmt, nullptr);
+    sqlite3_bind_int(stmt, 1, status);
+    sqlite3_bind_text(stmt, 2, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_upload_session(const std::string &session_id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_upload_session");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"upload_session\"\n"
+                             "where \"id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, session_id.c_str(), session_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void data_manager::db_remove_staged_object(const std::string &file_id)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("db.remove_staged_object");
+    metrics::scoped_timer timer(latency);
+    const char *sql_remove = "delete\n"
+                             "from \"staged_object\"\n"
+                             "where \"file_id\" = ?;";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(sql, sql_remove, -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+/**
+ * 写入一个 piece
+ * @param ticket 持久化模式下 piece 文件加入的组提交事务
+ */
+bool data_manager::upload_piece(const piece &p, const storage_node &node, group_commit::ticket ticket)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("piece_write");
+    static metrics::counter &bytes = metrics::instance().get_counter("piece_write.bytes");
+    // span 的节点 id 只在记录时间线时生成
+    metrics::scoped_timer timer(latency, trace::enabled() ? to_string(node.id) : std::string());
+    if (!node_online(to_string(node.id)))
+    {
+        return false;
+    }
+    bytes.add(p.data.size());
+    log_store *store = get_log_store(to_string(node.id));
+    if (store != nullptr)
+    {
+        if (!store->append(to_string(p.id), p.data.data(), p.data.size()))
+        {
+            printf("upload piece: Failed to append piece\n");
+            return false;
+        }
+        if (config::durable_writes)
+        {
+            durable.add_log(store, get_storage_node_path(node), ticket);
+        }
+        return true;
+    }
+    // 先写到 pending 路径，目录事务提交后由 publish_pieces() 重命名
+    const std::string &piece_path = get_pending_path(to_string(node.id), to_string(p.id));
+    // 创建文件
+    int fd = open(piece_path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        perror("upload piece: Failed to open file");
+        return false;
+    }
+    // 写内容
+    const int unit = 16 << 10;
+    for (int i = 0; i < p.data.size(); i += unit)
+    {
+        int n = std::min(unit, (int)p.data.size() - i);
+        if (write(fd, p.data.data() + i, n) <= 0)
+        {
+            perror("upload piece: Failed to write file");
+            close(fd);
+            return false;
+        }
+    }
+    // 持久化模式下由组提交负责落盘与关闭
+    if (config::durable_writes)
+    {
+        durable.add_file(fd, get_storage_node_path(node), ticket);
+        return true;
+    }
+    // 关闭文件
+    close(fd);
+    return true;
+}
+
+/**
+ * 持久化模式下让本次事务写入的 pieces 全部落盘，失败时抛出异常由调用方回滚事务。
+ * 只报告该事务的 pieces，同一批次中其它事务的落盘失败不影响本事务
+ * @param ticket 写入 pieces 时使用的组提交事务
+ */
+void data_manager::sync_pieces(group_commit::ticket ticket)
+{
+    if (config::durable_writes && !durable.flush(ticket))
+    {
+        throw -1;
+    }
+}
+
+piece data_manager::download_piece(const std::string &piece_id)
+{
+    piece piece = db_select_piece(piece_id);
+    read_piece(piece);
+    return piece;
+}
+
+/**
+ * 按已查出的元数据读取整个 piece，不再查询数据库。
+ * 已被修复替换的 piece 在回收前仍可读取
+ * @param piece 已赋值 id 与 storage_node_id 的 piece，数据追加到 piece.data
+ * @return 是否读取成功
+ */
+bool data_manager::read_piece(piece &piece)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("piece_read");
+    static metrics::counter &bytes = metrics::instance().get_counter("piece_read.bytes");
+    metrics::scoped_timer timer(latency, trace::enabled() ? to_string(piece.storage_node_id) : std::string());
+    const std::string &piece_id = to_string(piece.id);
+    // 离线节点上的 piece 按读取失败处理，数据仍在，节点恢复后可再读取
+    if (!node_online(to_string(piece.storage_node_id)))
+    {
+        return false;
+    }
+    log_store *store = get_log_store(to_string(piece.storage_node_id));
+    if (store != nullptr)
+    {
+        if (!store->read_all(piece_id, piece.data))
+        {
+            printf("download piece: Failed to read piece %s\n", piece_id.c_str());
+            return false;
+        }
+        bytes.add(piece.data.size());
+        return true;
+    }
+    // 打开文件
+    int fd = open_piece(piece);
+    if (fd == -1)
+    {
+        perror("download piece: Failed to open file");
+        return false;
+    }
+    // 读内容
+    const int unit = 16 << 10;
+    char buf[unit];
+    int i = 0;
+    int n;
+    while ((n = read(fd, buf, unit)) > 0)
+    {
+        piece.data.insert(piece.data.end(), buf, buf + n);
+        i += n;
+    }
+    bytes.add(i);
+    // 关闭文件
+    close(fd);
+    return true;
+}
+
+void data_manager::remove_piece(const std::string &piece_id)
+{
+    db_write_lock lock(*this);
+    const piece &piece = db_select_piece(piece_id);
+    const std::string &path = get_piece_path(to_string(piece.storage_node_id), piece_id);
+    // segment 的 pieces 发生变化，缓存失效
+    cache.invalidate(to_string(piece.segment_id));
+    log_store *store = get_log_store(to_string(piece.storage_node_id));
+    if (store != nullptr)
+    {
+        if (!store->remove(piece_id))
+        {
+            printf("remove piece: Failed to remove piece %s\n", piece_id.c_str());
+        }
+        db_remove_piece(piece_id);
+        return;
+    }
+    if (remove(path.c_str()) == -1)
+    {
+        perror("remove piece: Failed to remove piece file");
+        db_remove_piece(piece_id);
+        return;
+    }
+    db_remove_piece(piece_id);
+}
+
+/**
+ * 用 pread 读取 piece 中的一段数据
+ * @param p 已赋值 id 与 storage_node_id 的 piece
+ * @param offset piece 内偏移
+ * @param length 读取长度
+ * @param buf 输出缓冲区
+ * @return 实际读取的字节数，piece 不存在时返回 -1
+ */
+int data_manager::read_piece_range(const piece &p, long offset, int length, char *buf)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("piece_read_range");
+    metrics::scoped_timer timer(latency, trace::enabled() ? to_string(p.storage_node_id) : std::string());
+    if (!node_online(to_string(p.storage_node_id)))
+    {
+        return -1;
+    }
+    log_store *store = get_log_store(to_string(p.storage_node_id));
+    if (store != nullptr)
+    {
+        return store->read(to_string(p.id), offset, length, buf);
+    }
+    int fd = open_piece(p);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    int total = 0;
+    while (total < length)
+    {
+        int n = pread(fd, buf + total, length - total, offset + total);
+        if (n <= 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    return total;
+}
+
+bool data_manager::audit_piece(const piece &piece)
+{
+    if (synthetic_audit)
+    {
+        return synthetic_audit(piece);
+    }
+    if (!node_online(to_string(piece.storage_node_id)))
+    {
+        return false;
+    }
+    log_store *store = get_log_store(to_string(piece.storage_node_id));
+    if (store != nullptr)
+    {
+        // 只查内存索引
+        return store->contains(to_string(piece.id));
+    }
+    int fd = open_piece(piece);
+    if (fd == -1)
+    {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * 深度审计：读出 piece 数据并校验写入时的 CRC32。
+ * 单文件 piece 没有记录校验和，只能检查是否存在
+ */
+bool data_manager::deep_audit_piece(const piece &piece)
+{
+    if (synthetic_audit)
+    {
+        return synthetic_audit(piece);
+    }
+    if (!node_online(to_string(piece.storage_node_id)))
+    {
+        return false;
+    }
+    log_store *store = get_log_store(to_string(piece.storage_node_id));
+    if (store != nullptr)
+    {
+        return store->verify(to_string(piece.id));
+    }
+    return audit_piece(piece);
+}
+
+/**
+ * 审计 segment 当前代的 pieces
+ * @return 仍然可用的 piece 数
+ */
+int data_manager::count_available_pieces(const std::string &segment_id)
+{
+    int count = 0;
+    for (const auto &piece : db_select_pieces_by_segment(segment_id))
+    {
+        if (audit_piece(piece))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * 编码单个 segment 并分发到各个 storage nodes，不访问数据库，元数据由调用方统一写入
+ * <ol>
+ * <li> 切割成 stripes，纠删编码为 erasure shares
+ * <li> 组合 erasure shares，拼接成 pieces
+ * <li> pieces 分发到各个 storage nodes
+ * </ol>
+ * @param dp 对应文件配置的 data processor
+ * @param segment 已赋值 id, index, file_id 的 segment
+ * @param stored 输出已写入、需要记录到目录的 pieces（不含数据）
+ * @param ticket pieces 加入的组提交事务，提交前由调用方 sync_pieces(ticket)
+ */
+void data_manager::store_segment(data_processor &dp, segment &segment, std::vector<piece> &stored, group_commit::ticket ticket)
+{
+    trace::span span("segment_store");
+    boost::uuids::random_generator uuid_v4;
+    segment.length = segment.data.size();
+    // 切割成 stripes 并遍历
+    std::vector<stripe> stripes = dp.split_segment(segment);
+    std::vector<std::vector<erasure_share>> s;
+    s.reserve(stripes.size());
+    for (auto &stripe : stripes)
+    {
+        // 编码成 erasure shares，该数组为纵向
+        std::vector<erasure_share> shares = dp.erasure_encode(stripe);
+        s.emplace_back(shares);
+    }
+
+    // erasure shares 横向合并成 pieces，长尾上传时生成全部 k + m 个候选 pieces
+    const config &cfg = dp.get_config();
+    config candidates = cfg;
+    candidates.n = cfg.k + cfg.m;
+    std::vector<piece> pieces = cfg.long_tail_extra > 0 ? data_processor(candidates).merge_to_pieces(s) : dp.merge_to_pieces(s);
+    for (int piece_index = 0; piece_index < pieces.size(); piece_index++)
+    {
+        piece &piece = pieces[piece_index];
+        // piece id
+        piece.id = uuid_v4();
+        piece.index = piece_index;
+        piece.segment_id = segment.id;
+        for (auto &share : piece.erasure_shares)
+        {
+            share.piece_id = piece.id;
+        }
+    }
+
+    // 分配存储节点
+    auto piece = pieces.begin();
+    auto storage_node = storage_nodes.begin();
+    while (piece != pieces.end())
+    {
+        piece->storage_node_id = storage_node->id;
+        piece++;
+        storage_node++;
+        // 遍历到最后一个存储节点后，从第一个重新开始遍历
+        if (storage_node == storage_nodes.end())
+        {
+            storage_node = storage_nodes.begin();
+        }
+    }
+
+    // 并行上传：写完 quorum 个即返回，只保留最先写完的 n 个
+    const int keep = std::min(cfg.n, (int)pieces.size());
+    const int quorum = cfg.upload_quorum > 0 ? std::max(std::min(cfg.upload_quorum, keep), cfg.k) : keep;
+    if (quorum < keep || keep < pieces.size())
+    {
+        upload_pieces_parallel(pieces, quorum, keep, stored, ticket);
+        return;
+    }
+
+    // 上传 pieces 到各个存储节点，写入失败时换到该 segment 未使用的节点，仍失败则整个 segment 失败
+    std::set<std::string> nodes;
+    for (const auto &piece : pieces)
+    {
+        nodes.insert(to_string(piece.storage_node_id));
+    }
+    for (auto &piece : pieces)
+    {
+        const auto &node = *storage_nodes.find(::storage_node(piece.storage_node_id));
+        wait_node_delay(node, nullptr, 0);
+        if (!upload_piece_with_retry(piece, ticket, nodes))
+        {
+            printf("store segment: Failed to upload piece %d, %d/%d pieces stored\n", piece.index, (int)stored.size(), (int)pieces.size());
+            throw -1;
+        }
+        nodes.insert(to_string(piece.storage_node_id));
+        piece.data = piece_buffer();
+        piece.erasure_shares = std::vector<erasure_share>();
+        stored.push_back(std::move(piece));
+    }
+}
+
+/**
+ * 为指定节点设置人为的写入延迟，模拟速度不同的节点
+ * @param node_id 节点 id
+ * @param ms 每次写入 piece 前等待的毫秒数，0 表示取消
+ */
+void data_manager::set_node_delay(const std::string &node_id, int ms)
+{
+    std::lock_guard<std::mutex> lock(node_delays_mutex);
+    node_delays[node_id] = ms;
+}
+
+/**
+ * 设置节点在线状态，模拟节点暂时离开与恢复。
+ * 离线节点上的 pieces 读取与审计失败，新 pieces 不写入该节点；数据保留，恢复在线后可再读取
+ * @param node_id 节点 id
+ * @param online 是否在线
+ */
+void data_manager::set_node_online(const std::string &node_id, bool online)
+{
+    std::lock_guard<std::mutex> lock(offline_nodes_mutex);
+    if (online)
+    {
+        offline_nodes.erase(node_id);
+    }
+    else
+    {
+        offline_nodes.insert(node_id);
+    }
+}
+
+bool data_manager::node_online(const std::string &node_id)
+{
+    std::lock_guard<std::mutex> lock(offline_nodes_mutex);
+    return offline_nodes.count(node_id) == 0;
+}
+
+/**
+ * 等待节点的写入延迟。并行上传时，一旦已有 keep 个 pieces 写完即提前结束
+ * @return 是否仍需写入该 piece
+ */
+bool data_manager::wait_node_delay(const storage_node &node, upload_batch *batch, int keep)
+{
+    int ms = 0;
+    {
+        std::lock_guard<std::mutex> lock(node_delays_mutex);
+        auto it = node_delays.find(to_string(node.id));
+        if (it != node_delays.end())
+        {
+            ms = it->second;
+        }
+    }
+    if (batch == nullptr)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    if (ms > 0)
+    {
+        batch->cv.wait_for(lock, std::chrono::milliseconds(ms), [&] { return batch->winners >= keep; });
+    }
+    return batch->winners < keep;
+}
+
+/**
+ * 删除不在目录中的 piece 数据：未发布的 pending piece，或已被修复替换的旧 piece
+ */
+void data_manager::discard_piece(const piece &p)
+{
+    const std::string &node_id = to_string(p.storage_node_id);
+    const std::string &piece_id = to_string(p.id);
+    log_store *store = get_log_store(node_id);
+    if (store != nullptr)
+    {
+        store->remove(piece_id);
+        return;
+    }
+    if (unlink(get_pending_path(node_id, piece_id).c_str()) == -1)
+    {
+        unlink(get_piece_path(node_id, piece_id).c_str());
+    }
+}
+
+/**
+ * 目录事务提交后，把 pending piece 文件重命名为正式路径。
+ * 日志存储中的 piece 写入目录即为发布，无需处理。
+ * 提交后、重命名前崩溃的 piece 由 sweep_pending() 补完重命名
+ * @param pieces 已写入目录的 pieces
+ */
+void data_manager::publish_pieces(const std::vector<piece> &pieces)
+{
+    for (const auto &p : pieces)
+    {
+        const std::string &node_id = to_string(p.storage_node_id);
+        if (get_log_store(node_id) != nullptr)
+        {
+            continue;
+        }
+        const std::string &piece_id = to_string(p.id);
+        // 已被清理线程补完重命名时源文件不存在
+        if (rename(get_pending_path(node_id, piece_id).c_str(), get_piece_path(node_id, piece_id).c_str()) == -1 && errno != ENOENT)
+        {
+            perror("publish piece: Failed to rename piece file");
+        }
+    }
+}
+
+/**
+ * 回收崩溃或失败遗留的未发布 pieces
+ * <ol>
+ * <li> pending 文件已在目录中：提交后未来得及重命名，补完重命名
+ * <li> pending 文件不在目录中且超过 timeout_ms：删除
+ * <li> 日志存储中不在目录中且超过 timeout_ms 的 piece：删除
+ * </ol>
+ * 超时之前的 pending piece 可能仍在上传中，不处理。
+ * 日志存储中不在目录中的也可能是修复替换下来、仍在被读取的旧 piece，删除同样等读取结束后进行
+ * @param timeout_ms pending piece 的最短存在时间，0 表示全部回收（启动时没有进行中的上传）
+ * @return 回收的 piece 数
+ */
+int data_manager::sweep_pending(int timeout_ms)
+{
+    const std::string suffix = ".pending";
+    const time_t now = time(nullptr);
+    std::vector<piece> orphans;
+    for (const auto &node : storage_nodes)
+    {
+        const std::string &node_id = to_string(node.id);
+        log_store *store = get_log_store(node_id);
+        if (store != nullptr)
+        {
+            for (const auto &piece_id : store->piece_ids())
+            {
+                log_store::location loc;
+                if (!store->lookup(piece_id, &loc) || (now - loc.timestamp) * 1000 < timeout_ms)
+                {
+                    continue;
+                }
+                if (db_select_piece(piece_id).id.is_nil())
+                {
+                    piece p;
+                    p.id = boost::uuids::string_generator()(piece_id);
+                    p.storage_node_id = node.id;
+                    orphans.push_back(p);
+                }
+            }
+        }
+        DIR *dir = opendir(get_storage_node_path(node).c_str());
+        if (dir == nullptr)
+        {
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            const std::string name = entry->d_name;
+            if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+            {
+                continue;
+            }
+            const std::string &piece_id = name.substr(0, name.size() - suffix.size());
+            const std::string &pending_path = get_pending_path(node_id, piece_id);
+            struct stat st;
+            if (stat(pending_path.c_str(), &st) == -1 || (now - st.st_mtime) * 1000 < timeout_ms)
+            {
+                continue;
+            }
+            if (!db_select_piece(piece_id).id.is_nil())
+            {
+                rename(pending_path.c_str(), get_piece_path(node_id, piece_id).c_str());
+                continue;
+            }
+            piece p;
+            p.id = boost::uuids::string_generator()(piece_id);
+            p.storage_node_id = node.id;
+            orphans.push_back(p);
+        }
+        closedir(dir);
+    }
+    if (!orphans.empty())
+    {
+        printf("sweep pending: %d orphaned pieces\n", (int)orphans.size());
+        epochs.retire([this, orphans]()
+                      {
+                          for (const auto &p : orphans)
+                          {
+                              discard_piece(p);
+                          }
+                      });
+    }
+    return orphans.size();
+}
+
+/**
+ * 上传 piece，目标节点失败时依次换到后面的节点重试
+ * @param p 已分配 storage_node_id 的 piece，成功后更新为实际写入的节点
+ * @param ticket piece 文件加入的组提交事务
+ * @param avoid 重试时跳过的节点 id，通常是同一 segment 其它 pieces 所在的节点
+ * @return 是否上传成功
+ */
+bool data_manager::upload_piece_with_retry(piece &p, group_commit::ticket ticket, const std::set<std::string> &avoid)
+{
+    const int max_attempts = 3;
+    const auto target = storage_nodes.find(storage_node(p.storage_node_id));
+    if (target == storage_nodes.end())
+    {
+        return false;
+    }
+    auto node = target;
+    int attempts = 0;
+    do
+    {
+        if (node == target || avoid.count(to_string(node->id)) == 0)
+        {
+            if (upload_piece(p, *node, ticket))
+            {
+                p.storage_node_id = node->id;
+                return true;
+            }
+            if (++attempts == max_attempts)
+            {
+                break;
+            }
+        }
+        if (++node == storage_nodes.end())
+        {
+            node = storage_nodes.begin();
+        }
+    } while (node != target);
+    return false;
+}
+
+/**
+ * 在线程池中并行上传一个 segment 的 pieces，quorum 个 pieces 写完后加入 stored 并返回。
+ * 最先写完的 keep 个 pieces 为有效 pieces，其中确认之后才完成的由 drain_uploads() 写入目录；
+ * 其余 pieces 尚未开始写入的直接取消，已写入的删除。
+ * 写入失败、且其余 pieces 全部写完也凑不满 keep 个时，由 redrive_piece() 换节点重新上传。
+ * 写完的 pieces 不足 quorum 时抛出异常；调用方提交或放弃 segment 后须调用 settle_batch()
+ * @param pieces 已分配 storage_node_id 的候选 pieces
+ * @param quorum 确认所需的 pieces 数，介于 k 与 keep 之间
+ * @param keep 保留的 pieces 数，即 n
+ * @param ticket pieces 加入的组提交事务，确认之后才完成的 pieces 也使用它
+ */
+void data_manager::upload_pieces_parallel(std::vector<piece> &pieces, int quorum, int keep, std::vector<piece> &stored, group_commit::ticket ticket)
+{
+    const int total = pieces.size();
+    const std::string &segment_id = to_string(pieces.front().segment_id);
+    auto batch = std::make_shared<upload_batch>();
+    batch->segment_id = segment_id;
+    batch->ticket = ticket;
+    for (const auto &p : pieces)
+    {
+        batch->nodes.insert(to_string(p.storage_node_id));
+    }
+    {
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+        tracker.in_flight += total;
+        tracker.open_batches[segment_id] = batch;
+    }
+    for (auto &p : pieces)
+    {
+        // 确认后调用方释放 segment 的预算，仍在后台写入的 piece 各自持有数据大小的预算直到写完
+        long long bytes = p.data.size();
+        for (const auto &share : p.erasure_shares)
+        {
+            bytes += share.data.size();
+        }
+        auto budget = std::make_shared<memory::reservation>(bytes, false);
+        auto task = std::make_shared<piece>(std::move(p));
+        uploads.submit([this, batch, task, total, keep, budget]() mutable {
+            const storage_node &node = *storage_nodes.find(::storage_node(task->storage_node_id));
+            const bool cancelled = !wait_node_delay(node, batch.get(), keep);
+            std::set<std::string> avoid;
+            if (!cancelled)
+            {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                avoid = batch->nodes;
+            }
+            const bool ok = !cancelled && upload_piece_with_retry(*task, batch->ticket, avoid);
+            bool winner = false;
+            bool late = false;
+            bool redrive = false;
+            {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                if (ok && batch->winners < keep)
+                {
+                    winner = true;
+                    batch->winners++;
+                    batch->nodes.insert(to_string(task->storage_node_id));
+                    if (!batch->acknowledged)
+                    {
+                        batch->done.push_back(*task);
+                    }
+                    else
+                    {
+                        late = true;
+                    }
+                }
+                else if (!ok && !cancelled && batch->winners + batch->redriving + (total - batch->finished - 1) < keep)
+                {
+                    batch->redriving++;
+                    redrive = true;
+                }
+                batch->finished++;
+            }
+            batch->cv.notify_all();
+            if (ok && !winner)
+            {
+                discard_piece(*task);
+            }
+            if (redrive)
+            {
+                redrive_piece(batch, task, budget);
+            }
+            // 目录中只需要元数据
+            task->data = piece_buffer();
+            task->erasure_shares = std::vector<erasure_share>();
+            budget.reset();
+            {
+                std::lock_guard<std::mutex> lock(tracker.mutex);
+                if (late)
+                {
+                    tracker.completed.emplace_back(batch, *task);
+                }
+                tracker.in_flight--;
+            }
+            tracker.cv.notify_all();
+        });
+    }
+    std::vector<piece> acked;
+    {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->cv.wait(lock, [&] { return batch->done.size() >= quorum || batch->finished == total; });
+        batch->acknowledged = true;
+        acked.swap(batch->done);
+    }
+    if (acked.size() < quorum)
+    {
+        printf("upload segment: only %d of %d pieces written\n", (int)acked.size(), quorum);
+        // 之后写完的 pieces 由 drain_uploads() 删除
+        settle_batch(segment_id, false);
+        for (const auto &p : acked)
+        {
+            discard_piece(p);
+        }
+        throw -1;
+    }
+    stored.insert(stored.end(), acked.begin(), acked.end());
+}
+
+/**
+ * 在后台把写入失败的 piece 重新上传到该 segment 未使用的节点，依次尝试直到成功。
+ * 成功的 piece 与确认之后才完成的 pieces 一样由 drain_uploads() 按当前代写入目录；
+ * 全部节点都失败时，segment 提交后由下一次 scan_and_repair() 优先修复
+ * @param batch piece 所属的并行上传
+ * @param task 仍持有数据的 piece
+ * @param budget piece 数据的内存预算，上传结束后释放
+ */
+void data_manager::redrive_piece(const std::shared_ptr<upload_batch> &batch, const std::shared_ptr<piece> &task, const std::shared_ptr<memory::reservation> &budget)
+{
+    auto redriven = std::make_shared<piece>(std::move(*task));
+    {
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+        tracker.in_flight++;
+    }
+    uploads.submit([this, batch, redriven, reserved = budget]() mutable {
+        std::set<std::string> avoid;
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            avoid = batch->nodes;
+        }
+        bool ok = false;
+        for (const auto &node : storage_nodes)
+        {
+            if (avoid.count(to_string(node.id)) == 0 && upload_piece(*redriven, node, batch->ticket))
+            {
+                redriven->storage_node_id = node.id;
+                ok = true;
+                break;
+            }
+        }
+        redriven->data = piece_buffer();
+        redriven->erasure_shares = std::vector<erasure_share>();
+        reserved.reset();
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->redriving--;
+            if (ok)
+            {
+                batch->winners++;
+                batch->nodes.insert(to_string(redriven->storage_node_id));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(tracker.mutex);
+            if (ok)
+            {
+                tracker.completed.emplace_back(batch, *redriven);
+            }
+            else
+            {
+                printf("upload segment: Failed to redrive piece %d of segment %s\n", redriven->index, batch->segment_id.c_str());
+                tracker.underfilled.push_back(batch);
+            }
+            tracker.in_flight--;
+        }
+        tracker.cv.notify_all();
+    });
+}
+
+/**
+ * 记录并行上传的 segment 已提交或已放弃，之后完成的 pieces 据此写入目录或删除
+ * @param segment_id segment id，没有并行上传时忽略
+ * @param committed segment 是否已提交到目录
+ */
+void data_manager::settle_batch(const std::string &segment_id, bool committed)
+{
+    std::lock_guard<std::mutex> lock(tracker.mutex);
+    auto it = tracker.open_batches.find(segment_id);
+    if (it == tracker.open_batches.end())
+    {
+        return;
+    }
+    if (committed)
+    {
+        it->second->committed = true;
+    }
+    else
+    {
+        it->second->aborted = true;
+    }
+    tracker.open_batches.erase(it);
+}
+
+/**
+ * 把确认之后才完成的 pieces 写入目录。
+ * 所属 segment 被放弃的 pieces、修复已提升代数后才完成的旧代 pieces 直接删除；
+ * segment 尚未提交的 pieces 留到下一次调用
+ */
+void data_manager::drain_uploads()
+{
+    std::map<std::string, std::vector<piece>> committed;
+    // 各 segment 的 pieces 所属的组提交事务
+    std::map<std::string, std::set<group_commit::ticket>> tickets;
+    std::vector<piece> aborted;
+    {
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+        std::vector<std::pair<std::shared_ptr<upload_batch>, piece>> pending;
+        for (auto &entry : tracker.completed)
+        {
+            if (entry.first->committed)
+            {
+                tickets[to_string(entry.second.segment_id)].insert(entry.first->ticket);
+                committed[to_string(entry.second.segment_id)].push_back(std::move(entry.second));
+            }
+            else if (entry.first->aborted)
+            {
+                aborted.push_back(std::move(entry.second));
+            }
+            else
+            {
+                pending.push_back(std::move(entry));
+            }
+        }
+        tracker.completed.swap(pending);
+        std::vector<std::shared_ptr<upload_batch>> underfilled;
+        for (auto &batch : tracker.underfilled)
+        {
+            if (batch->committed)
+            {
+                tracker.repairs.insert(batch->segment_id);
+            }
+            else if (!batch->aborted)
+            {
+                underfilled.push_back(std::move(batch));
+            }
+        }
+        tracker.underfilled.swap(underfilled);
+    }
+    for (const auto &p : aborted)
+    {
+        discard_piece(p);
+    }
+    for (const auto &pair : committed)
+    {
+        // 持有 segment 锁，修复不能在比较代数与写入之间提升代数
+        std::shared_lock<std::shared_mutex> segment_guard(segment_lock(pair.first));
+        std::vector<piece> current;
+        std::vector<piece> stale;
+        {
+            db_write_lock lock(*this);
+            const segment &segment = db_select_segment(pair.first);
+            for (const auto &p : pair.second)
+            {
+                if (segment.id == p.segment_id && segment.generation == p.generation)
+                {
+                    current.push_back(p);
+                }
+                else
+                {
+                    stale.push_back(p);
+                }
+            }
+            if (!current.empty())
+            {
+                try
+                {
+                    for (const auto ticket : tickets[pair.first])
+                    {
+                        sync_pieces(ticket);
+                    }
+                    sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+                    for (const auto &p : current)
+                    {
+                        db_insert_piece(p);
+                    }
+                }
+                catch (int e)
+                {
+                    perror("Failed to record uploaded pieces");
+                    sqlite3_exec(sql, "rollback;", nullptr, nullptr, nullptr);
+                    stale.insert(stale.end(), current.begin(), current.end());
+                    current.clear();
+                }
+                if (!current.empty())
+                {
+                    db_commit();
+                }
+            }
+        }
+        publish_pieces(current);
+        for (const auto &p : stale)
+        {
+            discard_piece(p);
+        }
+    }
+}
+
+/**
+ * 等待所有后台上传完成并写入目录
+ */
+void data_manager::wait_pending_uploads()
+{
+    {
+        std::unique_lock<std::mutex> lock(tracker.mutex);
+        tracker.cv.wait(lock, [this] { return tracker.in_flight == 0; });
+    }
+    drain_uploads();
+}
+
+/**
+ * 以指定 (k, m, n) 等配置上传指定文件
+ * <ol>
+ * <li> 读取 file 内容，切割成 segments
+ * <li> 遍历 segments，切割成 stripes
+ * <li> 遍历 stripes，纠删编码为 erasure shares
+ * <li> 组合 erasure shares，拼接成 pieces
+ * <li> pieces 分发到各个 storage nodes
+ * </ol>
+ * 开启 cfg.pack_small_files 时，小于 segment_size 的文件追加到共享 segment 中。
+ * 每个 segment 单独提交，失败时保留上传会话，可用 resume_upload() 继续
+ * @param filename 文件名
+ * @param cfg 配置
+ */
+void data_manager::upload_file(const std::string &filename, config &cfg)
+{
+    trace::span span("upload_file", filename);
+    drain_uploads();
+
+    // 判断是否有同名文件
+    std::cout << filename << std::endl;
+    const file &record = db_select_file_by_name(filename);
+    std::cout << to_string(record.id) << std::endl;
+    std::cout << record.name << std::endl;
+    if (record.name == filename)
+    {
+        puts("存在同名文件，无法上传");
+        return;
+    }
+    if (find_unsealed(filename, nullptr, nullptr))
+    {
+        puts("存在同名文件，无法上传");
+        return;
+    }
+
+    // 长尾上传多编码 extra 个校验 piece，目录中按 m + extra 记录编码参数，n 保持不变
+    config layout = cfg;
+    layout.m += cfg.long_tail_extra;
+
+    // 小文件打包
+    if (layout.pack_small_files)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0 && st.st_size < layout.segment_size)
+        {
+            pack_file(filename, layout);
+            return;
+        }
+    }
+
+    // 以上传会话逐个 segment 提交，中断后可从第一个缺失的 segment 继续
+    const std::string &session_id = begin_upload(filename, cfg);
+    if (session_id.empty())
+    {
+        return;
+    }
+    if (!resume_upload(session_id))
+    {
+        printf("Upload file: interrupted, resume with session %s\n", session_id.c_str());
+    }
+}
+
+/**
+ * 开始可续传上传：记录上传中的 file 元数据与上传会话，不写入数据。
+ * 上传中的文件对下载与扫描不可见
+ * @param filename 文件名
+ * @param cfg 配置
+ * @return 上传会话 id，源文件不存在或存在同名文件时返回空串
+ */
+std::string data_manager::begin_upload(const std::string &filename, config &cfg)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) == -1)
+    {
+        perror("begin upload: Failed to stat file");
+        return "";
+    }
+    // 长尾上传多编码 extra 个校验 piece，目录中按 m + extra 记录编码参数，n 保持不变
+    config layout = cfg;
+    layout.m += cfg.long_tail_extra;
+    // 续传时据此校验源文件未被修改
+    layout.file_size = st.st_size;
+
+    // 随机生成 ID
+    boost::uuids::random_generator uuid_v4;
+    file file(filename, layout);
+    file.id = uuid_v4();
+    const std::string &session_id = to_string(uuid_v4());
+
+    db_write_lock lock(*this);
+    if (db_select_file_by_name(filename).name == filename)
+    {
+        puts("存在同名文件，无法上传");
+        return "";
+    }
+    sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+    db_insert_file(file, file_uploading);
+    db_insert_upload_session(session_id, file);
+    db_commit();
+    printf("Begin upload: %s session %s\n", filename.c_str(), session_id.c_str());
+    return session_id;
+}
+
+/**
+ * 查询上传会话中已提交的 segments
+ * @param session_id 上传会话 id
+ * @return 已提交的 segment index，升序
+ */
+std::vector<int> data_manager::uploaded_segments(const std::string &session_id)
+{
+    std::vector<int> res;
+    const char *sql_select = "select \"s\".\"index\"\n"
+                             "from \"upload_session\" \"u\"\n"
+                             "         join \"segment\" \"s\" on \"s\".\"file_id\" = \"u\".\"file_id\"\n"
+                             "where \"u\".\"id\" = ?\n"
+                             "order by \"s\".\"index\";";
+    auto db = db_read();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return res;
+    }
+    sqlite3_bind_text(stmt, 1, session_id.c_str(), session_id.length(), nullptr);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        res.push_back(sqlite3_column_int(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/**
+ * 继续上传会话：跳过已提交的 segments，其余 segment 逐个编码上传，
+ * 每个 segment 与其 pieces 在各自的短事务中提交。全部提交后文件变为可见，会话结束
+ * <ol>
+ * <li> 只读取尚未提交的 segment 的数据
+ * <li> segment 切割成 stripes，纠删编码，组合成 pieces 并分发到各个 storage nodes
+ * <li> pieces 落盘后提交 segment，失败时只丢失当前 segment
+ * </ol>
+ * @param session_id 上传会话 id
+ * @return 是否上传完成，失败时会话保留，可再次调用继续
+ */
+bool data_manager::resume_upload(const std::string &session_id)
+{
+    memory::operation op("upload");
+    drain_uploads();
+    std::string file_id;
+    int upload_quorum;
+    int long_tail_extra;
+    if (!db_select_upload_session(session_id, &file_id, &upload_quorum, &long_tail_extra))
+    {
+        puts("上传会话不存在");
+        return false;
+    }
+    file file = db_select_file_by_id(file_id);
+    file.cfg.upload_quorum = upload_quorum;
+    file.cfg.long_tail_extra = long_tail_extra;
+    data_processor dp(file.cfg);
+    const std::vector<int> &done = uploaded_segments(session_id);
+    const std::set<int> committed(done.begin(), done.end());
+
+    int fd = open(file.name.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        perror("resume upload: Failed to open file");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != file.cfg.file_size)
+    {
+        puts("resume upload: 源文件已被修改");
+        close(fd);
+        return false;
+    }
+
+    boost::uuids::random_generator uuid_v4;
+    const long segment_size = file.cfg.segment_size;
+    const int segment_num = (st.st_size + segment_size - 1) / segment_size;
+    for (int segment_index = 0; segment_index < segment_num; segment_index++)
+    {
+        if (committed.count(segment_index) > 0)
+        {
+            continue;
+        }
+        // 读取该 segment 的数据，最后一个 segment 不补 0
+        const long offset = segment_index * segment_size;
+        const long length = std::min(segment_size, (long)st.st_size - offset);
+        // 内存预算不足时等待其他 segment 处理完
+        memory::reservation budget(dp.segment_footprint(length));
+        segment_buffer data(length);
+        long total = 0;
+        {
+            static metrics::histogram &read_latency = metrics::instance().get_histogram("segment_read");
+            metrics::scoped_timer timer(read_latency);
+            while (total < data.size())
+            {
+                int n = pread(fd, data.data() + total, data.size() - total, offset + total);
+                if (n <= 0)
+                {
+                    break;
+                }
+                total += n;
+            }
+        }
+        if (total != data.size())
+        {
+            perror("resume upload: Failed to read file");
+            close(fd);
+            return false;
+        }
+
+        segment segment(std::move(data));
+        // segment id
+        segment.id = uuid_v4();
+        segment.index = segment_index;
+        segment.file_id = file.id;
+        std::vector<piece> stored;
+        const group_commit::ticket ticket = durable.begin();
+        try
+        {
+            store_segment(dp, segment, stored, ticket);
+            // pieces 落盘后再提交
+            sync_pieces(ticket);
+        }
+        catch (int e)
+        {
+            perror("Failed to upload segment");
+            durable.release(ticket);
+            settle_batch(to_string(segment.id), false);
+            for (const auto &p : stored)
+            {
+                discard_piece(p);
+            }
+            close(fd);
+            return false;
+        }
+        segment.data = segment_buffer();
+
+        // 记录 segment 与 pieces，只在这个短事务中持有写锁
+        {
+            db_write_lock lock(*this);
+            sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+            db_insert_segment(segment);
+            for (const auto &p : stored)
+            {
+                db_insert_piece(p);
+            }
+            db_commit();
+        }
+        settle_batch(to_string(segment.id), true);
+        publish_pieces(stored);
+        printf("Upload segment %d/%d: Commit\n", segment_index + 1, segment_num);
+    }
+    close(fd);
+
+    // 全部 segments 已提交，文件变为可见
+    db_write_lock lock(*this);
+    if (db_select_file_by_name(file.name).name == file.name)
+    {
+        puts("存在同名文件，无法上传");
+        return false;
+    }
+    sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+    db_update_file_status(file_id, file_complete);
+    db_remove_upload_session(session_id);
+    db_commit();
+    puts("Upload file: Commit!!");
+    return true;
+}
+
+/**
+ * 放弃上传会话，删除已提交的 segments 与 pieces
+ * @param session_id 上传会话 id
+ */
+void data_manager::abort_upload(const std::string &session_id)
+{
+    // 等待该会话仍在后台写入的 pieces 记录到目录，之后一并删除
+    wait_pending_uploads();
+    std::vector<piece> pieces;
+    {
+        db_write_lock lock(*this);
+        std::string file_id;
+        int upload_quorum;
+        int long_tail_extra;
+        if (!db_select_upload_session(session_id, &file_id, &upload_quorum, &long_tail_extra))
+        {
+            return;
+        }
+        const std::vector<segment> &segments = db_select_segments_by_file(file_id);
+        for (const auto &segment : segments)
+        {
+            const std::vector<piece> &segment_pieces = db_select_pieces_by_segment(to_string(segment.id));
+            pieces.insert(pieces.end(), segment_pieces.begin(), segment_pieces.end());
+        }
+        sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+        for (const auto &p : pieces)
+        {
+            db_remove_piece(to_string(p.id));
+        }
+        for (const auto &segment : segments)
+        {
+            db_remove_segment(to_string(segment.id));
+        }
+        db_remove_file_by_id(file_id);
+        db_remove_upload_session(session_id);
+        db_commit();
+    }
+    // 上传中的文件没有读取，直接删除
+    for (const auto &p : pieces)
+    {
+        discard_piece(p);
+    }
+    printf("Abort upload: session %s, %d pieces\n", session_id.c_str(), (int)pieces.size());
+}
+
+/**
+ * 除 file_size 外配置完全相同的小文件共享同一个 segment：
+ * 共享 segment 按第一个对象的配置编码、上传与定时封装，任何一项不同都会改变其他对象的布局或行为
+ */
+std::string data_manager::pack_key(const config &cfg)
+{
+    char padding[32];
+    snprintf(padding, sizeof(padding), "%.17g", cfg.max_padding_ratio);
+    return std::to_string(cfg.segment_size) + "/" + std::to_string(cfg.stripe_size) + "/" +
+           std::to_string(cfg.erasure_share_size) + "/" + std::to_string(cfg.piece_size) + "/" +
+           std::to_string(cfg.k) + "/" + std::to_string(cfg.m) + "/" + std::to_string(cfg.n) + "/" + padding + "/" +
+           std::to_string(cfg.pack_timeout_ms) + "/" + std::to_string(cfg.upload_quorum) + "/" +
+           std::to_string(cfg.long_tail_extra);
+}
+
+/**
+ * 小文件追加到打开的共享 segment 中，segment 写满时封装
+ * 开启 cfg.stage_small_files 时先写入 staged_object 表，返回时数据已落盘；
+ * 封装时才写入 file 与 packed_object 表，并删除暂存记录
+ * @param filename 文件名
+ * @param cfg 配置
+ */
+void data_manager::pack_file(const std::string &filename, config &cfg)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        perror("pack file: Failed to open file");
+        return;
+    }
+    std::vector<char> data;
+    const int unit = 16 << 10;
+    char buf[unit];
+    int n;
+    while ((n = read(fd, buf, unit)) > 0)
+    {
+        data.insert(data.end(), buf, buf + n);
+    }
+    close(fd);
+
+    boost::uuids::random_generator uuid_v4;
+    file object(filename, cfg);
+    object.id = uuid_v4();
+    object.cfg.file_size = data.size();
+    if (cfg.stage_small_files)
+    {
+        db_write_lock lock(*this);
+        if (!db_insert_staged_object(object, data))
+        {
+            printf("pack file: Failed to stage %s: %s\n", filename.c_str(), sqlite3_errmsg(sql));
+            return;
+        }
+    }
+    pack_object(object, data);
+}
+
+/**
+ * 把小文件追加到与其配置相同的打开中的共享 segment，放不下或写满时封装
+ * @param object 小文件，cfg.file_size 为数据长度
+ * @param data 小文件的数据
+ */
+void data_manager::pack_object(const file &object, const std::vector<char> &data)
+{
+    const config &cfg = object.cfg;
+    // 写满的共享 segment 移出 open_packs 后在锁外封装，编码与 piece 写入不阻塞其它小文件
+    std::vector<std::shared_ptr<open_pack>> full;
+    bool opened = false;
+    {
+        std::lock_guard<std::mutex> lock(packs_mutex);
+        const std::string &key = pack_key(cfg);
+        auto it = open_packs.find(key);
+        // 放不下则先封装当前 segment
+        if (it != open_packs.end() && it->second.seg.data.size() + data.size() > cfg.segment_size)
+        {
+            full.push_back(take_pack(it));
+            it = open_packs.end();
+        }
+        if (it == open_packs.end())
+        {
+            boost::uuids::random_generator uuid_v4;
+            open_pack pack;
+            pack.container = file("pack-" + to_string(uuid_v4()), cfg);
+            pack.container.id = uuid_v4();
+            pack.seg.id = uuid_v4();
+            pack.seg.index = 0;
+            pack.seg.file_id = pack.container.id;
+            pack.opened = std::chrono::steady_clock::now();
+            it = open_packs.emplace(key, pack).first;
+            opened = true;
+        }
+
+        open_pack &pack = it->second;
+        pack.objects.emplace_back(object, pack.seg.data.size());
+        pack.seg.data.insert(pack.seg.data.end(), data.begin(), data.end());
+        printf("pack file: %s -> %s offset %d\n", object.name.c_str(), to_string(pack.seg.id).c_str(), pack.objects.back().second);
+
+        if (pack.seg.data.size() == cfg.segment_size)
+        {
+            full.push_back(take_pack(it));
+        }
+    }
+    if (opened)
+    {
+        wake_sealer();
+    }
+    for (const auto &pack : full)
+    {
+        seal_pack(pack);
+    }
+}
+
+/**
+ * 重新打包上次运行暂存后未封装的小文件，在后台封装线程启动前调用
+ */
+void data_manager::restage_objects()
+{
+    const auto &objects = db_select_staged_objects();
+    for (const auto &object : objects)
+    {
+        pack_object(object.first, object.second);
+    }
+    if (!objects.empty())
+    {
+        printf("Restage packed objects: %d\n", (int)objects.size());
+    }
+}
+
+/**
+ * 把共享 segment 移出 open_packs，交给调用者封装，调用时持有 packs_mutex
+ * @param it open_packs 中的位置
+ * @return 正在封装的共享 segment，封装提交前留在 sealing_packs 中供读取
+ */
+std::shared_ptr<data_manager::open_pack> data_manager::take_pack(std::map<std::string, open_pack>::iterator it)
+{
+    auto pack = std::make_shared<open_pack>(std::move(it->second));
+    pack->sealing = true;
+    open_packs.erase(it);
+    sealing_packs.push_back(pack);
+    return pack;
+}
+
+/**
+ * 封装共享 segment：按实际长度作为普通 segment 编码上传，
+ * 并在同一事务中记录各个小文件的 offset 与 length、删除它们的暂存记录。
+ * 不持有 packs_mutex 调用；编码使用数据的副本，失败时小文件仍留在内存中，
+ * 经过 pack_timeout_ms 后重试
+ * @param pack 由 take_pack 取出的共享 segment
+ */
+void data_manager::seal_pack(const std::shared_ptr<open_pack> &pack)
+{
+    file container = pack->container;
+    segment seg = pack->seg;
+    container.cfg.file_size = seg.data.size();
+    const config &cfg = container.cfg;
+    std::vector<piece> stored;
+    const group_commit::ticket ticket = durable.begin();
+    try
+    {
+        data_processor dp(cfg);
+        store_segment(dp, seg, stored, ticket);
+        sync_pieces(ticket);
+    }
+    catch (int e)
+    {
+        perror("Failed to seal packed segment");
+        durable.release(ticket);
+        settle_batch(to_string(seg.id), false);
+        for (const auto &p : stored)
+        {
+            discard_piece(p);
+        }
+        {
+            std::lock_guard<std::mutex> lock(packs_mutex);
+            pack->sealing = false;
+            pack->opened = std::chrono::steady_clock::now();
+        }
+        packs_cv.notify_all();
+        printf("Seal packed segment: %s failed, %d objects kept in memory\n", to_string(pack->seg.id).c_str(), (int)pack->objects.size());
+        wake_sealer();
+        return;
+    }
+    {
+        db_write_lock lock(*this);
+        sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+        db_insert_file(container);
+        db_insert_segment(seg);
+        for (const auto &p : stored)
+        {
+            db_insert_piece(p);
+        }
+        const std::string &segment_id = to_string(seg.id);
+        for (const auto &object : pack->objects)
+        {
+            db_insert_file(object.first);
+            db_insert_packed_object(to_string(object.first.id), segment_id, object.second, object.first.cfg.file_size);
+            db_remove_staged_object(to_string(object.first.id));
+        }
+        db_commit();
+    }
+    settle_batch(to_string(seg.id), true);
+    publish_pieces(stored);
+    // pieces 发布之后才从内存中移除，读取总能在内存或目录中找到小文件
+    {
+        std::lock_guard<std::mutex> lock(packs_mutex);
+        sealing_packs.remove(pack);
+    }
+    packs_cv.notify_all();
+    printf("Seal packed segment: %s, %d objects\n", to_string(seg.id).c_str(), (int)pack->objects.size());
+}
+
+/**
+ * 封装打开时间超过 pack_timeout_ms 的共享 segment，并重试上次封装失败的共享 segment
+ */
+void data_manager::seal_expired_packs()
+{
+    std::vector<std::shared_ptr<open_pack>> expired;
+    {
+        std::lock_guard<std::mutex> lock(packs_mutex);
+        const auto now = std::chrono::steady_clock::now();
+        for (auto it = open_packs.begin(); it != open_packs.end();)
+        {
+            const open_pack &pack = it->second;
+            if (now - pack.opened >= std::chrono::milliseconds(pack.container.cfg.pack_timeout_ms))
+            {
+                expired.push_back(take_pack(it++));
+            }
+            else
+            {
+                it++;
+            }
+        }
+        for (const auto &pack : sealing_packs)
+        {
+            if (!pack->sealing && now - pack->opened >= std::chrono::milliseconds(pack->container.cfg.pack_timeout_ms))
+            {
+                pack->sealing = true;
+                expired.push_back(pack);
+            }
+        }
+    }
+    for (const auto &pack : expired)
+    {
+        seal_pack(pack);
+    }
+}
+
+/**
+ * 立即封装所有打开中与封装失败的共享 segment，并等待其它线程正在进行的封装结束
+ */
+void data_manager::flush_packs()
+{
+    std::vector<std::shared_ptr<open_pack>> packs;
+    {
+        std::lock_guard<std::mutex> lock(packs_mutex);
+        while (!open_packs.empty())
+        {
+            packs.push_back(take_pack(open_packs.begin()));
+        }
+        for (const auto &pack : sealing_packs)
+        {
+            if (!pack->sealing)
+            {
+                pack->sealing = true;
+                packs.push_back(pack);
+            }
+        }
+    }
+    for (const auto &pack : packs)
+    {
+        seal_pack(pack);
+    }
+    std::unique_lock<std::mutex> lock(packs_mutex);
+    packs_cv.wait(lock, [this] {
+        return std::none_of(sealing_packs.begin(), sealing_packs.end(), [](const std::shared_ptr<open_pack> &pack) { return pack->sealing; });
+    });
+}
+
+/**
+ * 后台线程：在最早的共享 segment 超时时封装它
+ */
+void data_manager::seal_packs_on_timer()
+{
+    std::unique_lock<std::mutex> lock(sealer_mutex);
+    while (!sealer_stop)
+    {
+        lock.unlock();
+        seal_expired_packs();
+        // 没有打开中的共享 segment 时等待 pack_file 唤醒
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+        {
+            std::lock_guard<std::mutex> packs_lock(packs_mutex);
+            for (const auto &pair : open_packs)
+            {
+                deadline = std::min(deadline, pair.second.opened + std::chrono::milliseconds(pair.second.container.cfg.pack_timeout_ms));
+            }
+            for (const auto &pack : sealing_packs)
+            {
+                if (!pack->sealing)
+                {
+                    deadline = std::min(deadline, pack->opened + std::chrono::milliseconds(pack->container.cfg.pack_timeout_ms));
+                }
+            }
+        }
+        lock.lock();
+        sealer_cv.wait_until(lock, deadline, [this] { return sealer_stop || packs_changed; });
+        packs_changed = false;
+    }
+}
+
+/**
+ * 打开了新的共享 segment 或封装失败时，让后台线程重新计算下一次封装的时间
+ */
+void data_manager::wake_sealer()
+{
+    {
+        std::lock_guard<std::mutex> lock(sealer_mutex);
+        packs_changed = true;
+    }
+    sealer_cv.notify_all();
+}
+
+/**
+ * 在尚未封装提交的共享 segment 中查找小文件
+ * @param filename 文件名
+ * @param object 找到时写入小文件的 file，可为 nullptr
+ * @param data 找到时写入小文件的数据，可为 nullptr
+ * @return 是否找到
+ */
+bool data_manager::find_unsealed(const std::string &filename, file *object, segment_buffer *data)
+{
+    std::lock_guard<std::mutex> lock(packs_mutex);
+    auto find = [&](const open_pack &pack) {
+        for (const auto &entry : pack.objects)
+        {
+            if (entry.first.name == filename)
+            {
+                if (object != nullptr)
+                {
+                    *object = entry.first;
+                }
+                if (data != nullptr)
+                {
+                    const auto begin = pack.seg.data.begin() + entry.second;
+                    data->assign(begin, begin + entry.first.cfg.file_size);
+                }
+                return true;
+            }
+        }
+        return false;
+    };
+    for (const auto &pair : open_packs)
+    {
+        if (find(pair.second))
+        {
+            return true;
+        }
+    }
+    for (const auto &pack : sealing_packs)
+    {
+        if (find(*pack))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 下载并解码单个 segment
+ * <ol>
+ * <li> 从相应的 storage nodes 下载得到 pieces
+ * <li> 解析 pieces 为 erasure shares
+ * <li> erasure shares 纠删解码成 stripes
+ * <li> stripes 拼接成 segment
+ * </ol>
+ * @param dp 对应文件配置的 data processor
+ * @param segment_id segment id
+ * @param pieces 按 index 排序的 piece 元数据
+ * @return segment
+ */
+segment data_manager::fetch_segment(data_processor &dp, const std::string &segment_id, std::vector<piece> &pieces)
+{
+    trace::span span("segment_fetch", segment_id);
+    // 命中缓存时不再读取 pieces 和解码
+    const auto &cached = cache.get(segment_id);
+    if (cached != nullptr)
+    {
+        segment segment = db_select_segment(segment_id);
+        segment.data = *cached;
+        return segment;
+    }
+
+    memory::reservation budget(dp.segment_footprint(dp.get_config().segment_size));
+    // 固定 epoch 后重新查询当前代的 pieces，调用方查到的可能已被修复替换。
+    // 读取结束前这一代 pieces 即使被替换也不会被回收
+    const auto &pin = epochs.pin();
+    pieces = db_select_pieces_by_segment(segment_id);
+
+    // 从相应的 storage node 下载 piece data
+    for (auto &piece : pieces)
+    {
+        piece.data.clear();
+        read_piece(piece);
+    }
+
+    // 查询出 segment 元数据，解码需要实际长度
+    segment segment = db_select_segment(segment_id);
+
+    // 遍历 pieces
+    // erasure shares 按 piece index 放置，缺失的 piece 以空 erasure share 占位
+    puts("split piece");
+    const config &cfg = dp.get_config();
+    const int stripe_num = dp.stripe_lengths(segment.length).size();
+    std::vector<std::vector<erasure_share>> s(cfg.k + cfg.m, std::vector<erasure_share>(stripe_num));
+    int available = 0;
+    // 读取失败的 pieces，读时修复时替换
+    std::vector<piece> lost;
+    for (auto &piece : pieces)
+    {
+        if (piece.index < 0 || piece.index >= s.size() || piece.data.empty())
+        {
+            lost.push_back(piece);
+        }
+        if (piece.index < 0 || piece.index >= s.size())
+        {
+            continue;
+        }
+        if (!piece.data.empty())
+        {
+            available++;
+        }
+        // piece 拆分成 erasure share（横向）
+        s[piece.index] = dp.split_piece(piece, segment.length);
+    }
+
+    puts("merge to stripes");
+    // erasure share decode，纵向拼接成 stripe
+    std::vector<stripe> stripes = dp.merge_to_stripes(s, segment.length);
+    //  stripe 拼接成 segment
+    segment.data = std::move(dp.merge_to_segment(stripes).data);
+    // 可用 piece 不足 k 个时解码结果无效，不缓存
+    if (available >= cfg.k && segment.data.size() == segment.length)
+    {
+        cache.put(segment_id, std::make_shared<const segment_buffer>(segment.data));
+        if (config::repair_on_read && available < cfg.n)
+        {
+            repair_on_read(dp, segment, pieces, lost);
+        }
+    }
+    return segment;
+}
+
+/**
+ * 读时修复：降级读取已经解码出整个 segment，直接重新编码出缺失的 pieces，不再重新下载
+ * <ol>
+ * <li> 读取成功的 pieces 保留，补齐到 n 个 pieces，优先使用读取失败的 piece 的 index
+ * <li> 新 pieces 写到该 segment 的 pieces 都不在的节点上
+ * <li> 短事务中发布新一代：新 pieces 与保留的 pieces 属于新一代，读取失败的 pieces 随旧一代删除
+ * </ol>
+ * 该 segment 正在修复时跳过；发布后扫描不再认为该 segment 损坏
+ * @param dp 对应文件配置的 data processor
+ * @param segment 解码出的 segment
+ * @param pieces 本次读取的 pieces
+ * @param lost 其中读取失败的 pieces
+ */
+void data_manager::repair_on_read(data_processor &dp, const segment &segment, const std::vector<piece> &pieces,
+                                  const std::vector<piece> &lost)
+{
+    const std::string &segment_id = to_string(segment.id);
+    std::unique_lock<std::shared_mutex> segment_guard(segment_lock(segment_id), std::try_to_lock);
+    if (!segment_guard.owns_lock() || pieces.empty())
+    {
+        return;
+    }
+    const config &cfg = dp.get_config();
+    const int generation = pieces.front().generation;
+    const group_commit::ticket ticket = durable.begin();
+    std::vector<bool> used(cfg.k + cfg.m, false);
+    std::set<std::string> nodes;
+    std::set<std::string> lost_ids;
+    for (const auto &p : lost)
+    {
+        lost_ids.insert(to_string(p.id));
+    }
+    std::vector<piece> survivors;
+    for (const auto &p : pieces)
+    {
+        nodes.insert(to_string(p.storage_node_id));
+        if (lost_ids.count(to_string(p.id)) > 0)
+        {
+            continue;
+        }
+        used[p.index] = true;
+        survivors.push_back(p);
+    }
+
+    // 重新编码出全部 k + m 个候选 pieces
+    storj::segment copy(segment.data);
+    std::vector<stripe> stripes = dp.split_segment(copy);
+    std::vector<std::vector<erasure_share>> s;
+    s.reserve(stripes.size());
+    for (auto &stripe : stripes)
+    {
+        s.emplace_back(dp.erasure_encode(stripe));
+    }
+    config candidates = cfg;
+    candidates.n = cfg.k + cfg.m;
+    std::vector<piece> encoded = data_processor(candidates).merge_to_pieces(s);
+
+    // 补齐缺失的 pieces，写到该 segment 的 pieces 都不在的节点上
+    boost::uuids::random_generator uuid_v4;
+    std::vector<piece> pieces_new;
+    auto storage_node = storage_nodes.begin();
+    for (int i = 0; i < encoded.size() && survivors.size() + pieces_new.size() < cfg.n; i++)
+    {
+        if (used[i])
+        {
+            continue;
+        }
+        while (storage_node != storage_nodes.end() && nodes.count(to_string(storage_node->id)) > 0)
+        {
+            storage_node++;
+        }
+        if (storage_node == storage_nodes.end())
+        {
+            break;
+        }
+        piece &piece = encoded[i];
+        piece.id = uuid_v4();
+        piece.index = i;
+        piece.segment_id = segment.id;
+        piece.generation = generation + 1;
+        piece.storage_node_id = storage_node->id;
+        piece.erasure_shares = std::vector<erasure_share>();
+        // 重试也只换到该 segment 的 pieces 都不在的节点
+        if (upload_piece_with_retry(piece, ticket, nodes))
+        {
+            nodes.insert(to_string(piece.storage_node_id));
+            piece.data = piece_buffer();
+            pieces_new.push_back(piece);
+        }
+        storage_node++;
+    }
+    if (pieces_new.empty())
+    {
+        durable.release(ticket);
+        return;
+    }
+    try
+    {
+        sync_pieces(ticket);
+    }
+    catch (int e)
+    {
+        perror("Failed to repair segment on read");
+        for (const auto &p : pieces_new)
+        {
+            discard_piece(p);
+        }
+        return;
+    }
+
+    // 发布新一代，期间 segment 已被其他途径修改则放弃
+    {
+        db_write_lock lock(*this);
+        if (db_select_segment(segment_id).generation != generation)
+        {
+            for (const auto &p : pieces_new)
+            {
+                discard_piece(p);
+            }
+            return;
+        }
+        sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+        for (const auto &p : pieces_new)
+        {
+            db_insert_piece(p);
+        }
+        for (const auto &p : survivors)
+        {
+            db_update_piece_generation(to_string(p.id), generation + 1);
+        }
+        db_update_segment_generation(segment_id, generation + 1);
+        db_remove_pieces_by_generation(segment_id, generation);
+        db_commit();
+    }
+    publish_pieces(pieces_new);
+    if (!lost.empty())
+    {
+        epochs.retire([this, lost]()
+                      {
+                          for (const auto &p : lost)
+                          {
+                              discard_piece(p);
+                          }
+                      });
+    }
+    printf("Repair on read: segment %s, %d pieces regenerated\n", segment_id.c_str(), (int)pieces_new.size());
+}
+
+/**
+ * 下载指定文件
+ * <ol>
+ * <li> 读取数据库，得到 file 元数据
+ * <li> 查询 file 对应的 segments
+ * <li> 以 segment 为单位，查询对应的 pieces 元数据
+ * <li> 从相应的 storage nodes 下载得到 pieces
+ * <li> 解析 pieces 为 erasure shares
+ * <li> erasure shares 纠删解码成 stripes
+ * <li> stripes 拼接成 segments
+ * <li> segments 拼接成 file
+ * </ol>
+ * 打包存储的小文件从共享 segment 中按 offset 与 length 截取
+ * @param filename 文件名
+ * @return 文件
+ */
+file data_manager::download_file(const std::string &filename)
+{
+    trace::span span("download_file", filename);
+    memory::operation op("download");
+
+    // 尚未封装的小文件直接从内存中读取
+    {
+        file file;
+        segment_buffer data;
+        if (find_unsealed(filename, &file, &data))
+        {
+            file.segments.emplace_back(std::move(data));
+            return file;
+        }
+    }
+
+    // 从数据库中查出对应的 file 数据
+    file file = db_select_file_by_name(filename);
+    data_processor dp(file.cfg);
+
+    // 打包存储的小文件
+    {
+        std::string segment_id;
+        int offset;
+        int length;
+        if (db_select_packed_object(to_string(file.id), &segment_id, &offset, &length))
+        {
+            const segment &container = db_select_segment(segment_id);
+            data_processor container_dp(db_select_file_by_id(to_string(container.file_id)).cfg);
+            std::vector<piece> pieces = db_select_pieces_by_segment(segment_id);
+            segment segment = fetch_segment(container_dp, segment_id, pieces);
+            const auto begin = segment.data.begin() + std::min(offset, (int)segment.data.size());
+            const auto end = segment.data.begin() + std::min(offset + length, (int)segment.data.size());
+            segment.data = segment_buffer(begin, end);
+            file.segments.emplace_back(segment);
+            return file;
+        }
+    }
+
+    // 从数据库中有序查出对应的 piece 数据
+    std::vector<std::pair<std::string, std::vector<piece>>> segment_id_to_pieces = locate_segments(filename);
+    printf("segment num: %d\n", segment_id_to_pieces.size());
+
+    // 遍历映射表，以 segment 为单位处理 piece
+    std::vector<segment> segments;
+    for (auto &pair : segment_id_to_pieces)
+    {
+        segments.emplace_back(fetch_segment(dp, pair.first, pair.second));
+    }
+
+    //  segment 拼接成 file
+    file.segments = segments;
+
+    return file;
+}
+
+/**
+ * 按 segment 与 piece 的 index 有序查出文件当前代的 pieces，不读取数据
+ * @param filename 文件名
+ * @return (segment id, pieces)，按 segment index 排列
+ */
+std::vector<std::pair<std::string, std::vector<piece>>> data_manager::locate_segments(const std::string &filename)
+{
+    boost::uuids::string_generator sg;
+    std::vector<std::pair<std::string, std::vector<piece>>> segment_id_to_pieces;
+    {
+        const char *sql_select = "select \"p\".\"id\",\n"
+                                 "       \"p\".\"storage_node_id\",\n"
+                                 "       \"s\".\"id\",\n"
+                                 "       \"p\".\"index\"\n"
+                                 "from \"file\" \"f\"\n"
+                                 "         left join \"segment\" \"s\" on \"f\".\"id\" = \"s\".\"file_id\"\n"
+                                 "         left join \"piece\" \"p\" on \"s\".\"id\" = \"p\".\"segment_id\" and \"s\".\"generation\" = \"p\".\"generation\"\n"
+                                 "where \"f\".\"file_name\" = ?\n"
+                                 "  and \"f\".\"status\" = ?\n"
+                                 "order by \"s\".\"index\", \"p\".\"index\";";
+        auto db = db_read();
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return segment_id_to_pieces;
+        }
+        sqlite3_bind_text(stmt, 1, filename.c_str(), filename.length(), nullptr);
+        sqlite3_bind_int(stmt, 2, file_complete);
+        std::string last_segment_id;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            // 没有 segment 的文件（空文件）
+            if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+            {
+                continue;
+            }
+            piece p;
+            p.id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 0)));
+            p.storage_node_id = sg(reinterpret_cast<const char *const>(sqlite3_column_text(stmt, 1)));
+            p.segment_id = sg(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
+            p.index = sqlite3_column_int(stmt, 3);
+            const std::string &segment_id = to_string(p.segment_id);
+            if (last_segment_id != segment_id)
+            {
+                last_segment_id = segment_id;
+                segment_id_to_pieces.emplace_back(segment_id, std::vector<piece>(0));
+            }
+            segment_id_to_pieces.back().second.push_back(p);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return segment_id_to_pieces;
+}
+
+/**
+ * 读取 segment 中 [offset, offset + length) 范围的数据，追加到 out
+ * <ol>
+ * <li> 范围映射到 stripe，再映射到 stripe 内的数据 erasure share
+ * <li> 数据 share i 位于第 i 个 piece 中，偏移为前面各个 stripe 的 share 大小之和
+ * <li> 只用 pread 读取覆盖范围的数据 piece 片段
+ * <li> 数据 piece 缺失时，读取任意 k 个 piece 中该 stripe 的 share，只解码该 stripe
+ * </ol>
+ * @return 可用 piece 不足 k 个时返回 false
+ */
+bool data_manager::read_segment_range(data_processor &dp, const segment &segment, long offset, long length, std::vector<char> &out)
+{
+    // 命中缓存时直接截取
+    // 范围读取只节省了范围内的字节
+    const auto &cached = cache.get(to_string(segment.id), length);
+    if (cached != nullptr)
+    {
+        out.insert(out.end(), cached->begin() + offset, cached->begin() + offset + length);
+        return true;
+    }
+
+    // 读取期间引用的 pieces 不会被修复回收
+    const auto &pin = epochs.pin();
+    const config &cfg = dp.get_config();
+    // 按 index 放置 piece，缺失的 id 为 nil
+    std::vector<piece> pieces(cfg.k + cfg.m);
+    for (const auto &p : db_select_pieces_by_segment(to_string(segment.id)))
+    {
+        if (p.index >= 0 && p.index < pieces.size())
+        {
+            pieces[p.index] = p;
+        }
+    }
+
+    const std::vector<int> &lengths = dp.stripe_lengths(segment.length);
+    const long end = offset + length;
+    // 当前 stripe 在 segment 中的起点，及其 erasure share 在 piece 中的偏移
+    long stripe_begin = 0;
+    long piece_offset = 0;
+    for (int x = 0; x < lengths.size() && stripe_begin < end; x++)
+    {
+        int packetsize;
+        int share_size;
+        dp.stripe_layout(lengths[x], &packetsize, &share_size);
+        const long stripe_end = stripe_begin + lengths[x];
+        if (stripe_end > offset)
+        {
+            const long a = std::max(offset, stripe_begin) - stripe_begin;
+            const long b = std::min(end, stripe_end) - stripe_begin;
+            const size_t out_begin = out.size();
+            bool degraded = false;
+            // 直接读取数据 piece
+            for (long pos = a; pos < b;)
+            {
+                const int i = pos / share_size;
+                const int n = std::min(b, (long)(i + 1) * share_size) - pos;
+                out.resize(out.size() + n);
+                if (pieces[i].id.is_nil() || read_piece_range(pieces[i], piece_offset + pos % share_size, n, out.data() + out.size() - n) != n)
+                {
+                    degraded = true;
+                    break;
+                }
+                pos += n;
+            }
+            // 数据 piece 缺失，只解码该 stripe
+            if (degraded)
+            {
+                out.resize(out_begin);
+                std::vector<erasure_share> shares(cfg.k + cfg.m);
+                int available = 0;
+                for (int y = 0; y < cfg.k + cfg.m && available < cfg.k; y++)
+                {
+                    if (pieces[y].id.is_nil())
+                    {
+                        continue;
+                    }
+                    share_buffer buf(share_size);
+                    if (read_piece_range(pieces[y], piece_offset, share_size, buf.data()) == share_size)
+                    {
+                        shares[y].data = std::move(buf);
+                        available++;
+                    }
+                }
+                if (available < cfg.k)
+                {
+                    puts("read range: not enough pieces");
+                    return false;
+                }
+                const stripe &stripe = dp.decode_stripe(shares, lengths[x]);
+                out.insert(out.end(), stripe.data.begin() + a, stripe.data.begin() + b);
+            }
+        }
+        stripe_begin = stripe_end;
+        piece_offset += share_size;
+    }
+    return true;
+}
+
+/**
+ * 读取文件中 [offset, offset + length) 范围的数据，只访问覆盖该范围的 segments 和数据 pieces
+ * @param filename 文件名
+ * @param offset 文件内偏移
+ * @param length 读取长度，超出文件末尾的部分被截断
+ * @return 读取到的数据，失败时为空
+ */
+std::vector<char> data_manager::read_range(const std::string &filename, long offset, long length)
+{
+    trace::span span("download_range", filename);
+    memory::operation op("read_range");
+    std::vector<char> res;
+    if (offset < 0 || length <= 0)
+    {
+        return res;
+    }
+
+    // 尚未封装的小文件直接从内存中读取
+    {
+        file object;
+        segment_buffer data;
+        if (find_unsealed(filename, &object, &data))
+        {
+            if (offset < (long)data.size())
+            {
+                res.assign(data.begin() + offset, data.begin() + std::min((long)data.size(), offset + length));
+            }
+            return res;
+        }
+    }
+
+    const file &file = db_select_file_by_name(filename);
+    if (file.name != filename)
+    {
+        return res;
+    }
+    data_processor dp(file.cfg);
+
+    // 打包存储的小文件，映射到共享 segment 中的范围
+    {
+        std::string segment_id;
+        int object_offset;
+        int object_length;
+        if (db_select_packed_object(to_string(file.id), &segment_id, &object_offset, &object_length))
+        {
+            if (offset >= object_length)
+            {
+                return res;
+            }
+            // 共享 segment 按容器文件的配置编码，与 download_file 相同
+            const segment &container = db_select_segment(segment_id);
+            data_processor container_dp(db_select_file_by_id(to_string(container.file_id)).cfg);
+            if (!read_segment_range(container_dp, container, object_offset + offset, std::min(length, object_length - offset), res))
+            {
+                res.clear();
+            }
+            return res;
+        }
+    }
+
+    long segment_begin = 0;
+    for (const auto &segment : db_select_segments_by_file(to_string(file.id)))
+    {
+        const long segment_end = segment_begin + segment.length;
+        if (segment_begin >= offset + length)
+        {
+            break;
+        }
+        if (segment_end > offset)
+        {
+            const long a = std::max(offset, segment_begin) - segment_begin;
+            const long b = std::min(offset + length, segment_end) - segment_begin;
+            if (!read_segment_range(dp, segment, a, b - a, res))
+            {
+                res.clear();
+                return res;
+            }
+        }
+        segment_begin = segment_end;
+    }
+    return res;
+}
+
+/**
+ * 扫描需要修复的 segments
+ * @return segment ids, ks, rs
+ */
+std::tuple<std::vector<std::string>, std::vector<int>, std::vector<int>, std::unordered_map<std::string, int>> data_manager::scan_corrupted_segments()
+{
+    std::cout << "begin scan" << std::endl;
+    drain_uploads();
+    // 顺带回收超时的 pending pieces
+    sweep_pending(config::pending_timeout_ms);
+    std::vector<std::string> segments_to_repair;
+    std::vector<int> ks;
+    std::vector<int> rs;
+    std::unordered_map<std::string, int> file_corrupted_segment_size;
+
+    // 查询并遍历所有 file
+    auto db = db_read();
+    std::vector<file> files;
+    {
+        const char *sql_select = "select *\n"
+                                 "from \"file\"\n"
+                                 "where \"status\" = ?;";
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return {};
+        }
+        sqlite3_bind_int(stmt, 1, file_complete);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            file file;
+            db_stmt_select_file(stmt, &file);
+            files.emplace_back(file);
+        }
+        sqlite3_finalize(stmt);
+    }
+    std::cout << "file size :" << files.size() << std::endl;
+    for (const auto &file : files)
+    {
+        int now_file_segments_corrupted_size = 0;
+        // 查询每个 file 对应的 segments
+        std::vector<std::string> segment_ids;
+        {
+            const char *sql_select = "select \"p\".\"id\"\n"
+                                     "from \"file\" \"s\"\n"
+                                     "         left join \"segment\" \"p\" on \"s\".\"id\" = \"p\".\"file_id\"\n"
+                                     "where \"s\".\"id\" = ? \n"
+                                     "order by \"p\".\"index\";";
+            sqlite3_stmt *stmt;
+            const std::string &file_id = to_string(file.id);
+            // std::cout << boost::uuids::to_string(file.id).c_str() << " "<< to_string(file.id).length()<< std::endl;
+            if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                continue;
+            }
+            sqlite3_bind_text(stmt, 1, file_id.c_str(), file_id.length(), nullptr);
+            // std::cout << sqlite3_expanded_sql(stmt) << std::endl;
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                // 打包存储的小文件没有自己的 segment
+                if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+                {
+                    continue;
+                }
+                const std::string &segment_id = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+                segment_ids.emplace_back(segment_id);
+            }
+            sqlite3_finalize(stmt);
+        }
+        // 以 segment 为单位，查询所有对应的 piece
+        std::cout << "segment size : " << segment_ids.size() << std::endl;
+        for (const auto &segment_id : segment_ids)
+        {
+            // 审计 piece
+            const int count = count_available_pieces(segment_id);
+            // std::cout << "count size " << count << std::endl;
+            // 当剩余 piece 数小于 m 时，将 segment id 和缺失的 piece id 加入到结果中
+            // k = 5 , m = 2 n = 7
+            if (count < file.cfg.n)
+            {
+                now_file_segments_corrupted_size++;
+                segments_to_repair.emplace_back(segment_id);
+                ks.emplace_back(file.cfg.k);
+                rs.emplace_back(count);
+            }
+        }
+        file_corrupted_segment_size.emplace(to_string(file.id), now_file_segments_corrupted_size);
+    }
+    return std::make_tuple(segments_to_repair, ks, rs, file_corrupted_segment_size);
+}
+
+/**
+ * 流式扫描：按 segment id 分批遍历已上传完成文件的 segments 并审计，
+ * 每发现一个损坏的 segment 立即回调，不在内存中累积结果，也不长时间持有读事务
+ * @param on_damaged 回调 (segment id, k, 剩余可用 piece 数 r)
+ * @return 扫描的 segment 数
+ */
+int data_manager::scan_segments(const std::function<void(const std::string &, int, int)> &on_damaged)
+{
+    drain_uploads();
+    // 顺带回收超时的 pending pieces
+    sweep_pending(config::pending_timeout_ms);
+    const int batch_size = 256;
+    const char *sql_select = "select \"s\".\"id\", \"f\".\"k\", \"f\".\"n\"\n"
+                             "from \"segment\" \"s\"\n"
+                             "         join \"file\" \"f\" on \"f\".\"id\" = \"s\".\"file_id\"\n"
+                             "where \"f\".\"status\" = ?\n"
+                             "  and \"s\".\"id\" > ?\n"
+                             "order by \"s\".\"id\"\n"
+                             "limit ?;";
+    int scanned = 0;
+    std::string last_id;
+    while (true)
+    {
+        // (segment id, k, n)
+        std::vector<std::tuple<std::string, int, int>> batch;
+        {
+            auto db = db_read();
+            sqlite3_stmt *stmt;
+            if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                return scanned;
+            }
+            sqlite3_bind_int(stmt, 1, file_complete);
+            sqlite3_bind_text(stmt, 2, last_id.c_str(), last_id.length(), nullptr);
+            sqlite3_bind_int(stmt, 3, batch_size);
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                batch.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2));
+            }
+            sqlite3_finalize(stmt);
+        }
+        if (batch.empty())
+        {
+            break;
+        }
+        for (const auto &entry : batch)
+        {
+            const std::string &segment_id = std::get<0>(entry);
+            const int count = count_available_pieces(segment_id);
+            if (count < std::get<2>(entry))
+            {
+                on_damaged(segment_id, std::get<1>(entry), count);
+            }
+            scanned++;
+        }
+        last_id = std::get<0>(batch.back());
+    }
+    return scanned;
+}
+
+/**
+ * 按当前剩余的可用 pieces 数计算权重，放入修复队列
+ */
+void data_manager::queue_repair(repair_queue &queue, const std::string &segment_id)
+{
+    const segment &segment = db_select_segment(segment_id);
+    if (to_string(segment.id) != segment_id)
+    {
+        return;
+    }
+    const file &file = db_select_file_by_id(to_string(segment.file_id));
+    queue.push(segment_id, segment_weight(file.cfg.k, count_available_pieces(segment_id)));
+}
+
+/**
+ * 上传时未能写满 n 个 pieces 的 segments 放入修复队列
+ * @return 入队的 segments
+ */
+std::set<std::string> data_manager::queue_underfilled(repair_queue &queue)
+{
+    drain_uploads();
+    std::set<std::string> underfilled;
+    {
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+        underfilled.swap(tracker.repairs);
+    }
+    for (const auto &segment_id : underfilled)
+    {
+        queue_repair(queue, segment_id);
+    }
+    return underfilled;
+}
+
+/**
+ * 修复线程立即开始，总是先修复队列中最紧急的 segment，与 fill 向队列放入 segments 同时进行
+ * @param fill 在调用线程中放入待修复的 segments，返回后关闭队列
+ * @return 修复的 segment 数
+ */
+int data_manager::run_repairs(repair_queue &queue, const std::function<void()> &fill, const std::function<void(const std::string &)> &on_repaired)
+{
+    int repaired = 0;
+    std::thread repairer([&]
+                         {
+                             std::string segment_id;
+                             while (queue.pop(&segment_id))
+                             {
+                                 if (repair_segment(segment_id))
+                                 {
+                                     repaired++;
+                                     if (on_repaired)
+                                     {
+                                         on_repaired(segment_id);
+                                     }
+                                 }
+                             }
+                         });
+    fill();
+    queue.close();
+    repairer.join();
+    return repaired;
+}
+
+/**
+ * 边扫描边修复：扫描线程把损坏的 segments 放入有界的修复队列，
+ * 修复线程立即开始，总是先修复队列中最紧急的 segment。
+ * 上传时未能写满 n 个 pieces 的 segments 在扫描前入队
+ * @param queue_capacity 修复队列容量，超出时丢弃最不紧急的，由下一轮扫描重新发现
+ * @param on_repaired 每修复完成一个 segment 在修复线程中回调，可为空
+ * @return 修复的 segment 数
+ */
+int data_manager::scan_and_repair(int queue_capacity, const std::function<void(const std::string &)> &on_repaired)
+{
+    repair_queue queue(queue_capacity);
+    int scanned = 0;
+    const int repaired = run_repairs(queue, [&]
+                                     {
+                                         const std::set<std::string> &underfilled = queue_underfilled(queue);
+                                         // 已入队的 segments 可能正在修复，扫描时跳过
+                                         scanned = scan_segments([&](const std::string &segment_id, int k, int r)
+                                                                 {
+                                                                     if (underfilled.count(segment_id) == 0)
+                                                                     {
+                                                                         queue.push(segment_id, segment_weight(k, r));
+                                                                     }
+                                                                 });
+                                     },
+                                     on_repaired);
+    printf("scan and repair: %d segments scanned, %d repaired, %ld dropped\n", scanned, repaired, queue.dropped());
+    return repaired;
+}
+
+/**
+ * 抽样审计并修复：先做一轮 sample_audit()，只全量审计估计丢失率超过阈值的节点，
+ * 其中发现的损坏 segments 与上传时未能写满的 segments 按紧急程度修复。
+ * 审计 I/O 与目录大小无关；丢失率低的节点上的损坏要在之后的轮次中逐渐发现
+ * @param queue_capacity 修复队列容量
+ * @param on_repaired 每修复完成一个 segment 在修复线程中回调，可为空
+ * @return 修复的 segment 数
+ */
+int data_manager::sample_and_repair(int queue_capacity, const std::function<void(const std::string &)> &on_repaired)
+{
+    repair_queue queue(queue_capacity);
+    int damaged = 0;
+    const int repaired = run_repairs(queue, [&]
+                                     {
+                                         const std::set<std::string> &underfilled = queue_underfilled(queue);
+                                         for (const auto &segment_id : sample_audit())
+                                         {
+                                             if (underfilled.count(segment_id) == 0)
+                                             {
+                                                 queue_repair(queue, segment_id);
+                                                 damaged++;
+                                             }
+                                         }
+                                     },
+                                     on_repaired);
+    printf("sample audit and repair: %d damaged segments found, %d repaired, %ld dropped\n", damaged, repaired, queue.dropped());
+    return repaired;
+}
+
+/**
+ * 抽样审计，审计 I/O 与目录大小无关
+ * <ol>
+ * <li> 每个节点随机抽取 audit_sample_size 个 pieces 审计，其中 audit_deep_sample_size 个做深度审计
+ * <li> 按累计的审计结果估计节点丢失率的置信区间
+ * <li> 置信下界超过 audit_loss_threshold 时，全量审计该节点并重新开始统计
+ * </ol>
+ * @return 审计中发现缺失 piece 的 segments，需要修复
+ */
+std::vector<std::string> data_manager::sample_audit()
+{
+    drain_uploads();
+    std::vector<std::string> damaged;
+    std::set<std::string> found;
+    for (const auto &node : storage_nodes)
+    {
+        const std::string &node_id = to_string(node.id);
+        const std::vector<piece> &sample = db_select_pieces_by_node(node_id, config::audit_sample_size);
+        for (int i = 0; i < sample.size(); i++)
+        {
+            const bool ok = i < config::audit_deep_sample_size ? deep_audit_piece(sample[i]) : audit_piece(sample[i]);
+            auditor.record(node_id, ok);
+            if (!ok && found.insert(to_string(sample[i].segment_id)).second)
+            {
+                damaged.push_back(to_string(sample[i].segment_id));
+            }
+        }
+        if (!auditor.should_escalate(node_id))
+        {
+            continue;
+        }
+        const sampling_auditor::estimate &estimate = auditor.get_estimate(node_id);
+        printf("sample audit: node %s loss rate in [%.3f, %.3f] after %ld audits, full audit\n", node_id.c_str(), estimate.lower, estimate.upper, estimate.audited);
+        int missing = 0;
+        const std::vector<piece> &pieces = db_select_pieces_by_node(node_id, 0);
+        for (const auto &p : pieces)
+        {
+            if (audit_piece(p))
+            {
+                continue;
+            }
+            missing++;
+            if (found.insert(to_string(p.segment_id)).second)
+            {
+                damaged.push_back(to_string(p.segment_id));
+            }
+        }
+        auditor.reset(node_id);
+        printf("full audit: node %s, %d of %d pieces missing\n", node_id.c_str(), missing, (int)pieces.size());
+    }
+    return damaged;
+}
+
+sampling_auditor::estimate data_manager::node_audit_estimate(const std::string &node_id) const
+{
+    return auditor.get_estimate(node_id);
+}
+
+/**
+ * 以 segment 为单位修复，步骤：
+ * <ol>
+ * <li> 查询对应的 file 配置 (k, m, n)
+ * <li> 查询对应的 pieces
+ * <li> 下载剩余的 pieces
+ * <li> pieces 解析为 erasure shares
+ * <li> erasure shares 恢复成 stripes
+ * <li> stripes 重新纠删编码成 erasure shares
+ * <li> erasure shares 合并成 pieces
+ * <li> pieces 分发到各个 storage nodes
+ * </ol>
+ * 可读取的 pieces 不足 k 个时不修复，保留当前代等待节点恢复
+ * @param segment_id
+ * @return 是否发布了新一代 pieces
+ */
+bool data_manager::repair_segment(const std::string &segment_id)
+{
+    trace::span span("repair_segment", segment_id);
+    memory::operation op("repair");
+    drain_uploads();
+    // 同一 segment 的修复依次进行；读取不等待，继续使用修复前的一代 pieces
+    std::unique_lock<std::shared_mutex> segment_guard(segment_lock(segment_id));
+    const auto &pin = epochs.pin();
+    // 各阶段的耗时 (ns) 记录到直方图，替代逐段追加到 test_data.txt
+    static metrics::histogram &split_latency = metrics::instance().get_histogram("repair.split_piece");
+    static metrics::histogram &decode_latency = metrics::instance().get_histogram("repair.decode");
+    static metrics::histogram &encode_latency = metrics::instance().get_histogram("repair.encode");
+    static metrics::histogram &merge_latency = metrics::instance().get_histogram("repair.merge_to_pieces");
+    static metrics::histogram &total_latency = metrics::instance().get_histogram("repair.total");
+    static metrics::counter &repaired = metrics::instance().get_counter("repair.segments");
+    static metrics::counter &repaired_bytes = metrics::instance().get_counter("repair.bytes");
+    const group_commit::ticket ticket = durable.begin();
+    try
+    {
+        // 查询对应的文件配置
+        const segment &segment = db_select_segment(segment_id);
+        const file &file = db_select_file_by_id(to_string(segment.file_id));
+        data_processor dp(file.cfg);
+        boost::uuids::random_generator uuid_v4;
+        boost::uuids::string_generator sg;
+        // 有序查询当前代的所有 piece
+        const std::vector<piece> &pieces_old = db_select_pieces_by_segment(segment_id);
+        memory::reservation budget(dp.segment_footprint(segment.length));
+
+        // 下载剩余的 pieces，erasure shares 按 piece index 放置，缺失的以空 erasure share 占位
+        const int stripe_num = dp.stripe_lengths(segment.length).size();
+        std::vector<std::vector<erasure_share>> s(file.cfg.k + file.cfg.m, std::vector<erasure_share>(stripe_num));
+        std::vector<piece> pieces;
+        long long t1 = metrics::now_ns();
+        for (piece piece : pieces_old)
+        {
+            // 跳过无效 piece
+            if (!read_piece(piece) || piece.index < 0 || piece.index >= s.size())
+            {
+                continue;
+            }
+            pieces.emplace_back(piece);
+            // piece 拆分成 erasure share（横向）
+            s[piece.index] = dp.split_piece(piece, segment.length);
+        }
+        long long t2 = metrics::now_ns();
+        metrics::record_interval(split_latency, t1, t2);
+        long long total_repair = t2 - t1;
+        // 解码结果无效，发布后反而会覆盖节点恢复后仍可读出的数据
+        if (pieces.size() < file.cfg.k)
+        {
+            printf("Repair segment: only %d of %d pieces available\n", (int)pieces.size(), file.cfg.k);
+            return false;
+        }
+
+        // erasure shares 恢复成 stripes，计算并修复数据
+        t1 = metrics::now_ns();
+        std::vector<stripe> stripes = dp.merge_to_stripes(s, segment.length);
+        t2 = metrics::now_ns();
+        metrics::record_interval(decode_latency, t1, t2);
+        total_repair += t2 - t1;
+        s.clear();
+
+        // 新 stripes 处理成 pieces
+        s.reserve(stripes.size());
+        t1 = metrics::now_ns();
+        for (auto &stripe : stripes)
+        {
+            // 编码成 erasure shares，该数组为纵向
+            s.emplace_back(dp.erasure_encode(stripe));
+        }
+        t2 = metrics::now_ns();
+        metrics::record_interval(encode_latency, t1, t2);
+        total_repair += t2 - t1;
+
+        // erasure shares 横向合并成 pieces
+        t1 = metrics::now_ns();
+        std::vector<piece> pieces_new = dp.merge_to_pieces(s);
+        t2 = metrics::now_ns();
+        metrics::record_interval(merge_latency, t1, t2);
+        total_repair += t2 - t1;
+        total_latency.record(total_repair);
+        repaired.add();
+        repaired_bytes.add(segment.length);
+        for (int i = 0; i < pieces_new.size(); i++)
+        {
+            piece &piece = pieces_new[i];
+            // piece id
+            piece.id = uuid_v4();
+            piece.index = i;
+            piece.segment_id = segment.id;
+            piece.generation = segment.generation + 1;
+        }
+
+        // 上传 pieces 到各个存储节点，写入失败（如节点离线）时换下一个节点
+        auto piece = pieces_new.begin();
+        auto storage_node = storage_nodes.begin();
+        int failures = 0;
+        while (piece != pieces_new.end())
+        {
+            piece->storage_node_id = storage_node->id;
+            if (upload_piece(*piece, *storage_node, ticket))
+            {
+                piece++;
+                failures = 0;
+            }
+            else if (++failures == storage_nodes.size())
+            {
+                throw -1;
+            }
+            storage_node++;
+            // 遍历到最后一个存储节点后，从第一个重新开始遍历
+            if (storage_node == storage_nodes.end())
+            {
+                storage_node = storage_nodes.begin();
+            }
+        }
+        // stop=clock();
+
+        //     duration=((double)(stop-start))/CLOCK_TAI;
+
+        //     std::cout<<"Total repair "<<duration<<std::endl;
+        // 新 pieces 落盘后才能发布
+        sync_pieces(ticket);
+        // 短事务中发布新一代 pieces：写入新 pieces，segment 切换到新一代，删除旧 pieces 的记录
+        {
+            db_write_lock lock(*this);
+            sqlite3_exec(sql, "begin transaction;", nullptr, nullptr, nullptr);
+            for (auto &p : pieces_new)
+            {
+                p.data.clear();
+                db_insert_piece(p);
+            }
+            db_update_segment_generation(segment_id, segment.generation + 1);
+            db_remove_pieces_by_generation(segment_id, segment.generation);
+            db_commit();
+        }
+        publish_pieces(pieces_new);
+        cache.invalidate(segment_id);
+        // 旧 pieces 对新的读取已不可见，等仍在读取它们的请求结束后删除
+        epochs.retire([this, pieces_old]()
+                      {
+                          for (const auto &p : pieces_old)
+                          {
+                              discard_piece(p);
+                          }
+                      });
+        puts("Repair segment: Commit");
+        return true;
+    }
+    catch (int e)
+    {
+        perror("Failed to repair segment");
+    }
+    durable.release(ticket);
+    return false;
+}
+
+/**
+ * 元数据规模测试用：审计不再访问存储节点，由 audit 判断 piece 是否可用。
+ * 合成的目录中 pieces 没有数据，用它给出丢失模型；传入空函数恢复正常审计。
+ * 只应在没有扫描、修复进行时设置
+ */
+void data_manager::set_synthetic_audit(std::function<bool(const piece &)> audit)
+{
+    synthetic_audit = std::move(audit);
+}
+
+segment_cache::stats data_manager::cache_stats() const
+{
+    return cache.get_stats();
+}
+
+/**
+ * 评分函数：剩余 r 个 piece 的 segment 预计还能承受的轮数，越小越需要优先修复
+ * @param k 解码所需的 piece 数
+ * @param r 剩余可用的 piece 数
+ */
+double data_manager::segment_weight(int k, int r)
+{
+    double churn_per_round = config::failure_rate * config::total_nodes;
+    if (churn_per_round < config::min_churn_per_round)
+    {
+        churn_per_round = config::min_churn_per_round;
+    }
+    double p = double(config::total_nodes - r) / config::total_nodes;
+    double mean = double(r - k + 1) * p / (1 - p);
+    return mean / churn_per_round;
+}
+
+void data_manager::sort_segments(std::vector<std::string> &segment_ids, std::vector<int> &ks, std::vector<int> &rs)
+{
+    if (segment_ids.size() != ks.size() || segment_ids.size() != rs.size())
+    {
+        return;
+    }
+    // 记录 segment id 与 k, r 的对应关系
+    std::unordered_map<std::string, std::pair<int, int>> map;
+    for (int i = 0; i < segment_ids.size(); i++)
+    {
+        map.emplace(segment_ids[i], std::make_pair(ks[i], rs[i]));
+    }
+
+    // 排序规则，按引用捕获：std::sort 会多次复制比较函数
+    const auto &less = [&](const std::string &a, const std::string &b)
+    {
+        const std::pair<int, int> &p1 = map.at(a);
+        const std::pair<int, int> &p2 = map.at(b);
+        return segment_weight(p1.first, p1.second) < segment_weight(p2.first, p2.second);
+    };
+
+    // 排序
+    std::sort(segment_ids.begin(), segment_ids.end(), less);
+
+    // 重新赋值 ks, rs
+    for (int i = 0; i < segment_ids.size(); i++)
+    {
+        const auto &pair = map[segment_ids[i]];
+        ks[i] = pair.first;
+        rs[i] = pair.second;
+    }
+}
@@ -1,73 +1,283 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#ifndef STORJ_EMULATOR_DATA_MANAGER_H
-#define STORJ_EMULATOR_DATA_MANAGER_H
-
-
-#include <set>
-#include <sqlite3.h>
-#include <string>
-
-#include "storage_node.h"
-#include "piece.h"
-#include "segment.h"
-#include "file.h"
-#include "stripe.h"
-#include "erasure_share.h"
-
-namespace storj
-{
-    class data_manager
-    {
-    private:
-        const int storage_node_num = 100;
-        const std::string storage_node_base_path = "./storage_nodes/";
-
-        sqlite3 *sql = nullptr;
-        std::set<storage_node> storage_nodes;
-
-        void init();
-        void init_db();
-        void init_storage_nodes();
-
-        std::string get_storage_node_path(const storage_node &node);
-        std::string get_storage_node_path(const std::string &node_id);
-        std::string get_piece_path(const std::string &node_id, const std::string &piece_id);
-        std::string get_piece_path(const std::string &piece_id);
-
-        void upload_piece(const piece &p, const storage_node &node);
-        piece download_piece(const std::string &piece_id);
-        void remove_piece(const std::string &piece_id);
-        bool audit_piece(const std::string &piece_id);
-
-        void db_insert_file(const file &f);
-        void db_insert_segment(const segment &s);
-        void db_insert_erasure_share(const erasure_share &es);
-        void db_insert_piece(const piece &p);
-
-        void db_stmt_select_file(sqlite3_stmt *stmt, file *file);
-        file db_select_file_by_id(const std::string &id);
-        file db_select_file_by_name(const std::string &filename);
-        segment db_select_segment(const std::string &id);
-        piece db_select_piece(const std::string &id);
-
-        void db_remove_file_by_id(const std::string &id);
-        void db_remove_file_by_name(const std::string &name);
-        void db_remove_segment(const std::string &id);
-        void db_remove_piece(const std::string &id);
-
-    public:
-        data_manager();
-        virtual ~data_manager();
-        void upload_file(const std::string &filename, config &cfg);
-        file download_file(const std::string &filename);
-        std::tuple<std::vector<std::string>, std::vector<int>, std::vector<int>, std::unordered_map<std::string, int>> scan_corrupted_segments();
-        void repair_segment(const std::string &segment_id);
-
-        static void sort_segments(std::vector<std::string> &segment_ids, std::vector<int> &ks, std::vector<int> &rs);
-    };
-}
-
-#endif //STORJ_EMULATOR_DATA_MANAGER_H
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#ifndef STORJ_EMULATOR_DATA_MANAGER_H
+#define STORJ_EMULATOR_DATA_MANAGER_H
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sqlite3.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "storage_node.h"
+#include "piece.h"
+#include "segment.h"
+#include "file.h"
+#include "stripe.h"
+#include "erasure_share.h"
+#include "data_processor.h"
+#include "segment_cache.h"
+#include "log_store.h"
+#include "group_commit.h"
+#include "thread_pool.h"
+#include "sqlite_pool.h"
+#include "epoch_tracker.h"
+#include "repair_queue.h"
+#include "sampling_auditor.h"
+
+namespace storj
+{
+    class data_manager
+    {
+    private:
+        // 打开中的共享 segment，小文件依次追加，满或超时后封装
+        struct open_pack
+        {
+            file container;
+            segment seg;
+            std::vector<std::pair<file, int>> objects;
+            std::chrono::steady_clock::time_point opened;
+            // 有线程正在封装
+            bool sealing = false;
+        };
+
+        // 一个 segment 的并行上传，达到 quorum 后由上传线程确认
+        struct upload_batch
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::string segment_id;
+            // 写入的 pieces 所属的持久化事务
+            group_commit::ticket ticket = 0;
+            std::vector<piece> done;
+            // 该 segment 候选 pieces 与已写完的 pieces 所在的节点，重试时跳过
+            std::set<std::string> nodes;
+            // 已写完的有效 pieces 数，达到 n 后其余 pieces 取消
+            int winners = 0;
+            // 写入失败后换节点重新上传、尚未完成的 pieces 数
+            int redriving = 0;
+            int finished = 0;
+            bool acknowledged = false;
+            // 调用方提交或放弃该 segment 的结果，由 tracker.mutex 保护
+            bool committed = false;
+            bool aborted = false;
+        };
+
+        // 确认之后才完成的 pieces，由持有数据库连接的线程写入目录
+        struct upload_tracker
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            int in_flight = 0;
+            // 所属 batch 尚未有结果的 pieces 留到下一次 drain_uploads()
+            std::vector<std::pair<std::shared_ptr<upload_batch>, piece>> completed;
+            // 按 segment id 索引、尚未提交或放弃的 batches
+            std::unordered_map<std::string, std::shared_ptr<upload_batch>> open_batches;
+            // 重新上传也失败、pieces 不足 n 个的 batches，提交后其 segment 移入 repairs
+            std::vector<std::shared_ptr<upload_batch>> underfilled;
+            // 下一次 scan_and_repair() 优先修复的 segments
+            std::set<std::string> repairs;
+        };
+
+        /**
+         * 写连接的锁，同一线程可重入。持有期间该线程的查询也走写连接，以读到事务中未提交的数据
+         */
+        class db_write_lock
+        {
+        private:
+            data_manager &dm;
+            bool outer;
+
+        public:
+            explicit db_write_lock(data_manager &dm);
+            virtual ~db_write_lock();
+        };
+
+        static const int segment_lock_shards = 64;
+        // file.status：上传会话中的文件对读取与扫描不可见
+        static const int file_uploading = 0;
+        static const int file_complete = 1;
+
+        const int storage_node_num = 100;
+        // 存储节点目录的根目录与数据库文件，互不相同的 data_manager 可以在同一进程中并行运行
+        const std::string storage_node_base_path;
+        const std::string db_path;
+
+        // 唯一的写连接，只在持有 db_write_lock 时使用
+        sqlite3 *sql = nullptr;
+        // 只读连接池，查询与写入互不阻塞 (WAL)
+        sqlite_pool readers;
+        std::recursive_mutex writer_mutex;
+        std::atomic<std::thread::id> writer_thread;
+        // 初始化之后只读，无需加锁
+        std::set<storage_node> storage_nodes;
+        std::map<std::string, open_pack> open_packs;
+        // 已移出 open_packs、正在封装或封装失败等待重试的共享 segment，提交前仍从内存读取
+        std::list<std::shared_ptr<open_pack>> sealing_packs;
+        std::mutex packs_mutex;
+        std::condition_variable packs_cv;
+        // 后台线程按 pack_timeout_ms 封装超时的共享 segment
+        std::thread sealer;
+        std::mutex sealer_mutex;
+        std::condition_variable sealer_cv;
+        bool sealer_stop = false;
+        bool packs_changed = false;
+        // 按 segment id 分片的锁，串行化同一 segment 的修复，读取不加锁
+        std::shared_mutex segment_locks[segment_lock_shards];
+        // 修复替换下来的旧代 pieces 在读取它们的请求结束后回收
+        epoch_tracker epochs;
+        segment_cache cache;
+        // config::log_structured_store 打开时每个节点一个日志存储
+        std::unordered_map<std::string, std::unique_ptr<log_store>> log_stores;
+        std::thread compactor;
+        std::mutex compactor_mutex;
+        std::condition_variable compactor_cv;
+        bool compactor_stop = false;
+        // config::durable_writes 打开时，待落盘的 pieces
+        group_commit durable;
+        upload_tracker tracker;
+        thread_pool uploads;
+        // 节点写入延迟 (ms)
+        std::unordered_map<std::string, int> node_delays;
+        std::mutex node_delays_mutex;
+        // 暂时离线的节点
+        std::unordered_set<std::string> offline_nodes;
+        std::mutex offline_nodes_mutex;
+        sampling_auditor auditor;
+        // 设置后代替 audit_piece 与 deep_audit_piece 的实际检查
+        std::function<bool(const piece &)> synthetic_audit;
+
+        void init();
+        void init_db();
+        void init_storage_nodes();
+
+        std::string get_storage_node_path(const storage_node &node);
+        std::string get_storage_node_path(const std::string &node_id);
+        std::string get_piece_path(const std::string &node_id, const std::string &piece_id);
+        std::string get_piece_path(const std::string &piece_id);
+        std::string get_pending_path(const std::string &node_id, const std::string &piece_id);
+        int open_piece(const piece &p);
+        log_store *get_log_store(const std::string &node_id);
+        sqlite_pool::connection db_read();
+        std::shared_mutex &segment_lock(const std::string &segment_id);
+        void compact_logs();
+        void sync_pieces(group_commit::ticket ticket);
+
+        bool upload_piece(const piece &p, const storage_node &node, group_commit::ticket ticket);
+        bool upload_piece_with_retry(piece &p, group_commit::ticket ticket, const std::set<std::string> &avoid = {});
+        void upload_pieces_parallel(std::vector<piece> &pieces, int quorum, int keep, std::vector<piece> &stored, group_commit::ticket ticket);
+        void redrive_piece(const std::shared_ptr<upload_batch> &batch, const std::shared_ptr<piece> &task, const std::shared_ptr<memory::reservation> &budget);
+        bool wait_node_delay(const storage_node &node, upload_batch *batch, int keep);
+        bool node_online(const std::string &node_id);
+        void discard_piece(const piece &p);
+        void publish_pieces(const std::vector<piece> &pieces);
+        void drain_uploads();
+        void settle_batch(const std::string &segment_id, bool committed);
+        piece download_piece(const std::string &piece_id);
+        bool read_piece(piece &piece);
+        void remove_piece(const std::string &piece_id);
+        bool audit_piece(const piece &piece);
+        bool deep_audit_piece(const piece &piece);
+        int count_available_pieces(const std::string &segment_id);
+        void queue_repair(repair_queue &queue, const std::string &segment_id);
+        std::set<std::string> queue_underfilled(repair_queue &queue);
+        int run_repairs(repair_queue &queue, const std::function<void()> &fill, const std::function<void(const std::string &)> &on_repaired);
+        int read_piece_range(const piece &p, long offset, int length, char *buf);
+
+        void db_insert_file(const file &f, int status = file_complete);
+        void db_insert_segment(const segment &s);
+        void db_insert_erasure_share(const erasure_share &es);
+        void db_insert_piece(const piece &p);
+        void db_insert_packed_object(const std::string &file_id, const std::string &segment_id, int offset, int length);
+        void db_insert_upload_session(const std::string &session_id, const file &f);
+        bool db_insert_staged_object(const file &object, const std::vector<char> &data);
+
+        void db_stmt_select_file(sqlite3_stmt *stmt, file *file);
+        file db_select_file_by_id(const std::string &id);
+        file db_select_file_by_name(const std::string &filename);
+        segment db_select_segment(const std::string &id);
+        std::vector<segment> db_select_segments_by_file(const std::string &file_id);
+        piece db_select_piece(const std::string &id);
+        std::vector<piece> db_select_pieces_by_segment(const std::string &segment_id);
+        std::vector<piece> db_select_pieces_by_node(const std::string &node_id, int sample_size);
+        bool db_select_packed_object(const std::string &file_id, std::string *segment_id, int *offset, int *length);
+        bool db_select_upload_session(const std::string &session_id, std::string *file_id, int *upload_quorum, int *long_tail_extra);
+        std::vector<std::pair<file, std::vector<char>>> db_select_staged_objects();
+
+        void db_remove_file_by_id(const std::string &id);
+        void db_remove_file_by_name(const std::string &name);
+        void db_remove_segment(const std::string &id);
+        void db_remove_piece(const std::string &id);
+        void db_remove_pieces_by_generation(const std::string &segment_id, int generation);
+        void db_update_segment_generation(const std::string &segment_id, int generation);
+        void db_update_piece_generation(const std::string &piece_id, int generation);
+        void db_commit();
+        void db_update_file_status(const std::string &file_id, int status);
+        void db_remove_upload_session(const std::string &session_id);
+        void db_remove_staged_object(const std::string &file_id);
+
+        void store_segment(data_processor &dp, segment &segment, std::vector<piece> &stored, group_commit::ticket ticket);
+        segment fetch_segment(data_processor &dp, const std::string &segment_id, std::vector<piece> &pieces);
+        void repair_on_read(data_processor &dp, const segment &segment, const std::vector<piece> &pieces,
+                            const std::vector<piece> &lost);
+        bool read_segment_range(data_processor &dp, const segment &segment, long offset, long length, std::vector<char> &out);
+
+        static std::string pack_key(const config &cfg);
+        void pack_file(const std::string &filename, config &cfg);
+        void pack_object(const file &object, const std::vector<char> &data);
+        void restage_objects();
+        std::shared_ptr<open_pack> take_pack(std::map<std::string, open_pack>::iterator it);
+        void seal_pack(const std::shared_ptr<open_pack> &pack);
+        void seal_expired_packs();
+        void seal_packs_on_timer();
+        void wake_sealer();
+        bool find_unsealed(const std::string &filename, file *object, segment_buffer *data);
+
+    public:
+        data_manager();
+        data_manager(const std::string &db_path, const std::string &storage_node_base_path);
+        virtual ~data_manager();
+        void upload_file(const std::string &filename, config &cfg);
+        std::string begin_upload(const std::string &filename, config &cfg);
+        std::vector<int> uploaded_segments(const std::string &session_id);
+        bool resume_upload(const std::string &session_id);
+        void abort_upload(const std::string &session_id);
+        file download_file(const std::string &filename);
+        std::vector<std::pair<std::string, std::vector<piece>>> locate_segments(const std::string &filename);
+        std::vector<char> read_range(const std::string &filename, long offset, long length);
+        std::tuple<std::vector<std::string>, std::vector<int>, std::vector<int>, std::unordered_map<std::string, int>> scan_corrupted_segments();
+        int scan_segments(const std::function<void(const std::string &, int, int)> &on_damaged);
+        int scan_and_repair(int queue_capacity, const std::function<void(const std::string &)> &on_repaired = nullptr);
+        bool repair_segment(const std::string &segment_id);
+        std::vector<std::string> sample_audit();
+        int sample_and_repair(int queue_capacity, const std::function<void(const std::string &)> &on_repaired = nullptr);
+        sampling_auditor::estimate node_audit_estimate(const std::string &node_id) const;
+        void flush_packs();
+        void wait_pending_uploads();
+        int sweep_pending(int timeout_ms);
+        void set_node_delay(const std::string &node_id, int ms);
+        void set_node_online(const std::string &node_id, bool online);
+        void set_synthetic_audit(std::function<bool(const piece &)> audit);
+        segment_cache::stats cache_stats() const;
+
+        static double segment_weight(int k, int r);
+        static void sort_segments(std::vector<std::string> &segment_ids, std::vector<int> &ks, std::vector<int> &rs);
+    };
+}
+
+#endif //STORJ_EMULATOR_DATA_MANAGER_H
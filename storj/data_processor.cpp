@@ -1,544 +1,633 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#include <fcntl.h>
-#include <unistd.h>
-#include <iostream>
-#include <time.h>
-#include <ctime>
-#include "jerasure.h"
-#include "cauchy.h"
-#include "config.h"
-#include "file.h"
-#include "data_processor.h"
-#include <fstream>
-using namespace storj;
-
-data_processor::data_processor(const config &cfg) : cfg(cfg)
-{
-}
-
-std::vector<segment> data_processor::split_file(file &f)
-{
-    // clock_t start,stop;
-    // double duration;
-    // start=clock();
-    //  TODO: 改写成流式处理
-    //  打开文件
-    int fd = open(f.name.c_str(), O_RDONLY);
-    if (fd == -1)
-    {
-        throw "File not exists";
-    }
-
-    // 以 size 为单位读取文件
-    char *segment_data = new char[cfg.segment_size];
-    int n;
-    while ((n = read(fd, segment_data, cfg.segment_size)) > 0)
-    {
-        f.segments.emplace_back(std::vector<char>(segment_data, segment_data + n));
-    }
-    delete[] segment_data;
-
-    // 最后一个 segment 补 0
-    if (!f.segments.empty())
-    {
-        segment &s = f.segments.back();
-        while (s.data.size() < cfg.segment_size)
-        {
-            s.data.emplace_back(0);
-        }
-    }
-    // stop=clock();
-    // duration=((double)(stop-start))/CLOCK_TAI;
-    // std::cout<<"split_file_time:"<<duration<<std::endl;
-    return f.segments;
-}
-
-std::vector<stripe> data_processor::split_segment(segment &s) const
-{
-    // clock_t start,stop;
-
-    // double duration;
-
-    // start=clock();
-    // 创建变量，预留空间
-    std::vector<stripe> stripes;
-    stripes.reserve(s.data.size() / cfg.stripe_size);
-    // 以 size 为单位遍历
-    for (auto it = s.data.begin(); it < s.data.end(); it += cfg.stripe_size)
-    {
-        std::vector<char> stripe_data;
-        auto right = it + cfg.stripe_size;
-        stripe_data.reserve(right - it);
-        stripe_data.insert(stripe_data.end(), std::make_move_iterator(it), std::make_move_iterator(right));
-        stripes.emplace_back(stripe_data);
-    }
-    s.data.clear();
-    // stop=clock();
-
-    // duration=((double)(stop-start))/CLOCK_TAI;
-
-    // std::cout<<"split_segment"<<duration<<std::endl;
-    return stripes;
-}
-
-// std::vector<erasure_share> data_processor::erasure_encode(stripe &s)
-// {
-//     // TODO: erasure encode
-//     // 创建变量，预留空间
-//     std::vector<erasure_share> shares;
-//     shares.reserve(cfg.n);
-//     // 以 size 为单位遍历
-//     for (auto it = s.data.begin(); it < s.data.end(); it += cfg.erasure_share_size) {
-//         std::vector<char> erasure_share_data;
-//         auto right = it + cfg.erasure_share_size;
-//         erasure_share_data.reserve(right - it);
-//         erasure_share_data.insert(erasure_share_data.end(), std::make_move_iterator(it), std::make_move_iterator(right));
-//         shares.emplace_back(erasure_share_data);
-//     }
-//     // 未实现 erasure encode，临时填充
-//     while (shares.size() < cfg.n) {
-//         shares.emplace_back(std::vector<char>(cfg.erasure_share_size, '\0'));
-//     }
-//     s.data.clear();
-//     return shares;
-// }
-
-std::vector<erasure_share> data_processor::erasure_encode(stripe &s)
-{
-    clock_t start, stop;
-    clock_t starte, stope;
-    double duration;
-
-    start = clock();
-    // TODO: erasure encode
-    // 创建变量，预留空间
-    // 101 char / 10 =
-    // packsize !
-    int w = 8;
-    int packsize = 8;
-    int newsize = 0;
-    int k = cfg.k;
-    int *matrix;
-    int *bitmatrix;
-    int size = s.data.size();
-    std::vector<erasure_share> shares;
-    shares.reserve(cfg.n);
-
-    // 计算erasure_share_size的大小并且赋值过去
-    /* Find new size by determining next closest multiple */
-    newsize = size;
-    if (packsize != 0)
-    {
-        if (size % (cfg.k * w * packsize * sizeof(long)) != 0)
-        {
-            while (newsize % (cfg.k * w * packsize * sizeof(long)) != 0)
-                newsize++;
-        }
-    }
-    else
-    {
-        if (size % (cfg.k * w * sizeof(long)) != 0)
-        {
-            while (newsize % (cfg.k * w * sizeof(long)) != 0)
-                newsize++;
-        }
-    }
-    int erasure_share_size = newsize / k;
-    // std::cout << newsize << " " << s.data.size() << std::endl;
-    char *block = new char[newsize];
-    std::copy(s.data.begin(), s.data.end(), block);
-
-    //
-    for (int i = size; i < newsize; i++)
-    {
-        block[i] = '\0';
-    }
-
-    // std::cout << block << std::endl;
-    // 获取生成矩阵大小 w = 8
-    matrix = cauchy_original_coding_matrix(cfg.k, cfg.m, w);
-    // matrix = cauchy_good_general_coding_matrix(cfg.k, cfg.m, w);
-    bitmatrix = jerasure_matrix_to_bitmatrix(cfg.k, cfg.m, w, matrix);
-
-    // ! bitmatrix要写入到reram中间,所以计时方式为
-    // 512 bit -> 写入
-    // m * w * const  const -> 1 ms
-    // cfg.m * cfg.w * 1ms
-
-    // 开始进行encode获取data和coding的数组
-    /* Allocate data and coding */
-    char **data = new char *[k];
-    char **coding = new char *[cfg.m];
-    for (int i = 0; i < cfg.m; i++)
-    {
-        coding[i] = new char[erasure_share_size];
-        if (coding[i] == NULL)
-        {
-            perror("malloc");
-            exit(1);
-        }
-    }
-
-    int n = 1;
-    int total = 0;
-    int extra;
-    int readins = 1; // 暂定写死
-
-    while (n <= readins)
-    {
-        /* Set pointers to point to file data */
-        for (int i = 0; i < k; i++)
-        {
-            data[i] = block + (i * erasure_share_size);
-        }
-
-        // timing_set(&t3);
-        /* Encode according to coding method */
-        // std::cout << erasure_share_size << std::endl;
-        // clock_t starte,stope;
-        // double t1,t2;
-        //  double duratione;
-        // t1 = getTimeNs();
-        //  starte=clock();
-
-        // std:cout<<"share size:"<<erasure_share_size<<std::endl;
-        // 这里计算encode的时间
-        jerasure_bitmatrix_encode(cfg.k, cfg.m, w, bitmatrix, data, coding, erasure_share_size, packsize);
-        // ！这里计算encode的时间
-
-        // reram -> encode (x) ｜ (erasure_share_size * 8 / 512) 最小等于1 * const 1ms
-
-        // !每次需要读的数据为
-        // (erasure_share_size * 8 / 512) 最小等于1 * const 1ms * cfg.k
-        // i
-
-        // t2 = getTimeNs();
-        // stope=clock();
-        //	std::cout << t2 - t1 << std::endl;
-        //  duratione=((double)(stope-starte))/CLOCK_TAI;
-
-        // std::ofstream mycout("test_data.txt",std::ios::app);
-        // mycout<<"Jerasure Encode time:"<<duratione<<std::endl;
-        // mycout<<"erasure_share_size:"<<erasure_share_size<<std::endl;
-        // mycout.close();
-        for (int i = 1; i <= k; i++)
-        {
-            if (i == k)
-            {
-                // std::cout << data[i-1] << std::endl;
-            }
-            std::vector<char> stripe_data(data[i - 1], data[i - 1] + erasure_share_size);
-            shares.emplace_back(stripe_data);
-            // bzero(data[i-1], cfg.erasure_share_size));
-        }
-        for (int i = 1; i <= cfg.m; i++)
-        {
-            std::vector<char> stripe_data(coding[i - 1], coding[i - 1] + erasure_share_size);
-            shares.emplace_back(stripe_data);
-            // bzero(data[i-1], cfg.erasure_share_size));
-        }
-        n++;
-    }
-    free(block);
-    free(matrix);
-    free(bitmatrix);
-    free(coding);
-    s.data.clear();
-    stop = clock();
-
-    duration = ((double)(stop - start)) / CLOCK_TAI;
-
-    std::cout << "erasure_encode:" << duration << std::endl;
-    return shares;
-}
-
-std::vector<piece> data_processor::merge_to_pieces(std::vector<std::vector<erasure_share>> &s) const
-{
-    // 粒度为 stripe -> erasure share
-    // s[i][j] 是单个 stripe 切分出来的单个 erasure share
-    // s[i]    是单个 stripe 切分出来的所有 erasure shares
-    // 即，需要交换遍历维度以转换成 piece
-    clock_t start, stop;
-
-    double duration;
-
-    start = clock();
-    std::vector<piece> pieces;
-    pieces.reserve(cfg.n);
-    for (int y = 0; y < cfg.n; y++)
-    {
-        piece p;
-        // p.erasure_shares.reserve(s.size());
-        // p.data.reserve(s.size() * cfg.erasure_share_size);
-        for (auto &shares : s)
-        {
-            erasure_share &share = shares[y];
-            p.data.insert(p.data.end(), share.data.begin(), share.data.end());
-            p.erasure_shares.emplace_back(share);
-        }
-        pieces.emplace_back(p);
-    }
-    stop = clock();
-
-    duration = ((double)(stop - start)) / CLOCK_TAI;
-    std::cout << "merge_to_pieces" << duration << std::endl;
-    return pieces;
-}
-
-std::vector<erasure_share> data_processor::split_piece(piece &p) const
-{
-    // clock_t start,stop;
-
-    // double duration;
-
-    // start=clock();
-    // 创建变量，预留空间
-    std::vector<erasure_share> shares;
-    // 以 size 为单位遍历
-    for (auto it = p.data.begin(); it < p.data.end(); it += (p.data.size() / (cfg.segment_size / cfg.stripe_size)))
-    {
-        std::vector<char> erasure_share_data;
-        auto right = it + (p.data.size() / (cfg.segment_size / cfg.stripe_size));
-        erasure_share_data.reserve(right - it);
-        erasure_share_data.insert(erasure_share_data.end(), std::make_move_iterator(it), std::make_move_iterator(right));
-        shares.emplace_back(erasure_share_data);
-    }
-
-    int share_size = shares.size();
-    for (int i = 0; i < ((cfg.segment_size / cfg.stripe_size) - share_size); i++)
-    {
-        erasure_share temp;
-        shares.push_back(temp);
-    }
-    p.data.clear();
-    // stop=clock();
-
-    // duration=((double)(stop-start))/CLOCK_TAI;
-
-    // std::cout<<"split_piece"<<duration<<std::endl;
-    return shares;
-}
-
-// std::vector<stripe> data_processor::merge_to_stripes(std::vector<std::vector<erasure_share>> &s) const
-// {
-//     // 粒度为 piece -> erasure share
-//     // s[i][j] 是单个 piece 切分出来的单个 erasure share
-//     // s[i]    是单个 piece 切分出来的所有 erasure shares
-//     // 即，需要交换遍历维度以转换成 stripe
-//     std::cout << "test !!!!" << std::endl;
-//     std::vector<stripe> stripes;
-//     // 未实现 erasure decode，临时处理数据，只需前 k 个 piece
-//     for (int x = 0; x < cfg.segment_size / cfg.stripe_size; x++) {
-//         stripe stripe;
-//         stripe.data.reserve(cfg.stripe_size);
-//         for (int y = 0; y < cfg.k; y++) {
-//             erasure_share &share = s[y][x];
-//             for(int i = 0; i < share.data.size() ;i ++) {
-//                 if(share.data[i] != '\0') {
-//                     stripe.data.push_back(share.data[i]);
-//                 }
-//             }
-//             // stripe.data.insert(stripe.data.end(), std::make_move_iterator(share.data.begin()), std::make_move_iterator(share.data.end()));
-//         }
-//         stripes.emplace_back(stripe);
-//     }
-//     // TODO: erasure decode
-//     return stripes;
-// }
-long gettimens2()
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    return ts.tv_sec * 1000000000 + ts.tv_nsec;
-}
-
-std::vector<stripe> data_processor::merge_to_stripes(std::vector<std::vector<erasure_share>> &s) const
-{
-    // s[n]的某一个元素的size为0,则说明了丢失了
-
-    long start, stop;
-    // clock_t startd,stopd;
-    long duration;
-
-    // start=clock();
-    std::vector<stripe> stripes;
-    int numerased = 0;
-    char **data;
-    char **coding;
-    int *erasures;
-    int *erased;
-    int *matrix;
-    int *bitmatrix;
-    int w = 8;
-    int packetsize = 8;
-    int k = cfg.k;
-    int m = cfg.m;
-
-    matrix = cauchy_original_coding_matrix(k, m, w);
-    // matrix = cauchy_good_general_coding_matrix(k, m, w);
-    bitmatrix = jerasure_matrix_to_bitmatrix(k, m, w, matrix);
-
-    // !
-
-    erased = (int *)malloc(sizeof(int) * (cfg.k + cfg.m));
-    for (int i = 0; i < k + m; i++)
-        erased[i] = 0;
-    erasures = (int *)malloc(sizeof(int) * (cfg.k + cfg.m));
-    for (int i = 0; i < k + m; i++)
-        erasures[i] = -2;
-
-    data = (char **)malloc(sizeof(char *) * k);
-    coding = (char **)malloc(sizeof(char *) * m);
-
-    int blocksize = 0;
-    long total_decode_time = 0;
-    for (int x = 0; x < cfg.segment_size / cfg.stripe_size; x++)
-    {
-        // total
-        // t1
-        start = gettimens2();
-        // 说明了有cfg.segment_size / cfg.stripe_size 个stripe
-        for (int y = 0; y < cfg.k + cfg.m; y++)
-        {
-
-            // 读所有的切分的内容啊
-            erasure_share &share = s[y][x];
-
-            // 当前的erasure_share
-            // if (share.data.size() != 512) {
-            //     std::cout << share.data.size()<<std::endl;
-            // }
-
-            if (share.data.size() == 0)
-            {
-                // std::cout << "!!!! win !!!!" << std::endl;
-                erased[y] = 1;
-                erasures[numerased] = y;
-                numerased++;
-                // printf("%s failed\n", fname);
-            }
-            else
-            {
-                // std::cout << share.data.size() << std::endl;
-                // data[y] = (char *)malloc(sizeof(char)*share.data.size());
-                blocksize = share.data.size();
-
-                if (y < cfg.k)
-                {
-                    data[y] = (char *)malloc(sizeof(char) * share.data.size());
-                    std::copy(share.data.begin(), share.data.end(), data[y]);
-                }
-                else
-                {
-                    coding[y - k] = (char *)malloc(sizeof(char) * share.data.size());
-                    std::copy(share.data.begin(), share.data.end(), coding[y - k]);
-                }
-            }
-        }
-        /* Finish allocating data/coding if needed */
-        for (int i = 0; i < numerased; i++)
-        {
-            if (erasures[i] < k)
-            {
-                data[erasures[i]] = (char *)malloc(sizeof(char) * blocksize);
-            }
-            else
-            {
-                coding[erasures[i] - k] = (char *)malloc(sizeof(char) * blocksize);
-            }
-        }
-        erasures[numerased] = -1;
-
-        // clock_t startd,stopd;
-        //	double t1, t2;
-        //      double durationd;
-
-        //    startd=clock();
-        //	t1 = getTimeNs();
-        // ! decode
-        jerasure_bitmatrix_decode(k, m, w, bitmatrix, 0, erasures, data, coding, blocksize, packetsize);
-        stripe stripe_inner;
-        //      stopd=clock();
-        // t2
-        //
-        //	stop = clock();
-        ///
-
-        // total += t2 - t1
-        // t2 = getTimeNs();
-        //      durationd=((double)(stop-start))/CLOCK_TAI;
-        // std::cout << t2- t1 << std::endl;
-        //    std::ofstream mycout("test_data.txt",std::ios::app);
-        //  mycout<<"one Jerasure Decode time:"<<durationd<<std::endl;
-
-        // std::cout << data[0] << std::endl;
-        // std::cout << s[0][x].data[0] << s[0][x].data[1];
-        for (int i = 0; i < cfg.k; i++)
-        {
-            if (i == (cfg.k - 1))
-            {
-                // std::cout << data[i] << std::endl;
-            }
-            for (int j = 0; j < blocksize; j++)
-            {
-                if (data[i][j] != '\0')
-                    stripe_inner.data.push_back(data[i][j]);
-            }
-        }
-        numerased = 0;
-        stripes.emplace_back(stripe_inner);
-        // data.insert(stripe.data.end(), std::make_move_iterator(share.data.begin()), std::make_move_iterator(share.data.end()));
-        stop = gettimens2();
-        total_decode_time += stop - start;
-        std::ofstream mycout("test_data.txt", std::ios::app);
-        // mycout<<"Stripe decode: "<<stop-start<<std::endl;
-    }
-    std::ofstream mycout("test_data.txt", std::ios::app);
-    mycout << "Stripe decode for one segment avg thoughput : " << (double)(cfg.segment_size / 1024.0 / 1024.0 * 1000000000.0) / total_decode_time << " MB /s " << std::endl;
-
-    free(data);
-    free(coding);
-    free(erasures);
-    free(erased);
-    // stop=clock();
-
-    // duration=((double)(stop-start))/CLOCK_TAI;
-
-    // std::cout<<"merge_to_stripes"<<duration<<std::endl;
-    return stripes;
-}
-
-segment data_processor::merge_to_segment(std::vector<stripe> &stripes) const
-{
-    segment res;
-    for (auto &stripe : stripes)
-    {
-        res.data.insert(res.data.end(), std::make_move_iterator(stripe.data.begin()), std::make_move_iterator(stripe.data.end()));
-    }
-    return res;
-}
-
-file data_processor::merge_to_file(std::vector<segment> &segments) const
-{
-    // clock_t start,stop;
-
-    // double duration;
-
-    // start=clock();
-    file res;
-    res.segments = segments;
-    // stop=clock();
-
-    // duration=((double)(stop-start))/CLOCK_TAI;
-
-    // std::cout<<"merge_to_file:"<<duration<<std::endl;
-    return res;
-}
-
-std::vector<stripe> data_processor::repair_stripes_from_erasure_shares(const std::vector<std::vector<erasure_share>> &s) const
-{
-    // TODO: implementation
-}
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <time.h>
+#include <ctime>
+#include <mutex>
+#include "jerasure.h"
+#include "cauchy.h"
+#include "galois.h"
+#include "config.h"
+#include "file.h"
+#include "data_processor.h"
+#include "metrics.h"
+#include "reram_model.h"
+#include <fstream>
+using namespace storj;
+
+long gettimens2();
+
+data_processor::data_processor(const config &cfg) : cfg(cfg)
+{
+    // galois 乘法表惰性初始化且不是线程安全的，多线程编解码前先初始化一次
+    static std::once_flag galois_once;
+    std::call_once(galois_once, [] { galois_init_default_field(8); });
+}
+
+/**
+ * segment 按 stripe_size 切分后各个 stripe 的实际长度，最后一个 stripe 可能较短
+ * @param segment_length segment 实际数据长度
+ * @return 各个 stripe 的长度
+ */
+std::vector<int> data_processor::stripe_lengths(int segment_length) const
+{
+    std::vector<int> lengths;
+    for (int offset = 0; offset < segment_length; offset += cfg.stripe_size)
+    {
+        lengths.push_back(std::min(cfg.stripe_size, segment_length - offset));
+    }
+    return lengths;
+}
+
+/**
+ * 计算 stripe 的编码布局
+ * jerasure 要求每个 erasure share 的大小为 w * packetsize 的整数倍，且 packetsize 为 sizeof(long) 的整数倍，
+ * 因此 stripe 需补 0 到 k * w * packetsize 的整数倍。
+ * 在补 0 比例不超过 max_padding_ratio 的前提下选择尽量大的 packetsize，否则退化为 sizeof(long)。
+ * max_padding_ratio 小于 0 时沿用基线版本的布局：每个 stripe 都按 stripe_size 补齐，与实际长度无关
+ * @param stripe_length stripe 实际数据长度
+ * @param packetsize 输出 packetsize
+ * @param share_size 输出 erasure share 大小
+ */
+void data_processor::stripe_layout(int stripe_length, int *packetsize, int *share_size) const
+{
+    const int w = 8;
+    if (cfg.max_padding_ratio < 0)
+    {
+        const int unit = cfg.k * w * 8 * sizeof(long);
+        *packetsize = 8;
+        *share_size = (cfg.stripe_size + unit - 1) / unit * unit / cfg.k;
+        return;
+    }
+    for (int p = 2048; p >= (int)sizeof(long); p /= 2)
+    {
+        const int unit = cfg.k * w * p;
+        const int padded = (stripe_length + unit - 1) / unit * unit;
+        if (p == (int)sizeof(long) || padded - stripe_length <= stripe_length * cfg.max_padding_ratio)
+        {
+            *packetsize = p;
+            *share_size = padded / cfg.k;
+            return;
+        }
+    }
+}
+
+/**
+ * 处理一个 segment 时同时存在的缓冲区的预估大小，用于申请内存预算。
+ * 上传时 segment、stripes 各一份，编码后的 erasure shares、pieces 中的 shares 与 pieces 数据各一份；
+ * 下载时反过来，另有一份 segment 放入缓存。再加一份编码后的大小作为补 0 与编解码临时数据的余量
+ * @param segment_length segment 实际数据长度
+ * @return 字节数
+ */
+long long data_processor::segment_footprint(int segment_length) const
+{
+    long long encoded = 0;
+    for (int length : stripe_lengths(segment_length))
+    {
+        int packetsize;
+        int share_size;
+        stripe_layout(length, &packetsize, &share_size);
+        encoded += (long long)share_size * (cfg.k + cfg.m);
+    }
+    return 2LL * segment_length + 4 * encoded;
+}
+
+std::vector<segment> data_processor::split_file(file &f)
+{
+    // clock_t start,stop;
+    // double duration;
+    // start=clock();
+    //  TODO: 改写成流式处理
+    //  打开文件
+    int fd = open(f.name.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw "File not exists";
+    }
+
+    // 以 size 为单位读取文件
+    char *segment_data = new char[cfg.segment_size];
+    int n;
+    while ((n = read(fd, segment_data, cfg.segment_size)) > 0)
+    {
+        f.segments.emplace_back(segment_buffer(segment_data, segment_data + n));
+    }
+    delete[] segment_data;
+    close(fd);
+
+    // 最后一个 segment 不再补 0，实际长度记录在 segment.length 中
+    for (auto &s : f.segments)
+    {
+        s.length = s.data.size();
+    }
+    // stop=clock();
+    // duration=((double)(stop-start))/CLOCK_TAI;
+    // std::cout<<"split_file_time:"<<duration<<std::endl;
+    return f.segments;
+}
+
+std::vector<stripe> data_processor::split_segment(segment &s) const
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("split_segment");
+    metrics::scoped_timer timer(latency);
+    // clock_t start,stop;
+
+    // double duration;
+
+    // start=clock();
+    // 创建变量，预留空间
+    std::vector<stripe> stripes;
+    stripes.reserve((s.data.size() + cfg.stripe_size - 1) / cfg.stripe_size);
+    // 以 size 为单位遍历，最后一个 stripe 可能较短
+    for (auto it = s.data.begin(); it < s.data.end(); it += cfg.stripe_size)
+    {
+        stripe_buffer stripe_data;
+        auto right = it + std::min((long)cfg.stripe_size, (long)(s.data.end() - it));
+        stripe_data.reserve(right - it);
+        stripe_data.insert(stripe_data.end(), std::make_move_iterator(it), std::make_move_iterator(right));
+        stripes.emplace_back(stripe_data);
+    }
+    s.data.clear();
+    // stop=clock();
+
+    // duration=((double)(stop-start))/CLOCK_TAI;
+
+    // std::cout<<"split_segment"<<duration<<std::endl;
+    return stripes;
+}
+
+// std::vector<erasure_share> data_processor::erasure_encode(stripe &s)
+// {
+//     // TODO: erasure encode
+//     // 创建变量，预留空间
+//     std::vector<erasure_share> shares;
+//     shares.reserve(cfg.n);
+//     // 以 size 为单位遍历
+//     for (auto it = s.data.begin(); it < s.data.end(); it += cfg.erasure_share_size) {
+//         std::vector<char> erasure_share_data;
+//         auto right = it + cfg.erasure_share_size;
+//         erasure_share_data.reserve(right - it);
+//         erasure_share_data.insert(erasure_share_data.end(), std::make_move_iterator(it), std::make_move_iterator(right));
+//         shares.emplace_back(erasure_share_data);
+//     }
+//     // 未实现 erasure encode，临时填充
+//     while (shares.size() < cfg.n) {
+//         shares.emplace_back(std::vector<char>(cfg.erasure_share_size, '\0'));
+//     }
+//     s.data.clear();
+//     return shares;
+// }
+
+std::vector<erasure_share> data_processor::erasure_encode(stripe &s)
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("encode");
+    static metrics::counter &bytes = metrics::instance().get_counter("encode.bytes");
+    metrics::scoped_timer timer(latency);
+    bytes.add(s.data.size());
+    // TODO: erasure encode
+    // 创建变量，预留空间
+    // 101 char / 10 =
+    // packsize !
+    int w = 8;
+    int packsize = 8;
+    int newsize = 0;
+    int k = cfg.k;
+    int *matrix;
+    int *bitmatrix;
+    int size = s.data.size();
+    std::vector<erasure_share> shares;
+    shares.reserve(cfg.n);
+
+    // 计算erasure_share_size的大小并且赋值过去
+    // 按补 0 比例选择 packetsize，stripe 只补齐到 k * w * packetsize 的整数倍
+    int erasure_share_size = 0;
+    stripe_layout(size, &packsize, &erasure_share_size);
+    newsize = erasure_share_size * k;
+    // std::cout << newsize << " " << s.data.size() << std::endl;
+    stripe_buffer block(newsize, '\0');
+    std::copy(s.data.begin(), s.data.end(), block.begin());
+
+    // std::cout << block << std::endl;
+    // 获取生成矩阵大小 w = 8
+    matrix = cauchy_original_coding_matrix(cfg.k, cfg.m, w);
+    // matrix = cauchy_good_general_coding_matrix(cfg.k, cfg.m, w);
+    bitmatrix = jerasure_matrix_to_bitmatrix(cfg.k, cfg.m, w, matrix);
+
+    // ! bitmatrix要写入到reram中间,所以计时方式为
+    // 512 bit -> 写入
+    // m * w * const  const -> 1 ms
+    // cfg.m * cfg.w * 1ms
+
+    // 开始进行encode获取data和coding的数组
+    /* Allocate data and coding */
+    // 校验数据直接写入 erasure share 的缓冲区，编码后移入 share，不再复制
+    char **data = new char *[k];
+    char **coding = new char *[cfg.m];
+    std::vector<share_buffer> coding_blocks(cfg.m, share_buffer(erasure_share_size));
+    for (int i = 0; i < cfg.m; i++)
+    {
+        coding[i] = coding_blocks[i].data();
+    }
+
+    int n = 1;
+    int total = 0;
+    int extra;
+    int readins = 1; // 暂定写死
+
+    while (n <= readins)
+    {
+        /* Set pointers to point to file data */
+        for (int i = 0; i < k; i++)
+        {
+            data[i] = block.data() + (i * erasure_share_size);
+        }
+
+        // timing_set(&t3);
+        /* Encode according to coding method */
+        // std::cout << erasure_share_size << std::endl;
+        // clock_t starte,stope;
+        // double t1,t2;
+        //  double duratione;
+        // t1 = getTimeNs();
+        //  starte=clock();
+
+        // std:cout<<"share size:"<<erasure_share_size<<std::endl;
+        // 这里计算encode的时间
+        if (config::reram_backend)
+        {
+            // ReRAM 模型完成编码，同一 stripe 上实测 Jerasure 的 CPU 时间作对照
+            std::vector<scratch_buffer> expected(cfg.m, scratch_buffer(erasure_share_size));
+            std::vector<char *> expected_ptrs;
+            for (auto &e : expected)
+            {
+                expected_ptrs.push_back(e.data());
+            }
+            long t1 = gettimens2();
+            jerasure_bitmatrix_encode(cfg.k, cfg.m, w, bitmatrix, data, expected_ptrs.data(), erasure_share_size, packsize);
+            long t2 = gettimens2();
+            reram_model &model = reram_model::instance();
+            const reram_model::cost &c = model.encode(cfg.k, cfg.m, w, bitmatrix, data, coding, erasure_share_size, packsize);
+            model.record_encode(c, t2 - t1);
+            for (int i = 0; i < cfg.m; i++)
+            {
+                if (!std::equal(expected[i].begin(), expected[i].end(), coding[i]))
+                {
+                    printf("reram encode differs from jerasure at coding %d\n", i);
+                }
+            }
+            static metrics::histogram &cpu = metrics::instance().get_histogram("reram.encode.jerasure_ns");
+            static metrics::histogram &modeled = metrics::instance().get_histogram("reram.encode.model_ns");
+            static metrics::histogram &energy = metrics::instance().get_histogram("reram.encode.energy_pj");
+            cpu.record(t2 - t1);
+            modeled.record(c.latency_ns);
+            energy.record(c.energy_pj);
+        }
+        else
+        {
+            jerasure_bitmatrix_encode(cfg.k, cfg.m, w, bitmatrix, data, coding, erasure_share_size, packsize);
+        }
+        // ！这里计算encode的时间
+
+        // reram -> encode (x) ｜ (erasure_share_size * 8 / 512) 最小等于1 * const 1ms
+
+        // !每次需要读的数据为
+        // (erasure_share_size * 8 / 512) 最小等于1 * const 1ms * cfg.k
+        // i
+
+        // t2 = getTimeNs();
+        // stope=clock();
+        //	std::cout << t2 - t1 << std::endl;
+        //  duratione=((double)(stope-starte))/CLOCK_TAI;
+
+        // std::ofstream mycout("test_data.txt",std::ios::app);
+        // mycout<<"Jerasure Encode time:"<<duratione<<std::endl;
+        // mycout<<"erasure_share_size:"<<erasure_share_size<<std::endl;
+        // mycout.close();
+        for (int i = 1; i <= k; i++)
+        {
+            if (i == k)
+            {
+                // std::cout << data[i-1] << std::endl;
+            }
+            share_buffer stripe_data(data[i - 1], data[i - 1] + erasure_share_size);
+            shares.emplace_back(stripe_data);
+            // bzero(data[i-1], cfg.erasure_share_size));
+        }
+        for (int i = 1; i <= cfg.m; i++)
+        {
+            shares.emplace_back(std::move(coding_blocks[i - 1]));
+        }
+        n++;
+    }
+    free(matrix);
+    free(bitmatrix);
+    delete[] data;
+    delete[] coding;
+    s.data.clear();
+    return shares;
+}
+
+std::vector<piece> data_processor::merge_to_pieces(std::vector<std::vector<erasure_share>> &s) const
+{
+    // 粒度为 stripe -> erasure share
+    // s[i][j] 是单个 stripe 切分出来的单个 erasure share
+    // s[i]    是单个 stripe 切分出来的所有 erasure shares
+    // 即，需要交换遍历维度以转换成 piece
+    static metrics::histogram &latency = metrics::instance().get_histogram("merge_to_pieces");
+    metrics::scoped_timer timer(latency);
+    std::vector<piece> pieces;
+    pieces.reserve(cfg.n);
+    for (int y = 0; y < cfg.n; y++)
+    {
+        piece p;
+        // 预留空间，避免扩容时新旧两份数据同时存在
+        long size = 0;
+        for (auto &shares : s)
+        {
+            size += shares[y].data.size();
+        }
+        p.erasure_shares.reserve(s.size());
+        p.data.reserve(size);
+        for (auto &shares : s)
+        {
+            erasure_share &share = shares[y];
+            p.data.insert(p.data.end(), share.data.begin(), share.data.end());
+            p.erasure_shares.emplace_back(share);
+        }
+        pieces.emplace_back(p);
+    }
+    return pieces;
+}
+
+std::vector<erasure_share> data_processor::split_piece(piece &p, int segment_length) const
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("split_piece");
+    metrics::scoped_timer timer(latency);
+    // 创建变量，预留空间
+    // 每个 stripe 的 erasure share 大小由该 stripe 的实际长度决定
+    const std::vector<int> &lengths = stripe_lengths(segment_length);
+    std::vector<erasure_share> shares;
+    shares.reserve(lengths.size());
+    int offset = 0;
+    for (int length : lengths)
+    {
+        int packetsize;
+        int share_size;
+        stripe_layout(length, &packetsize, &share_size);
+        // piece 缺失或长度不足时，以空 erasure share 占位
+        if (offset + share_size > p.data.size())
+        {
+            shares.emplace_back();
+            continue;
+        }
+        auto it = p.data.begin() + offset;
+        shares.emplace_back(share_buffer(std::make_move_iterator(it), std::make_move_iterator(it + share_size)));
+        offset += share_size;
+    }
+    // 释放 piece 数据，调用方可能在整个下载期间持有 pieces
+    p.data = piece_buffer();
+    return shares;
+}
+
+// std::vector<stripe> data_processor::merge_to_stripes(std::vector<std::vector<erasure_share>> &s) const
+// {
+//     // 粒度为 piece -> erasure share
+//     // s[i][j] 是单个 piece 切分出来的单个 erasure share
+//     // s[i]    是单个 piece 切分出来的所有 erasure shares
+//     // 即，需要交换遍历维度以转换成 stripe
+//     std::cout << "test !!!!" << std::endl;
+//     std::vector<stripe> stripes;
+//     // 未实现 erasure decode，临时处理数据，只需前 k 个 piece
+//     for (int x = 0; x < cfg.segment_size / cfg.stripe_size; x++) {
+//         stripe stripe;
+//         stripe.data.reserve(cfg.stripe_size);
+//         for (int y = 0; y < cfg.k; y++) {
+//             erasure_share &share = s[y][x];
+//             for(int i = 0; i < share.data.size() ;i ++) {
+//                 if(share.data[i] != '\0') {
+//                     stripe.data.push_back(share.data[i]);
+//                 }
+//             }
+//             // stripe.data.insert(stripe.data.end(), std::make_move_iterator(share.data.begin()), std::make_move_iterator(share.data.end()));
+//         }
+//         stripes.emplace_back(stripe);
+//     }
+//     // TODO: erasure decode
+//     return stripes;
+// }
+long gettimens2()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * 纠删解码单个 stripe
+ * @param bitmatrix 编码矩阵对应的 bitmatrix
+ * @param shares 该 stripe 的 k + m 个 erasure share，大小为 0 说明丢失
+ * @param stripe_length stripe 实际数据长度
+ * @return 解码后的 stripe
+ */
+stripe data_processor::decode_stripe(int *bitmatrix, std::vector<erasure_share *> &shares, int stripe_length) const
+{
+    static metrics::histogram &latency = metrics::instance().get_histogram("decode");
+    static metrics::counter &bytes = metrics::instance().get_counter("decode.bytes");
+    metrics::scoped_timer timer(latency);
+    bytes.add(stripe_length);
+    int w = 8;
+    int packetsize = 8;
+    int blocksize = 0;
+    int k = cfg.k;
+    int m = cfg.m;
+    int numerased = 0;
+    stripe_layout(stripe_length, &packetsize, &blocksize);
+
+    char **data = (char **)malloc(sizeof(char *) * k);
+    char **coding = (char **)malloc(sizeof(char *) * m);
+    int *erasures = (int *)malloc(sizeof(int) * (k + m + 1));
+    std::vector<scratch_buffer> blocks(k + m, scratch_buffer(blocksize));
+    for (int y = 0; y < k + m; y++)
+    {
+        erasure_share &share = *shares[y];
+        char *block = blocks[y].data();
+        // 大小为 0 说明丢失了
+        if (share.data.size() == 0)
+        {
+            erasures[numerased] = y;
+            numerased++;
+        }
+        else
+        {
+            std::copy(share.data.begin(), share.data.end(), block);
+        }
+        if (y < k)
+        {
+            data[y] = block;
+        }
+        else
+        {
+            coding[y - k] = block;
+        }
+    }
+    erasures[numerased] = -1;
+
+    // ! decode
+    if (numerased > 0 && config::reram_backend)
+    {
+        // ReRAM 模型完成解码，在副本上实测 Jerasure 的 CPU 时间作对照
+        std::vector<scratch_buffer> expected;
+        std::vector<char *> expected_ptrs;
+        for (int y = 0; y < k + m; y++)
+        {
+            const char *block = y < k ? data[y] : coding[y - k];
+            expected.emplace_back(block, block + blocksize);
+        }
+        for (auto &e : expected)
+        {
+            expected_ptrs.push_back(e.data());
+        }
+        long t1 = gettimens2();
+        jerasure_bitmatrix_decode(k, m, w, bitmatrix, 0, erasures, expected_ptrs.data(), expected_ptrs.data() + k, blocksize, packetsize);
+        long t2 = gettimens2();
+        reram_model &model = reram_model::instance();
+        const reram_model::cost &c = model.decode(k, m, w, bitmatrix, erasures, data, coding, blocksize, packetsize);
+        model.record_decode(c, t2 - t1);
+        for (int i = 0; i < k; i++)
+        {
+            if (!std::equal(expected[i].begin(), expected[i].end(), data[i]))
+            {
+                printf("reram decode differs from jerasure at data %d\n", i);
+            }
+        }
+        static metrics::histogram &cpu = metrics::instance().get_histogram("reram.decode.jerasure_ns");
+        static metrics::histogram &modeled = metrics::instance().get_histogram("reram.decode.model_ns");
+        static metrics::histogram &energy = metrics::instance().get_histogram("reram.decode.energy_pj");
+        cpu.record(t2 - t1);
+        modeled.record(c.latency_ns);
+        energy.record(c.energy_pj);
+    }
+    else if (numerased > 0)
+    {
+        jerasure_bitmatrix_decode(k, m, w, bitmatrix, 0, erasures, data, coding, blocksize, packetsize);
+    }
+
+    // 按 stripe 实际长度截取，去掉对齐补的 0
+    stripe stripe_inner;
+    stripe_inner.data.reserve(stripe_length);
+    for (int i = 0; i < k && stripe_inner.data.size() < stripe_length; i++)
+    {
+        const int n = std::min(blocksize, stripe_length - (int)stripe_inner.data.size());
+        stripe_inner.data.insert(stripe_inner.data.end(), data[i], data[i] + n);
+    }
+    free(data);
+    free(coding);
+    free(erasures);
+    return stripe_inner;
+}
+
+/**
+ * 纠删解码单个 stripe，供只需要少量 stripe 的范围读取使用
+ * @param shares 该 stripe 的 k + m 个 erasure share，大小为 0 说明丢失
+ * @param stripe_length stripe 实际数据长度
+ * @return 解码后的 stripe
+ */
+stripe data_processor::decode_stripe(std::vector<erasure_share> &shares, int stripe_length) const
+{
+    int w = 8;
+    int *matrix = cauchy_original_coding_matrix(cfg.k, cfg.m, w);
+    int *bitmatrix = jerasure_matrix_to_bitmatrix(cfg.k, cfg.m, w, matrix);
+    std::vector<erasure_share *> ptrs;
+    for (auto &share : shares)
+    {
+        ptrs.push_back(&share);
+    }
+    stripe res = decode_stripe(bitmatrix, ptrs, stripe_length);
+    free(matrix);
+    free(bitmatrix);
+    return res;
+}
+
+std::vector<stripe> data_processor::merge_to_stripes(std::vector<std::vector<erasure_share>> &s, int segment_length) const
+{
+    // 粒度为 piece -> erasure share
+    // s[y][x] 是第 y 个 piece 切分出来的第 x 个 erasure share，大小为 0 说明丢失了
+    // 即，需要交换遍历维度以转换成 stripe
+    // 每个 stripe 的解码时间记录在 decode 直方图中，这里记录整个 segment
+    static metrics::histogram &latency = metrics::instance().get_histogram("merge_to_stripes");
+    metrics::scoped_timer timer(latency);
+    std::vector<stripe> stripes;
+    int w = 8;
+    int *matrix = cauchy_original_coding_matrix(cfg.k, cfg.m, w);
+    // matrix = cauchy_good_general_coding_matrix(k, m, w);
+    int *bitmatrix = jerasure_matrix_to_bitmatrix(cfg.k, cfg.m, w, matrix);
+
+    const std::vector<int> &lengths = stripe_lengths(segment_length);
+    stripes.reserve(lengths.size());
+    std::vector<erasure_share *> shares(cfg.k + cfg.m);
+    for (int x = 0; x < lengths.size(); x++)
+    {
+        for (int y = 0; y < cfg.k + cfg.m; y++)
+        {
+            shares[y] = &s[y][x];
+        }
+        stripes.emplace_back(decode_stripe(bitmatrix, shares, lengths[x]));
+    }
+
+    free(matrix);
+    free(bitmatrix);
+    return stripes;
+}
+
+segment data_processor::merge_to_segment(std::vector<stripe> &stripes) const
+{
+    segment res;
+    for (auto &stripe : stripes)
+    {
+        res.data.insert(res.data.end(), std::make_move_iterator(stripe.data.begin()), std::make_move_iterator(stripe.data.end()));
+    }
+    return res;
+}
+
+file data_processor::merge_to_file(std::vector<segment> &segments) const
+{
+    // clock_t start,stop;
+
+    // double duration;
+
+    // start=clock();
+    file res;
+    res.segments = segments;
+    // stop=clock();
+
+    // duration=((double)(stop-start))/CLOCK_TAI;
+
+    // std::cout<<"merge_to_file:"<<duration<<std::endl;
+    return res;
+}
+
+/**
+ * 按该配置完整 stripe 的编码，输出 ReRAM 模型随并行 tile 数的吞吐
+ */
+void data_processor::reram_scaling_report(int max_tiles) const
+{
+    int w = 8;
+    int packetsize = 0;
+    int share_size = 0;
+    stripe_layout(cfg.stripe_size, &packetsize, &share_size);
+    int *matrix = cauchy_original_coding_matrix(cfg.k, cfg.m, w);
+    int *bitmatrix = jerasure_matrix_to_bitmatrix(cfg.k, cfg.m, w, matrix);
+    reram_model::instance().scaling_report(cfg.k, cfg.m, w, bitmatrix, share_size, packetsize, max_tiles);
+    free(matrix);
+    free(bitmatrix);
+}
+
+std::vector<stripe> data_processor::repair_stripes_from_erasure_shares(const std::vector<std::vector<erasure_share>> &s) const
+{
+    // TODO: implementation
+}
@@ -0,0 +1,89 @@
+//
+// 基于 epoch 的延迟回收
+//
+
+#include <vector>
+
+#include "epoch_tracker.h"
+
+using namespace storj;
+
+epoch_tracker::guard::guard(epoch_tracker *tracker, uint64_t epoch) : tracker(tracker), epoch(epoch)
+{}
+
+epoch_tracker::guard::guard(guard &&other) noexcept : tracker(other.tracker), epoch(other.epoch)
+{
+    other.tracker = nullptr;
+}
+
+epoch_tracker::guard::~guard()
+{
+    if (tracker != nullptr)
+    {
+        tracker->unpin(epoch);
+    }
+}
+
+epoch_tracker::guard epoch_tracker::pin()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    active.insert(global_epoch);
+    return guard(this, global_epoch);
+}
+
+void epoch_tracker::unpin(uint64_t epoch)
+{
+    bool oldest;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        oldest = *active.begin() == epoch;
+        active.erase(active.find(epoch));
+    }
+    // 最早的读取结束时才可能有资源可以回收
+    if (oldest)
+    {
+        reclaim();
+    }
+}
+
+/**
+ * 登记被替换下来的资源，资源必须已经对新的读取不可见
+ * @param reclaim 回收函数，在没有读取可能引用该资源后调用
+ */
+void epoch_tracker::retire(std::function<void()> reclaim)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.emplace_back(global_epoch, std::move(reclaim));
+        global_epoch++;
+    }
+    this->reclaim();
+}
+
+/**
+ * 回收所有已经安全的资源
+ * @return 回收的资源数
+ */
+int epoch_tracker::reclaim()
+{
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!retired.empty() && (active.empty() || *active.begin() > retired.front().first))
+        {
+            ready.push_back(std::move(retired.front().second));
+            retired.pop_front();
+        }
+    }
+    for (auto &f : ready)
+    {
+        f();
+    }
+    return ready.size();
+}
+
+int epoch_tracker::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return retired.size();
+}
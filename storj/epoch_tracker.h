@@ -0,0 +1,63 @@
+//
+// 基于 epoch 的延迟回收
+//
+
+#ifndef STORJ_EMULATOR_EPOCH_TRACKER_H
+#define STORJ_EMULATOR_EPOCH_TRACKER_H
+
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <utility>
+
+namespace storj
+{
+    /**
+     * 读取前 pin() 记下当前全局 epoch；替换下来的资源以当前 epoch retire()，随后全局 epoch 加一。
+     * 只有当所有仍在进行的读取都是在 retire 之后开始的（其 epoch 大于 retire 时的 epoch），
+     * 资源才可能不再被引用，此时执行回收函数
+     */
+    class epoch_tracker
+    {
+    public:
+        /**
+         * 读取期间持有，析构时解除并尝试回收
+         */
+        class guard
+        {
+        private:
+            epoch_tracker *tracker;
+            uint64_t epoch;
+
+        public:
+            guard(epoch_tracker *tracker, uint64_t epoch);
+            guard(guard &&other) noexcept;
+            guard(const guard &) = delete;
+            guard &operator=(const guard &) = delete;
+            virtual ~guard();
+        };
+
+    private:
+        uint64_t global_epoch = 1;
+        std::multiset<uint64_t> active;
+        std::deque<std::pair<uint64_t, std::function<void()>>> retired;
+        mutable std::mutex mutex;
+
+        void unpin(uint64_t epoch);
+
+    public:
+        epoch_tracker() = default;
+        epoch_tracker(const epoch_tracker &) = delete;
+        epoch_tracker &operator=(const epoch_tracker &) = delete;
+
+        guard pin();
+        void retire(std::function<void()> reclaim);
+        int reclaim();
+        int pending() const;
+    };
+}
+
+#endif //STORJ_EMULATOR_EPOCH_TRACKER_H
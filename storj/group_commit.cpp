@@ -0,0 +1,148 @@
+//
+// 持久化写入的组提交
+//
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "group_commit.h"
+
+using namespace storj;
+
+group_commit::group_commit(int batch_size) : batch_size(batch_size)
+{}
+
+group_commit::~group_commit()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    flush_locked();
+}
+
+/**
+ * 为一个事务分配 ticket
+ */
+group_commit::ticket group_commit::begin()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ++next_ticket;
+}
+
+/**
+ * 加入一个已写完的文件，文件由组提交负责关闭
+ * @param fd 文件描述符
+ * @param dir 文件所在目录
+ * @param t 写入该文件的事务
+ */
+void group_commit::add_file(int fd, const std::string &dir, ticket t)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fds.emplace_back(fd, t);
+    dirs[dir].insert(t);
+    pending.insert(t);
+    flush_if_full();
+}
+
+/**
+ * 加入一个有未落盘追加的日志存储
+ * @param store 日志存储
+ * @param dir 日志所在目录，日志滚动时会新建文件
+ * @param t 追加的事务
+ */
+void group_commit::add_log(log_store *store, const std::string &dir, ticket t)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stores[store].insert(t);
+    dirs[dir].insert(t);
+    pending.insert(t);
+    flush_if_full();
+}
+
+int group_commit::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return fds.size() + stores.size();
+}
+
+/**
+ * 当前批次中有该事务的文件时落盘整个批次
+ * @param t 事务的 ticket
+ * @return 该事务加入的文件是否全部落盘，报告后不再记录
+ */
+bool group_commit::flush(ticket t)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.count(t) > 0)
+    {
+        flush_locked();
+    }
+    return failed.erase(t) == 0;
+}
+
+/**
+ * 放弃事务，不再报告它的落盘结果；仍在当前批次中的文件照常落盘
+ */
+void group_commit::release(ticket t)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.count(t) > 0)
+    {
+        flush_locked();
+    }
+    failed.erase(t);
+}
+
+void group_commit::flush_if_full()
+{
+    if (fds.size() + stores.size() >= batch_size)
+    {
+        flush_locked();
+    }
+}
+
+/**
+ * 落盘当前批次，失败记到加入对应文件的 tickets 上
+ */
+void group_commit::flush_locked()
+{
+    // 一轮 sync_file_range 让所有文件同时开始写回
+    for (const auto &entry : fds)
+    {
+        sync_file_range(entry.first, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+    for (const auto &entry : fds)
+    {
+        if (fdatasync(entry.first) == -1)
+        {
+            perror("group commit: Failed to sync file");
+            failed.insert(entry.second);
+        }
+        close(entry.first);
+    }
+    for (const auto &entry : stores)
+    {
+        if (!entry.first->sync())
+        {
+            perror("group commit: Failed to sync log");
+            failed.insert(entry.second.begin(), entry.second.end());
+        }
+    }
+    // 新建文件的目录项
+    for (const auto &entry : dirs)
+    {
+        int fd = open(entry.first.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd == -1 || fsync(fd) == -1)
+        {
+            perror("group commit: Failed to sync directory");
+            failed.insert(entry.second.begin(), entry.second.end());
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+    fds.clear();
+    dirs.clear();
+    stores.clear();
+    pending.clear();
+}
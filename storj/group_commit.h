@@ -0,0 +1,65 @@
+//
+// 持久化写入的组提交
+//
+
+#ifndef STORJ_EMULATOR_GROUP_COMMIT_H
+#define STORJ_EMULATOR_GROUP_COMMIT_H
+
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log_store.h"
+
+namespace storj
+{
+    /**
+     * 收集一批已写完但尚未落盘的 piece 文件，flush() 时统一落盘：
+     * 先对所有文件发起 sync_file_range 写回，再逐个 fdatasync（此时大多已写完），
+     * 最后 fsync 涉及的目录使新建的目录项持久化。
+     * 每个事务先用 begin() 取得一个 ticket，加入的文件都带上它；
+     * 事务提交前调用 flush(ticket)，只报告该 ticket 的文件是否落盘，其它事务的失败不会报告给它。
+     * 数据库事务应在 flush(ticket) 成功之后再提交。
+     */
+    class group_commit
+    {
+    public:
+        typedef long long ticket;
+
+    private:
+        // 攒够该数量的文件后立即落盘，避免一次事务中打开过多文件
+        int batch_size;
+        ticket next_ticket = 0;
+        // 当前批次的文件、日志存储与目录，以及加入它们的 tickets
+        std::vector<std::pair<int, ticket>> fds;
+        std::map<std::string, std::set<ticket>> dirs;
+        std::map<log_store *, std::set<ticket>> stores;
+        // 当前批次中有文件的 tickets
+        std::set<ticket> pending;
+        // 有文件落盘失败、尚未由 flush(ticket) 报告的 tickets
+        std::set<ticket> failed;
+        mutable std::mutex mutex;
+
+        void flush_locked();
+        void flush_if_full();
+
+    public:
+        explicit group_commit(int batch_size);
+        virtual ~group_commit();
+        group_commit(const group_commit &) = delete;
+        group_commit &operator=(const group_commit &) = delete;
+
+        ticket begin();
+        void add_file(int fd, const std::string &dir, ticket t);
+        void add_log(log_store *store, const std::string &dir, ticket t);
+        int size() const;
+        bool flush(ticket t);
+        void release(ticket t);
+    };
+}
+
+#endif //STORJ_EMULATOR_GROUP_COMMIT_H
@@ -0,0 +1,530 @@
+//
+// 日志结构的单节点 piece 存储
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <tuple>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+
+#include "log_store.h"
+
+using namespace storj;
+
+log_store::log_store(std::string dir, long max_log_size, double compact_ratio) : dir(std::move(dir)), max_log_size(max_log_size), compact_ratio(compact_ratio)
+{
+    open_logs();
+}
+
+log_store::~log_store()
+{
+    for (auto &pair : logs)
+    {
+        close(pair.second.fd);
+    }
+}
+
+std::string log_store::log_path(int log) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "log_%06d.log", log);
+    return dir + "/" + name;
+}
+
+std::string log_store::compact_path(int log) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "compact_%06d.tmp", log);
+    return dir + "/" + name;
+}
+
+/**
+ * 按编号顺序打开并重放已有的日志，没有日志时创建第一个
+ */
+void log_store::open_logs()
+{
+    mkdir(dir.c_str(), 0755);
+    std::vector<int> numbers;
+    DIR *d = opendir(dir.c_str());
+    if (d != nullptr)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != nullptr)
+        {
+            int log;
+            char tail;
+            if (sscanf(entry->d_name, "log_%d.lo%c", &log, &tail) == 2 && tail == 'g')
+            {
+                numbers.push_back(log);
+            }
+            // 压缩中途崩溃遗留的临时文件，原日志仍完整
+            else if (sscanf(entry->d_name, "compact_%d.tm%c", &log, &tail) == 2 && tail == 'p')
+            {
+                unlink((dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    std::sort(numbers.begin(), numbers.end());
+    for (int log : numbers)
+    {
+        int fd = open(log_path(log).c_str(), O_RDWR);
+        if (fd == -1)
+        {
+            perror("log store: Failed to open log");
+            continue;
+        }
+        logs[log] = log_file{fd, 0, 0, 0};
+        replay(log);
+        active = log;
+    }
+    if (logs.empty())
+    {
+        roll();
+    }
+}
+
+/**
+ * 重放单个日志重建索引，遇到不完整的记录（写入时崩溃）则截断
+ * @param log 日志编号
+ */
+void log_store::replay(int log)
+{
+    log_file &file = logs[log];
+    struct stat st;
+    fstat(file.fd, &st);
+    long offset = 0;
+    while (offset + (long)sizeof(record_header) <= st.st_size)
+    {
+        record_header header;
+        if (pread(file.fd, &header, sizeof(header), offset) != sizeof(header) || header.magic != record_magic ||
+            offset + (long)sizeof(header) + (long)header.length > st.st_size)
+        {
+            break;
+        }
+        const std::string piece_id(header.piece_id, strnlen(header.piece_id, sizeof(header.piece_id)));
+        const long record_size = sizeof(header) + header.length;
+        auto it = index.find(piece_id);
+        if (it != index.end())
+        {
+            logs[it->second.log].live -= sizeof(header) + it->second.length;
+            index.erase(it);
+        }
+        if (header.type == record_put)
+        {
+            index[piece_id] = location{log, offset + (long)sizeof(header), (long)header.length, header.crc, header.timestamp};
+            file.live += record_size;
+        }
+        else
+        {
+            file.tombstones += record_size;
+        }
+        offset += record_size;
+    }
+    if (offset < st.st_size)
+    {
+        printf("log store: truncate %s at %ld\n", log_path(log).c_str(), offset);
+        if (ftruncate(file.fd, offset) == -1)
+        {
+            perror("log store: Failed to truncate log");
+        }
+    }
+    file.size = offset;
+}
+
+/**
+ * 创建新的日志作为追加目标
+ */
+void log_store::roll()
+{
+    // 切换前让旧日志落盘，sync() 之后只需同步当前日志
+    if (!logs.empty())
+    {
+        fdatasync(logs[active].fd);
+    }
+    const int log = logs.empty() ? 1 : logs.rbegin()->first + 1;
+    int fd = open(log_path(log).c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        perror("log store: Failed to create log");
+        return;
+    }
+    logs[log] = log_file{fd, 0, 0, 0};
+    active = log;
+}
+
+/**
+ * 追加一条记录到当前日志，调用方持有写锁
+ */
+bool log_store::append_record(uint32_t type, const std::string &piece_id, const char *data, long length, int64_t timestamp, location *loc)
+{
+    if (logs[active].size > 0 && logs[active].size + (long)sizeof(record_header) + length > max_log_size)
+    {
+        roll();
+    }
+    log_file &file = logs[active];
+
+    record_header header{};
+    header.magic = record_magic;
+    header.type = type;
+    std::copy(piece_id.begin(), piece_id.begin() + std::min(piece_id.size(), sizeof(header.piece_id)), header.piece_id);
+    header.length = length;
+    boost::crc_32_type crc;
+    crc.process_bytes(data, length);
+    header.crc = crc.checksum();
+    header.timestamp = timestamp;
+
+    // header 与 payload 一次写入
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = length;
+    const long total = sizeof(header) + length;
+    long written = pwritev(file.fd, iov, length > 0 ? 2 : 1, file.size);
+    while (written > 0 && written < total)
+    {
+        // 极少出现的部分写入，逐段补齐
+        const long n = written < (long)sizeof(header)
+                           ? pwrite(file.fd, reinterpret_cast<char *>(&header) + written, sizeof(header) - written, file.size + written)
+                           : pwrite(file.fd, data + (written - sizeof(header)), total - written, file.size + written);
+        if (n <= 0)
+        {
+            break;
+        }
+        written += n;
+    }
+    if (written != total)
+    {
+        perror("log store: Failed to append record");
+        return false;
+    }
+    if (loc != nullptr)
+    {
+        *loc = location{active, file.size + (long)sizeof(header), length, header.crc, timestamp};
+    }
+    file.size += total;
+    if (type == record_delete)
+    {
+        file.tombstones += total;
+    }
+    return true;
+}
+
+/**
+ * 追加 piece，同一 piece id 重复写入时以最后一次为准
+ */
+bool log_store::append(const std::string &piece_id, const char *data, long length)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    location loc;
+    if (!append_record(record_put, piece_id, data, length, time(nullptr), &loc))
+    {
+        return false;
+    }
+    auto it = index.find(piece_id);
+    if (it != index.end())
+    {
+        logs[it->second.log].live -= sizeof(record_header) + it->second.length;
+    }
+    index[piece_id] = loc;
+    logs[loc.log].live += sizeof(record_header) + length;
+    return true;
+}
+
+/**
+ * 读取 piece 中的一段数据，一次索引查询加一次 pread
+ * @return 实际读取的字节数，piece 不存在时返回 -1
+ */
+long log_store::read(const std::string &piece_id, long offset, long length, char *buf) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = index.find(piece_id);
+    if (it == index.end())
+    {
+        return -1;
+    }
+    const location &loc = it->second;
+    if (offset >= loc.length)
+    {
+        return 0;
+    }
+    length = std::min(length, loc.length - offset);
+    const int fd = logs.at(loc.log).fd;
+    long total = 0;
+    while (total < length)
+    {
+        long n = pread(fd, buf + total, length - total, loc.offset + offset + total);
+        if (n <= 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+bool log_store::read_all(const std::string &piece_id, piece_buffer &data) const
+{
+    location loc;
+    if (!lookup(piece_id, &loc))
+    {
+        return false;
+    }
+    data.resize(loc.length);
+    const long n = read(piece_id, 0, loc.length, data.data());
+    if (n != loc.length)
+    {
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 深度审计：读出整个 piece 并校验写入时记录的 CRC32
+ * @return piece 存在且数据完好
+ */
+bool log_store::verify(const std::string &piece_id) const
+{
+    location loc;
+    piece_buffer data;
+    if (!lookup(piece_id, &loc) || !read_all(piece_id, data))
+    {
+        return false;
+    }
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+    return crc.checksum() == loc.crc;
+}
+
+bool log_store::contains(const std::string &piece_id) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return index.count(piece_id) > 0;
+}
+
+bool log_store::lookup(const std::string &piece_id, location *loc) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = index.find(piece_id);
+    if (it == index.end())
+    {
+        return false;
+    }
+    *loc = it->second;
+    return true;
+}
+
+/**
+ * 删除 piece：追加墓碑记录，空间由 compact() 回收
+ */
+bool log_store::remove(const std::string &piece_id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = index.find(piece_id);
+    if (it == index.end())
+    {
+        return false;
+    }
+    if (!append_record(record_delete, piece_id, nullptr, 0, time(nullptr), nullptr))
+    {
+        return false;
+    }
+    logs[it->second.log].live -= sizeof(record_header) + it->second.length;
+    index.erase(it);
+    return true;
+}
+
+bool log_store::sync()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return fdatasync(logs.at(active).fd) == 0;
+}
+
+/**
+ * 写入完整的一段数据，处理部分写入
+ */
+static bool pwrite_all(int fd, const char *data, long length, long offset)
+{
+    long written = 0;
+    while (written < length)
+    {
+        const long n = pwrite(fd, data + written, length - written, offset + written);
+        if (n <= 0)
+        {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+/**
+ * 压缩一个日志：存活的 piece 按原顺序复制到临时文件，落盘后替换该日志，日志编号不变，重放顺序也不变。
+ * 该日志之前还有更早的日志时，其中的墓碑记录也需要保留，否则旧的 piece 会在重放时复活。
+ * 复制与落盘只持有共享锁检查记录是否存活，追加与读取照常进行；
+ * 替换时才持有写锁，只更新复制期间没有被覆盖或删除的 piece 的索引
+ * @param log 日志编号
+ */
+bool log_store::compact_log(int log)
+{
+    std::lock_guard<std::mutex> compacting(compact_mutex);
+    int fd;
+    long size;
+    bool oldest;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto file = logs.find(log);
+        if (file == logs.end() || log == active)
+        {
+            return false;
+        }
+        // 只有当前日志会追加，其它日志的内容在压缩期间不变
+        fd = file->second.fd;
+        size = file->second.size;
+        oldest = logs.begin()->first == log;
+    }
+
+    const std::string &path = compact_path(log);
+    int out = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (out == -1)
+    {
+        perror("log store: Failed to create compacted log");
+        return false;
+    }
+    // 复制的 put 记录：piece id、原 payload 偏移、新 payload 偏移
+    std::vector<std::tuple<std::string, long, long>> moved;
+    long offset = 0;
+    long out_size = 0;
+    long tombstones = 0;
+    std::vector<char> buf;
+    bool ok = true;
+    while (ok && offset < size)
+    {
+        record_header header;
+        if (pread(fd, &header, sizeof(header), offset) != sizeof(header))
+        {
+            ok = false;
+            break;
+        }
+        const std::string piece_id(header.piece_id, strnlen(header.piece_id, sizeof(header.piece_id)));
+        const long payload = offset + sizeof(header);
+        const long record_size = sizeof(header) + header.length;
+        bool keep;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto it = index.find(piece_id);
+            keep = header.type == record_put
+                       ? it != index.end() && it->second.log == log && it->second.offset == payload
+                       : header.type == record_delete && !oldest && it == index.end();
+        }
+        if (keep)
+        {
+            buf.resize(record_size);
+            ok = pread(fd, buf.data(), record_size, offset) == record_size && pwrite_all(out, buf.data(), record_size, out_size);
+            if (header.type == record_put)
+            {
+                moved.emplace_back(piece_id, payload, out_size + (long)sizeof(header));
+            }
+            else
+            {
+                tombstones += record_size;
+            }
+            out_size += record_size;
+        }
+        offset = payload + header.length;
+    }
+    // 复制的数据落盘后才能替换旧日志
+    if (!ok || fdatasync(out) == -1)
+    {
+        perror("log store: Failed to write compacted log");
+        close(out);
+        unlink(path.c_str());
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    log_file &file = logs[log];
+    if (out_size == 0)
+    {
+        close(out);
+        unlink(path.c_str());
+        close(file.fd);
+        unlink(log_path(log).c_str());
+        logs.erase(log);
+        return true;
+    }
+    if (rename(path.c_str(), log_path(log).c_str()) == -1)
+    {
+        perror("log store: Failed to replace log");
+        close(out);
+        unlink(path.c_str());
+        return false;
+    }
+    long live = 0;
+    for (const auto &record : moved)
+    {
+        auto it = index.find(std::get<0>(record));
+        if (it != index.end() && it->second.log == log && it->second.offset == std::get<1>(record))
+        {
+            it->second.offset = std::get<2>(record);
+            live += sizeof(record_header) + it->second.length;
+        }
+    }
+    close(file.fd);
+    file = log_file{out, out_size, live, tombstones};
+    return true;
+}
+
+/**
+ * 压缩垃圾比例超过 compact_ratio 的日志，由后台线程周期调用
+ * @return 压缩的日志数
+ */
+int log_store::compact()
+{
+    std::vector<int> candidates;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        for (const auto &pair : logs)
+        {
+            const log_file &file = pair.second;
+            // 最早的日志中的墓碑记录可以丢弃，其它日志中的需要保留
+            const long garbage = file.size - file.live - (pair.first == logs.begin()->first ? 0 : file.tombstones);
+            if (pair.first != active && file.size > 0 && (double)garbage / file.size >= compact_ratio)
+            {
+                candidates.push_back(pair.first);
+            }
+        }
+    }
+    int compacted = 0;
+    for (int log : candidates)
+    {
+        if (compact_log(log))
+        {
+            compacted++;
+        }
+    }
+    return compacted;
+}
+
+std::vector<std::string> log_store::piece_ids() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<std::string> res;
+    res.reserve(index.size());
+    for (const auto &pair : index)
+    {
+        res.push_back(pair.first);
+    }
+    return res;
+}
@@ -0,0 +1,102 @@
+//
+// 日志结构的单节点 piece 存储
+//
+
+#ifndef STORJ_EMULATOR_LOG_STORE_H
+#define STORJ_EMULATOR_LOG_STORE_H
+
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.h"
+
+namespace storj
+{
+    /**
+     * 一个 storage node 的所有 pieces 顺序追加到若干个日志文件 (log_XXXXXX.log) 中，
+     * 内存索引记录 piece id -> (log, offset, length)，启动时重放日志重建索引。
+     * 删除 piece 时追加墓碑记录，compact() 把日志重写为只含存活记录的同编号日志，回收已删除 piece 占用的空间。
+     */
+    class log_store
+    {
+    public:
+#pragma pack(push, 1)
+        struct record_header
+        {
+            uint32_t magic;
+            uint32_t type;
+            char piece_id[36];
+            uint64_t length;
+            // payload 的 CRC32，用于深度审计
+            uint32_t crc;
+            int64_t timestamp;
+        };
+#pragma pack(pop)
+
+        struct location
+        {
+            int log;
+            long offset;
+            long length;
+            uint32_t crc;
+            int64_t timestamp;
+        };
+
+    private:
+        struct log_file
+        {
+            int fd;
+            long size;
+            long live;
+            // 墓碑记录的字节数，更早的日志都压缩掉之前不能回收
+            long tombstones;
+        };
+
+        static const uint32_t record_magic = 0x50434c47;
+        static const uint32_t record_put = 1;
+        static const uint32_t record_delete = 2;
+
+        std::string dir;
+        long max_log_size;
+        double compact_ratio;
+        std::map<int, log_file> logs;
+        std::unordered_map<std::string, location> index;
+        int active = 0;
+        mutable std::shared_mutex mutex;
+        // 串行化压缩，压缩期间不持有 mutex 的写锁
+        std::mutex compact_mutex;
+
+        std::string log_path(int log) const;
+        std::string compact_path(int log) const;
+        void open_logs();
+        void replay(int log);
+        void roll();
+        bool append_record(uint32_t type, const std::string &piece_id, const char *data, long length, int64_t timestamp, location *loc);
+        bool compact_log(int log);
+
+    public:
+        log_store(std::string dir, long max_log_size, double compact_ratio);
+        virtual ~log_store();
+        log_store(const log_store &) = delete;
+        log_store &operator=(const log_store &) = delete;
+
+        bool append(const std::string &piece_id, const char *data, long length);
+        long read(const std::string &piece_id, long offset, long length, char *buf) const;
+        bool read_all(const std::string &piece_id, piece_buffer &data) const;
+        bool verify(const std::string &piece_id) const;
+        bool contains(const std::string &piece_id) const;
+        bool lookup(const std::string &piece_id, location *loc) const;
+        bool remove(const std::string &piece_id);
+        bool sync();
+        int compact();
+        std::vector<std::string> piece_ids() const;
+    };
+}
+
+#endif //STORJ_EMULATOR_LOG_STORE_H
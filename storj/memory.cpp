@@ -0,0 +1,257 @@
+//
+// 按流水线阶段统计的内存占用与内存预算
+//
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+#include "config.h"
+#include "memory.h"
+#include "metrics.h"
+
+using namespace storj;
+
+// 每块缓冲区前保存分配时所在的操作，释放时从同一个操作上扣除
+static const std::size_t header_size = 16;
+static_assert(sizeof(std::shared_ptr<memory::usage>) <= header_size, "header too small");
+
+static thread_local std::shared_ptr<memory::usage> current_op;
+
+static std::mutex budget_mutex;
+static std::condition_variable budget_cv;
+static long long reserved_bytes = 0;
+static long long reserved_peak_bytes = 0;
+static thread_local int reservations_held = 0;
+
+// 不析构，静态对象析构时释放的缓冲区仍可记账
+static memory::usage &global()
+{
+    static memory::usage *usage = new memory::usage();
+    return *usage;
+}
+
+static void update_peak(std::atomic<long long> &peak, long long value)
+{
+    long long current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+memory::usage::usage(std::shared_ptr<usage> parent) : parent(std::move(parent))
+{
+    for (int i = 0; i < phase_count; i++)
+    {
+        current[i].store(0, std::memory_order_relaxed);
+        peak[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void memory::usage::add(int phase, long long bytes)
+{
+    update_peak(peak[phase], current[phase].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    update_peak(total_peak, total.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    if (parent != nullptr)
+    {
+        parent->add(phase, bytes);
+    }
+}
+
+void memory::usage::sub(int phase, long long bytes)
+{
+    current[phase].fetch_sub(bytes, std::memory_order_relaxed);
+    total.fetch_sub(bytes, std::memory_order_relaxed);
+    if (parent != nullptr)
+    {
+        parent->sub(phase, bytes);
+    }
+}
+
+/**
+ * 峰值重置为当前占用
+ */
+void memory::usage::reset_peaks()
+{
+    for (int i = 0; i < phase_count; i++)
+    {
+        peak[i].store(current[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    total_peak.store(total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+/**
+ * @param name 静态字符串，作为直方图名字的一部分
+ */
+memory::operation::operation(const char *name) : name(name), outer(current_op)
+{
+    state = std::make_shared<usage>(outer);
+    current_op = state;
+}
+
+memory::operation::~operation()
+{
+    current_op = outer;
+    const std::string prefix = std::string("memory.") + name;
+    metrics::instance().get_histogram(prefix + ".peak_bytes").record(peak());
+    for (int i = 0; i < phase_count; i++)
+    {
+        metrics::instance().get_histogram(prefix + "." + phase_name(i) + ".peak_bytes").record(peak(i));
+    }
+}
+
+long long memory::operation::peak() const
+{
+    return state->total_peak.load(std::memory_order_relaxed);
+}
+
+long long memory::operation::peak(int phase) const
+{
+    return state->peak[phase].load(std::memory_order_relaxed);
+}
+
+memory::bind::bind(std::shared_ptr<usage> state) : outer(current_op)
+{
+    current_op = std::move(state);
+}
+
+memory::bind::~bind()
+{
+    current_op = outer;
+}
+
+memory::reservation::reservation(long long bytes, bool wait) : bytes(bytes), wait(wait)
+{
+    if (!wait)
+    {
+        std::lock_guard<std::mutex> lock(budget_mutex);
+        reserved_bytes += bytes;
+        reserved_peak_bytes = std::max(reserved_peak_bytes, reserved_bytes);
+        return;
+    }
+    static metrics::histogram &wait_latency = metrics::instance().get_histogram("memory.reserve_wait");
+    const long long start = metrics::now_ns();
+    {
+        std::unique_lock<std::mutex> lock(budget_mutex);
+        if (config::memory_budget > 0 && reservations_held == 0)
+        {
+            budget_cv.wait(lock, [bytes]
+                           { return reserved_bytes == 0 || reserved_bytes + bytes <= config::memory_budget; });
+        }
+        reserved_bytes += bytes;
+        reserved_peak_bytes = std::max(reserved_peak_bytes, reserved_bytes);
+    }
+    reservations_held++;
+    metrics::record_interval(wait_latency, start, metrics::now_ns());
+}
+
+memory::reservation::~reservation()
+{
+    if (wait)
+    {
+        reservations_held--;
+    }
+    {
+        std::lock_guard<std::mutex> lock(budget_mutex);
+        reserved_bytes -= bytes;
+    }
+    budget_cv.notify_all();
+}
+
+const char *memory::phase_name(int phase)
+{
+    static const char *names[phase_count] = {"segments", "stripes", "shares", "pieces", "decode_scratch"};
+    return names[phase];
+}
+
+void *memory::allocate(int phase, std::size_t bytes)
+{
+    char *block = static_cast<char *>(::operator new(bytes + header_size));
+    new (block) std::shared_ptr<usage>(current_op);
+    global().add(phase, bytes);
+    if (current_op != nullptr)
+    {
+        current_op->add(phase, bytes);
+    }
+    return block + header_size;
+}
+
+void memory::deallocate(int phase, void *p, std::size_t bytes)
+{
+    char *block = static_cast<char *>(p) - header_size;
+    auto *op = reinterpret_cast<std::shared_ptr<usage> *>(block);
+    global().sub(phase, bytes);
+    if (*op != nullptr)
+    {
+        (*op)->sub(phase, bytes);
+    }
+    op->~shared_ptr();
+    ::operator delete(block);
+}
+
+/**
+ * 当前线程所在的操作，不在任何操作中时为空
+ */
+std::shared_ptr<memory::usage> memory::current_operation()
+{
+    return current_op;
+}
+
+long long memory::current(int phase)
+{
+    return global().current[phase].load(std::memory_order_relaxed);
+}
+
+long long memory::peak(int phase)
+{
+    return global().peak[phase].load(std::memory_order_relaxed);
+}
+
+long long memory::total()
+{
+    return global().total.load(std::memory_order_relaxed);
+}
+
+long long memory::total_peak()
+{
+    return global().total_peak.load(std::memory_order_relaxed);
+}
+
+long long memory::reserved()
+{
+    std::lock_guard<std::mutex> lock(budget_mutex);
+    return reserved_bytes;
+}
+
+long long memory::reserved_peak()
+{
+    std::lock_guard<std::mutex> lock(budget_mutex);
+    return reserved_peak_bytes;
+}
+
+/**
+ * 各阶段的当前占用与峰值，以及预算的使用情况
+ */
+std::string memory::report()
+{
+    std::ostringstream out;
+    for (int i = 0; i < phase_count; i++)
+    {
+        out << "memory " << phase_name(i) << ": current " << current(i) << " bytes, peak " << peak(i) << " bytes\n";
+    }
+    out << "memory total: current " << total() << " bytes, peak " << total_peak() << " bytes\n";
+    out << "memory budget: " << config::memory_budget << " bytes, peak reserved " << reserved_peak() << " bytes\n";
+    return out.str();
+}
+
+/**
+ * 全局峰值重置为当前占用，已开始的操作不受影响
+ */
+void memory::reset_peaks()
+{
+    global().reset_peaks();
+    std::lock_guard<std::mutex> lock(budget_mutex);
+    reserved_peak_bytes = reserved_bytes;
+}
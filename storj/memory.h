@@ -0,0 +1,168 @@
+//
+// 按流水线阶段统计的内存占用与内存预算
+//
+
+#ifndef STORJ_EMULATOR_MEMORY_H
+#define STORJ_EMULATOR_MEMORY_H
+
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace storj
+{
+    /**
+     * segment、stripe、erasure share、piece 与解码临时数据的缓冲区通过 tracking_allocator 分配，
+     * 按阶段记录当前占用与峰值。
+     * operation 作用域内分配的缓冲区同时记到该操作上（包括提交到 thread_pool 的任务），结束时记录峰值；
+     * reservation 在处理一个 segment 前按预估占用申请内存预算，超出 config::memory_budget 时阻塞等待
+     */
+    class memory
+    {
+    public:
+        enum phase
+        {
+            segments,
+            stripes,
+            shares,
+            pieces,
+            decode_scratch,
+            phase_count
+        };
+
+        /**
+         * 各阶段的当前字节数与峰值；操作的占用同时累加到外层操作
+         */
+        struct usage
+        {
+            const std::shared_ptr<usage> parent;
+            std::atomic<long long> current[phase_count];
+            std::atomic<long long> peak[phase_count];
+            std::atomic<long long> total{0};
+            std::atomic<long long> total_peak{0};
+
+            explicit usage(std::shared_ptr<usage> parent = nullptr);
+            void add(int phase, long long bytes);
+            void sub(int phase, long long bytes);
+            void reset_peaks();
+        };
+
+        /**
+         * 作用域内当前线程分配的缓冲区记到该操作，
+         * 结束时把峰值记录到直方图 memory.<name>.peak_bytes 与 memory.<name>.<phase>.peak_bytes
+         */
+        class operation
+        {
+            const char *name;
+            std::shared_ptr<usage> state;
+            std::shared_ptr<usage> outer;
+
+        public:
+            explicit operation(const char *name);
+            operation(const operation &) = delete;
+            operation &operator=(const operation &) = delete;
+            ~operation();
+
+            long long peak() const;
+            long long peak(int phase) const;
+        };
+
+        /**
+         * 作用域内把当前线程的分配记到指定操作上，thread_pool 用它把提交线程的操作带到工作线程
+         */
+        class bind
+        {
+            std::shared_ptr<usage> outer;
+
+        public:
+            explicit bind(std::shared_ptr<usage> state);
+            bind(const bind &) = delete;
+            bind &operator=(const bind &) = delete;
+            ~bind();
+        };
+
+        /**
+         * 作用域内占用 bytes 字节的内存预算。
+         * 已占用的预算加上 bytes 超出上限时等待，没有其他占用时总是放行，避免单个大 segment 永远等待；
+         * 同一线程已持有预算时不再等待，避免与自己持有的预算互相等待。
+         * wait 为 false 时不等待也不计入当前线程，可以在其他线程析构，用于后台任务继续持有已分配的数据
+         */
+        class reservation
+        {
+            const long long bytes;
+            const bool wait;
+
+        public:
+            explicit reservation(long long bytes, bool wait = true);
+            reservation(const reservation &) = delete;
+            reservation &operator=(const reservation &) = delete;
+            ~reservation();
+        };
+
+        static const char *phase_name(int phase);
+        static void *allocate(int phase, std::size_t bytes);
+        static void deallocate(int phase, void *p, std::size_t bytes);
+        static std::shared_ptr<usage> current_operation();
+
+        static long long current(int phase);
+        static long long peak(int phase);
+        static long long total();
+        static long long total_peak();
+        static long long reserved();
+        static long long reserved_peak();
+        static std::string report();
+        static void reset_peaks();
+    };
+
+    /**
+     * 分配时记账到阶段 P 的分配器，各实例之间没有状态
+     */
+    template <typename T, int P>
+    struct tracking_allocator
+    {
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef tracking_allocator<U, P> other;
+        };
+
+        tracking_allocator() = default;
+
+        template <typename U>
+        tracking_allocator(const tracking_allocator<U, P> &)
+        {}
+
+        T *allocate(std::size_t n)
+        {
+            return static_cast<T *>(memory::allocate(P, n * sizeof(T)));
+        }
+
+        void deallocate(T *p, std::size_t n)
+        {
+            memory::deallocate(P, p, n * sizeof(T));
+        }
+
+        bool operator==(const tracking_allocator &) const
+        {
+            return true;
+        }
+
+        bool operator!=(const tracking_allocator &) const
+        {
+            return false;
+        }
+    };
+
+    typedef std::vector<char, tracking_allocator<char, memory::segments>> segment_buffer;
+    typedef std::vector<char, tracking_allocator<char, memory::stripes>> stripe_buffer;
+    typedef std::vector<char, tracking_allocator<char, memory::shares>> share_buffer;
+    typedef std::vector<char, tracking_allocator<char, memory::pieces>> piece_buffer;
+    typedef std::vector<char, tracking_allocator<char, memory::decode_scratch>> scratch_buffer;
+}
+
+#endif //STORJ_EMULATOR_MEMORY_H
@@ -0,0 +1,301 @@
+//
+// 进程内的计数器与延迟直方图
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "metrics.h"
+#include "trace.h"
+
+using namespace storj;
+
+void metrics::counter::add(long long n)
+{
+    value.fetch_add(n, std::memory_order_relaxed);
+}
+
+long long metrics::counter::get() const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+void metrics::counter::reset()
+{
+    value.store(0, std::memory_order_relaxed);
+}
+
+metrics::histogram::histogram(std::string name) : name(std::move(name))
+{
+    reset();
+}
+
+int metrics::histogram::bucket_of(long long value)
+{
+    if (value < (1 << sub_bits))
+    {
+        return value < 0 ? 0 : (int)value;
+    }
+    const int e = 63 - __builtin_clzll(value);
+    const int sub = (int)(value >> (e - sub_bits)) & ((1 << sub_bits) - 1);
+    return ((e - sub_bits + 1) << sub_bits) + sub;
+}
+
+/**
+ * 桶内的最大值
+ */
+long long metrics::histogram::bucket_upper(int bucket)
+{
+    if (bucket < (1 << sub_bits))
+    {
+        return bucket;
+    }
+    const int e = (bucket >> sub_bits) + sub_bits - 1;
+    const long long sub = bucket & ((1 << sub_bits) - 1);
+    const long long lower = ((1LL << sub_bits) + sub) << (e - sub_bits);
+    return lower + (1LL << (e - sub_bits)) - 1;
+}
+
+void metrics::histogram::record(long long value)
+{
+    counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    long long current = min.load(std::memory_order_relaxed);
+    while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+    current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+const std::string &metrics::histogram::get_name() const
+{
+    return name;
+}
+
+long long metrics::histogram::get_count() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+long long metrics::histogram::get_sum() const
+{
+    return sum.load(std::memory_order_relaxed);
+}
+
+long long metrics::histogram::get_min() const
+{
+    return get_count() == 0 ? 0 : min.load(std::memory_order_relaxed);
+}
+
+long long metrics::histogram::get_max() const
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+double metrics::histogram::mean() const
+{
+    const long long n = get_count();
+    return n == 0 ? 0 : (double)get_sum() / n;
+}
+
+/**
+ * @param q 分位数，0 ~ 1
+ * @return 该分位数所在桶的最大值，不超过记录到的最大值
+ */
+long long metrics::histogram::percentile(double q) const
+{
+    long long total = 0;
+    for (const auto &c : counts)
+    {
+        total += c.load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    const long long rank = std::max(1LL, (long long)(q * total + 0.5));
+    long long seen = 0;
+    for (int i = 0; i < buckets; i++)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return std::min(bucket_upper(i), get_max());
+        }
+    }
+    return get_max();
+}
+
+void metrics::histogram::reset()
+{
+    for (auto &c : counts)
+    {
+        c.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    min.store(LLONG_MAX, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @param detail 附加到 trace span 的信息，如节点 id
+ */
+metrics::scoped_timer::scoped_timer(histogram &h, std::string detail) : h(h), start(now_ns()), detail(std::move(detail))
+{}
+
+metrics::scoped_timer::~scoped_timer()
+{
+    const long long duration = now_ns() - start;
+    h.record(duration);
+    // 直方图不会被销毁，名字可以直接作为 span 的名字
+    if (trace::enabled())
+    {
+        trace::instance().record(h.get_name().c_str(), start, duration, std::move(detail));
+    }
+}
+
+metrics &metrics::instance()
+{
+    static metrics registry;
+    return registry;
+}
+
+long long metrics::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * 与 scoped_timer 相同，记录一段已经结束的时间
+ */
+void metrics::record_interval(histogram &h, long long start_ns, long long end_ns)
+{
+    h.record(end_ns - start_ns);
+    if (trace::enabled())
+    {
+        trace::instance().record(h.get_name().c_str(), start_ns, end_ns - start_ns);
+    }
+}
+
+/**
+ * 同名的计数器只创建一次，返回的引用一直有效
+ */
+metrics::counter &metrics::get_counter(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &c = counters[name];
+    if (c == nullptr)
+    {
+        c.reset(new counter());
+    }
+    return *c;
+}
+
+/**
+ * 同名的直方图只创建一次，返回的引用一直有效
+ */
+metrics::histogram &metrics::get_histogram(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &h = histograms[name];
+    if (h == nullptr)
+    {
+        h.reset(new histogram(name));
+    }
+    return *h;
+}
+
+/**
+ * {"counters": {名字: 值}, "histograms": {名字: {count, sum, min, max, mean, p50, p90, p99, p999}}}
+ */
+std::string metrics::to_json() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << "{\n  \"counters\": {";
+    const char *sep = "\n";
+    for (const auto &c : counters)
+    {
+        out << sep << "    \"" << c.first << "\": " << c.second->get();
+        sep = ",\n";
+    }
+    out << "\n  },\n  \"histograms\": {";
+    sep = "\n";
+    for (const auto &h : histograms)
+    {
+        const histogram &x = *h.second;
+        out << sep << "    \"" << h.first << "\": {\"count\": " << x.get_count() << ", \"sum\": " << x.get_sum()
+            << ", \"min\": " << x.get_min() << ", \"max\": " << x.get_max() << ", \"mean\": " << x.mean()
+            << ", \"p50\": " << x.percentile(0.5) << ", \"p90\": " << x.percentile(0.9)
+            << ", \"p99\": " << x.percentile(0.99) << ", \"p999\": " << x.percentile(0.999) << "}";
+        sep = ",\n";
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+}
+
+/**
+ * 每行一个指标，计数器的值写在 count 列
+ */
+std::string metrics::to_csv() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << "name,type,count,sum,min,max,mean,p50,p90,p99,p999\n";
+    for (const auto &c : counters)
+    {
+        out << c.first << ",counter," << c.second->get() << ",,,,,,,,\n";
+    }
+    for (const auto &h : histograms)
+    {
+        const histogram &x = *h.second;
+        out << h.first << ",histogram," << x.get_count() << "," << x.get_sum() << "," << x.get_min() << ","
+            << x.get_max() << "," << x.mean() << "," << x.percentile(0.5) << "," << x.percentile(0.9) << ","
+            << x.percentile(0.99) << "," << x.percentile(0.999) << "\n";
+    }
+    return out.str();
+}
+
+/**
+ * 输出全部指标，路径以 .csv 结尾时输出 CSV，否则输出 JSON
+ */
+bool metrics::dump(const std::string &path) const
+{
+    const bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    const std::string &content = csv ? to_csv() : to_json();
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        perror("Failed to dump metrics");
+        return false;
+    }
+    out << content;
+    return true;
+}
+
+/**
+ * 清零全部指标，已返回的引用仍然有效
+ */
+void metrics::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &c : counters)
+    {
+        c.second->reset();
+    }
+    for (auto &h : histograms)
+    {
+        h.second->reset();
+    }
+}
@@ -0,0 +1,106 @@
+//
+// 进程内的计数器与延迟直方图
+//
+
+#ifndef STORJ_EMULATOR_METRICS_H
+#define STORJ_EMULATOR_METRICS_H
+
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace storj
+{
+    /**
+     * 按名字注册的计数器与直方图，记录只做原子操作，不加锁也不做 IO；
+     * 需要时整体输出为 JSON 或 CSV。
+     * 热路径上用静态局部变量保存 get_counter() / get_histogram() 返回的引用，只在第一次查表
+     */
+    class metrics
+    {
+    public:
+        class counter
+        {
+            std::atomic<long long> value{0};
+
+        public:
+            void add(long long n = 1);
+            long long get() const;
+            void reset();
+        };
+
+        /**
+         * 对数线性分桶的直方图：小于 16 的值每个一个桶，
+         * 之后按最高位分组，每组再均分 16 个桶，相对误差不超过 1/16
+         */
+        class histogram
+        {
+            static const int sub_bits = 4;
+            static const int buckets = 64 << sub_bits;
+
+            const std::string name;
+            std::atomic<long long> counts[buckets];
+            std::atomic<long long> count{0};
+            std::atomic<long long> sum{0};
+            std::atomic<long long> min{0};
+            std::atomic<long long> max{0};
+
+            static int bucket_of(long long value);
+            static long long bucket_upper(int bucket);
+
+        public:
+            explicit histogram(std::string name = std::string());
+            histogram(const histogram &) = delete;
+            histogram &operator=(const histogram &) = delete;
+
+            void record(long long value);
+            const std::string &get_name() const;
+            long long get_count() const;
+            long long get_sum() const;
+            long long get_min() const;
+            long long get_max() const;
+            double mean() const;
+            long long percentile(double q) const;
+            void reset();
+        };
+
+        /**
+         * 作用域结束时把经过的时间 (ns) 记录到直方图，同时以直方图的名字记录一个 trace span
+         */
+        class scoped_timer
+        {
+            histogram &h;
+            const long long start;
+            std::string detail;
+
+        public:
+            explicit scoped_timer(histogram &h, std::string detail = std::string());
+            scoped_timer(const scoped_timer &) = delete;
+            scoped_timer &operator=(const scoped_timer &) = delete;
+            ~scoped_timer();
+        };
+
+    private:
+        mutable std::mutex mutex;
+        std::map<std::string, std::unique_ptr<counter>> counters;
+        std::map<std::string, std::unique_ptr<histogram>> histograms;
+
+    public:
+        static metrics &instance();
+        static long long now_ns();
+        static void record_interval(histogram &h, long long start_ns, long long end_ns);
+
+        counter &get_counter(const std::string &name);
+        histogram &get_histogram(const std::string &name);
+
+        std::string to_json() const;
+        std::string to_csv() const;
+        bool dump(const std::string &path) const;
+        void reset();
+    };
+}
+
+#endif //STORJ_EMULATOR_METRICS_H
@@ -1,31 +1,34 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#ifndef STORJ_EMULATOR_PIECE_H
-#define STORJ_EMULATOR_PIECE_H
-
-
-#include <string>
-#include <vector>
-
-#include <boost/uuid/uuid.hpp>
-
-#include "erasure_share.h"
-
-namespace storj
-{
-    struct piece
-    {
-        boost::uuids::uuid id;
-        boost::uuids::uuid storage_node_id;
-        int index;
-        boost::uuids::uuid segment_id;
-        std::vector<char> data;
-        std::vector<erasure_share> erasure_shares;
-
-        piece();
-    };
-}
-
-#endif //STORJ_EMULATOR_PIECE_H
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#ifndef STORJ_EMULATOR_PIECE_H
+#define STORJ_EMULATOR_PIECE_H
+
+
+#include <string>
+#include <vector>
+
+#include <boost/uuid/uuid.hpp>
+
+#include "erasure_share.h"
+#include "memory.h"
+
+namespace storj
+{
+    struct piece
+    {
+        boost::uuids::uuid id{};
+        boost::uuids::uuid storage_node_id{};
+        int index = 0;
+        boost::uuids::uuid segment_id{};
+        // 所属的 pieces 代数，与 segment.generation 相同时才对读取可见
+        int generation = 0;
+        piece_buffer data;
+        std::vector<erasure_share> erasure_shares;
+
+        piece();
+    };
+}
+
+#endif //STORJ_EMULATOR_PIECE_H
@@ -0,0 +1,94 @@
+//
+// 有界的修复优先队列
+//
+
+#include <iterator>
+
+#include "repair_queue.h"
+
+using namespace storj;
+
+/**
+ * @param capacity 最多保留的 segment 数，不大于 0 时不限容量
+ */
+repair_queue::repair_queue(int capacity) : capacity(capacity)
+{}
+
+/**
+ * 加入待修复的 segment，已在队列中的 segment 更新为更紧急的权重
+ * @return 是否进入队列
+ */
+bool repair_queue::push(const std::string &segment_id, double weight)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = weights.find(segment_id);
+        if (it != weights.end())
+        {
+            if (weight >= it->second)
+            {
+                return true;
+            }
+            entries.erase(std::make_pair(it->second, segment_id));
+            weights.erase(it);
+        }
+        if (capacity > 0 && entries.size() >= (size_t)capacity)
+        {
+            auto least = std::prev(entries.end());
+            if (weight >= least->first)
+            {
+                dropped_count++;
+                return false;
+            }
+            weights.erase(least->second);
+            entries.erase(least);
+            dropped_count++;
+        }
+        entries.emplace(weight, segment_id);
+        weights[segment_id] = weight;
+    }
+    cv.notify_one();
+    return true;
+}
+
+/**
+ * 取出最紧急的 segment，队列为空时等待
+ * @return 队列已关闭且为空时返回 false
+ */
+bool repair_queue::pop(std::string *segment_id)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !entries.empty() || closed; });
+    if (entries.empty())
+    {
+        return false;
+    }
+    *segment_id = entries.begin()->second;
+    weights.erase(*segment_id);
+    entries.erase(entries.begin());
+    return true;
+}
+
+/**
+ * 不再加入新的 segment，消费者取完剩余的后退出
+ */
+void repair_queue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    cv.notify_all();
+}
+
+int repair_queue::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+long repair_queue::dropped()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped_count;
+}
@@ -0,0 +1,49 @@
+//
+// 有界的修复优先队列
+//
+
+#ifndef STORJ_EMULATOR_REPAIR_QUEUE_H
+#define STORJ_EMULATOR_REPAIR_QUEUE_H
+
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace storj
+{
+    /**
+     * 扫描与修复之间的有界队列，只保留最紧急的 capacity 个 segments。
+     * 权重越小越紧急（见 data_manager::segment_weight），pop() 总是取出最紧急的；
+     * 队列已满时，新 segment 比队列中最不紧急的还不紧急则丢弃，否则挤出后者。
+     * 被丢弃的 segment 由下一轮扫描重新发现；capacity 不大于 0 时不限容量
+     */
+    class repair_queue
+    {
+    private:
+        const int capacity;
+        // (权重, segment id) 有序集合，两端分别是最紧急与最不紧急的
+        std::set<std::pair<double, std::string>> entries;
+        std::unordered_map<std::string, double> weights;
+        bool closed = false;
+        long dropped_count = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+    public:
+        explicit repair_queue(int capacity);
+        repair_queue(const repair_queue &) = delete;
+        repair_queue &operator=(const repair_queue &) = delete;
+
+        bool push(const std::string &segment_id, double weight);
+        bool pop(std::string *segment_id);
+        void close();
+        int size();
+        long dropped();
+    };
+}
+
+#endif //STORJ_EMULATOR_REPAIR_QUEUE_H
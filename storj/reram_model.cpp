@@ -0,0 +1,568 @@
+//
+// ReRAM crossbar 纠删码加速器的周期近似模型
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include "config.h"
+#include "reram_model.h"
+
+using namespace storj;
+
+reram_model::cost &reram_model::cost::operator+=(const cost &other)
+{
+    row_writes += other.row_writes;
+    tile_hits += other.tile_hits;
+    tile_misses += other.tile_misses;
+    row_reads += other.row_reads;
+    xors += other.xors;
+    bytes_moved += other.bytes_moved;
+    latency_ns += other.latency_ns;
+    energy_pj += other.energy_pj;
+    return *this;
+}
+
+reram_model::reram_model(const params &p) : p(p)
+{}
+
+/**
+ * 读取参数文件，每行一个 key = value，# 之后为注释，未出现的参数保持默认值
+ * @param path 参数文件路径，打开失败时全部使用默认值
+ */
+reram_model::params reram_model::load_params(const std::string &path)
+{
+    params res;
+    std::ifstream in(path);
+    if (!in)
+    {
+        perror("Failed to open reram params, using defaults");
+        return res;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        line = line.substr(0, line.find('#'));
+        const size_t eq = line.find('=');
+        if (eq == std::string::npos)
+        {
+            continue;
+        }
+        std::string key;
+        double value;
+        std::istringstream(line.substr(0, eq)) >> key;
+        if (!(std::istringstream(line.substr(eq + 1)) >> value))
+        {
+            printf("reram params: bad value for %s\n", key.c_str());
+            continue;
+        }
+        if (key == "crossbar_size")
+        {
+            res.crossbar_size = (int)value;
+        }
+        else if (key == "write_latency_ns")
+        {
+            res.write_latency_ns = value;
+        }
+        else if (key == "write_energy_pj")
+        {
+            res.write_energy_pj = value;
+        }
+        else if (key == "read_latency_ns")
+        {
+            res.read_latency_ns = value;
+        }
+        else if (key == "read_energy_pj")
+        {
+            res.read_energy_pj = value;
+        }
+        else if (key == "xor_latency_ns")
+        {
+            res.xor_latency_ns = value;
+        }
+        else if (key == "xor_energy_pj")
+        {
+            res.xor_energy_pj = value;
+        }
+        else if (key == "move_latency_ns")
+        {
+            res.move_latency_ns = value;
+        }
+        else if (key == "move_energy_pj")
+        {
+            res.move_energy_pj = value;
+        }
+        else if (key == "resident_tiles")
+        {
+            res.resident_tiles = (int)value;
+        }
+        else if (key == "parallel_tiles")
+        {
+            res.parallel_tiles = (int)value;
+        }
+        else
+        {
+            printf("reram params: unknown key %s\n", key.c_str());
+        }
+    }
+    if (res.crossbar_size <= 0)
+    {
+        printf("reram params: crossbar_size must be positive, using 512\n");
+        res.crossbar_size = 512;
+    }
+    if (res.parallel_tiles <= 0)
+    {
+        printf("reram params: parallel_tiles must be positive, using 1\n");
+        res.parallel_tiles = 1;
+    }
+    return res;
+}
+
+/**
+ * 所有 data processor 共用的模型，首次使用时读取 config::reram_param_file
+ */
+reram_model &reram_model::instance()
+{
+    static reram_model model(load_params(config::reram_param_file));
+    return model;
+}
+
+/**
+ * rows 行、cols 位宽的 bitmatrix 分成的块数，每块占一个 tile
+ */
+int reram_model::blocks(int rows, int cols) const
+{
+    return ((rows + p.crossbar_size - 1) / p.crossbar_size) * ((cols + p.crossbar_size - 1) / p.crossbar_size);
+}
+
+/**
+ * 把 rows 行、cols 位宽的 bitmatrix 写入 crossbar。
+ * 已常驻时不需要写入；否则写入空闲 tile，tile 不足时替换最久未使用的 bitmatrix，
+ * 超过全部常驻 tile 的 bitmatrix 不常驻
+ * @param key 标识 bitmatrix，相同的 key 对应相同的矩阵
+ * @return 是否已常驻，未常驻时调用方计入写入代价
+ */
+bool reram_model::program(const std::string &key, int rows, int cols)
+{
+    const int need = blocks(rows, cols);
+    if (p.resident_tiles <= 0 || need > p.resident_tiles)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = resident_index.find(key);
+    if (it != resident_index.end())
+    {
+        resident.splice(resident.begin(), resident, it->second);
+        return true;
+    }
+    while (resident_used + need > p.resident_tiles)
+    {
+        resident_used -= resident.back().second;
+        resident_index.erase(resident.back().first);
+        resident.pop_back();
+    }
+    resident.emplace_front(key, need);
+    resident_index[key] = resident.begin();
+    resident_used += need;
+    return false;
+}
+
+/**
+ * dst = rows * src，与 jerasure_bitmatrix_dotprod 的数据布局一致：
+ * 每 w * packetsize 字节为一组，组内第 i 行对应第 i 个 packet
+ * @param rows nrows * ncols 的 bitmatrix
+ * @param src ncols / w 个输入 erasure share
+ * @param dst nrows / w 个输出 erasure share
+ * @param size 每个 erasure share 的大小
+ */
+void reram_model::multiply(const std::vector<char> &rows, int nrows, int ncols, char **src, char **dst, int size,
+                           int packetsize) const
+{
+    const int w = 8;
+    for (int sindex = 0; sindex < size; sindex += packetsize * w)
+    {
+        for (int j = 0; j < nrows; j++)
+        {
+            char *pptr = dst[j / w] + sindex + (j % w) * packetsize;
+            memset(pptr, 0, packetsize);
+            for (int x = 0; x < ncols; x++)
+            {
+                if (!rows[(size_t)j * ncols + x])
+                {
+                    continue;
+                }
+                const char *bp = src[x / w] + sindex + (x % w) * packetsize;
+                for (int q = 0; q < packetsize; q++)
+                {
+                    pptr[q] ^= bp[q];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * 按最长任务优先分给当前负载最小的 tile
+ * @return 全部任务完成的时间
+ */
+double reram_model::makespan(std::vector<double> times, int tiles)
+{
+    std::sort(times.begin(), times.end(), std::greater<double>());
+    std::vector<double> load(std::max(tiles, 1), 0);
+    for (double t : times)
+    {
+        *std::min_element(load.begin(), load.end()) += t;
+    }
+    return *std::max_element(load.begin(), load.end());
+}
+
+/**
+ * 计算 dst = rows * src 的代价：
+ * <ol>
+ * <li> bitmatrix 按 crossbar 分块，每块负责若干输出行在一段输入上的部分异或积，全 0 的块不需要计算
+ * <li> 每块依次写入 bitmatrix（未常驻时）、读出这段输入、存内异或，各块调度到 tiles 个 tile 上并行
+ * <li> 同一输出行有多个部分结果时逐层两两异或归约，每层的归约同样并行，部分结果在 tile 之间搬运
+ * <li> 输入与输出经同一接口搬运，不并行
+ * </ol>
+ * 能耗按全部操作次数计算，与调度无关
+ * @param programmed bitmatrix 是否已常驻
+ * @param tiles 并行计算的 tile 数
+ */
+reram_model::cost reram_model::schedule(const std::vector<char> &rows, int nrows, int ncols, int size, int packetsize,
+                                        bool programmed, int tiles) const
+{
+    const int w = 8;
+    const int cs = p.crossbar_size;
+    cost c;
+    const long long chunks = (size + packetsize * w - 1) / (packetsize * w);
+    const long long share_rows = ((long long)size * 8 + cs - 1) / cs;
+    const long long packet_rows = ((long long)packetsize * 8 + cs - 1) / cs;
+    const int row_blocks = (nrows + cs - 1) / cs;
+    const int col_blocks = (ncols + cs - 1) / cs;
+
+    // 各块的部分异或积
+    std::vector<double> times;
+    std::vector<int> partials(row_blocks, 0);
+    for (int i = 0; i < row_blocks; i++)
+    {
+        const int r0 = i * cs;
+        const int r1 = std::min(nrows, r0 + cs);
+        for (int j = 0; j < col_blocks; j++)
+        {
+            const int c0 = j * cs;
+            const int c1 = std::min(ncols, c0 + cs);
+            long long xors = 0;
+            bool used = false;
+            for (int r = r0; r < r1; r++)
+            {
+                const int ones = std::count(rows.begin() + (size_t)r * ncols + c0, rows.begin() + (size_t)r * ncols + c1, 1);
+                used |= ones > 0;
+                // 第一个 packet 直接读出，其余每个 packet 一次存内异或
+                if (ones > 1)
+                {
+                    xors += (ones - 1) * chunks * packet_rows;
+                }
+            }
+            if (!used)
+            {
+                continue;
+            }
+            partials[i]++;
+            const long long writes = programmed ? 0 : r1 - r0;
+            const long long reads = (c1 - c0 + w - 1) / w * share_rows;
+            c.row_writes += writes;
+            c.row_reads += reads;
+            c.xors += xors;
+            times.push_back(writes * p.write_latency_ns + reads * p.read_latency_ns + xors * p.xor_latency_ns);
+        }
+    }
+    c.latency_ns = makespan(times, tiles);
+
+    // 归约树，每层把每个输出行块的部分结果两两异或
+    while (true)
+    {
+        times.clear();
+        for (int i = 0; i < row_blocks; i++)
+        {
+            const int r0 = i * cs;
+            const int r1 = std::min(nrows, r0 + cs);
+            for (int pair = 0; pair < partials[i] / 2; pair++)
+            {
+                const long long xors = (r1 - r0) * chunks * packet_rows;
+                const long long bytes = (long long)(r1 - r0 + w - 1) / w * size;
+                c.xors += xors;
+                c.bytes_moved += bytes;
+                times.push_back(xors * p.xor_latency_ns + bytes * p.move_latency_ns);
+            }
+            partials[i] -= partials[i] / 2;
+        }
+        if (times.empty())
+        {
+            break;
+        }
+        c.latency_ns += makespan(times, tiles);
+    }
+
+    const long long io = (long long)(ncols / w + nrows / w) * size;
+    c.bytes_moved += io;
+    c.latency_ns += io * p.move_latency_ns;
+    c.energy_pj = c.row_writes * p.write_energy_pj + c.row_reads * p.read_energy_pj +
+                  c.xors * p.xor_energy_pj + c.bytes_moved * p.move_energy_pj;
+    c.tile_hits = programmed ? 1 : 0;
+    c.tile_misses = programmed ? 0 : 1;
+    return c;
+}
+
+/**
+ * 与 jerasure_bitmatrix_encode 逐位一致的编码
+ * @param bitmatrix m * w 行、k * w 列的编码 bitmatrix
+ * @return 该 stripe 的代价
+ */
+reram_model::cost reram_model::encode(int k, int m, int w, const int *bitmatrix, char **data, char **coding, int size,
+                                      int packetsize)
+{
+    std::vector<char> rows(bitmatrix, bitmatrix + k * m * w * w);
+    const bool programmed = program("encode " + std::to_string(k) + " " + std::to_string(m), m * w, k * w);
+    multiply(rows, m * w, k * w, data, coding, size, packetsize);
+    return schedule(rows, m * w, k * w, size, packetsize, programmed, p.parallel_tiles);
+}
+
+/**
+ * 与 jerasure_bitmatrix_decode 逐位一致的解码：
+ * 取前 k 个未丢失的 erasure share 构成 k * w 阶方阵，在 GF(2) 上求逆得到丢失数据的解码行，
+ * 恢复数据后再用编码行重算丢失的校验。
+ * 两部分的行作为同一个解码矩阵常驻，按丢失模式区分
+ * @param erasures 丢失的 erasure share 下标，以 -1 结尾
+ * @return 该 stripe 的代价，丢失超过 m 个时不解码
+ */
+reram_model::cost reram_model::decode(int k, int m, int w, const int *bitmatrix, const int *erasures, char **data,
+                                      char **coding, int size, int packetsize)
+{
+    cost c;
+    std::vector<bool> erased(k + m, false);
+    int numerased = 0;
+    for (int i = 0; erasures[i] != -1; i++)
+    {
+        if (!erased[erasures[i]])
+        {
+            erased[erasures[i]] = true;
+            numerased++;
+        }
+    }
+    if (numerased > m)
+    {
+        return c;
+    }
+    const int kw = k * w;
+    auto device = [&](int i) { return i < k ? data[i] : coding[i - k]; };
+    std::string key = "decode " + std::to_string(k) + " " + std::to_string(m);
+    for (int i = 0; i < k + m; i++)
+    {
+        if (erased[i])
+        {
+            key += " " + std::to_string(i);
+        }
+    }
+    const bool programmed = program(key, numerased * w, kw);
+
+    std::vector<int> lost_data;
+    for (int i = 0; i < k; i++)
+    {
+        if (erased[i])
+        {
+            lost_data.push_back(i);
+        }
+    }
+    if (!lost_data.empty())
+    {
+        // 前 k 个未丢失的 erasure share 对应的行
+        std::vector<char *> src;
+        std::vector<char> mat((size_t)kw * kw, 0);
+        for (int i = 0; i < k + m && src.size() < k; i++)
+        {
+            if (erased[i])
+            {
+                continue;
+            }
+            const int t = src.size();
+            src.push_back(device(i));
+            for (int r = 0; r < w; r++)
+            {
+                char *row = mat.data() + (size_t)(t * w + r) * kw;
+                if (i < k)
+                {
+                    row[i * w + r] = 1;
+                }
+                else
+                {
+                    std::copy(bitmatrix + (size_t)((i - k) * w + r) * kw, bitmatrix + (size_t)((i - k) * w + r + 1) * kw, row);
+                }
+            }
+        }
+
+        // GF(2) 上的 Gauss-Jordan 消元
+        std::vector<char> inv((size_t)kw * kw, 0);
+        for (int i = 0; i < kw; i++)
+        {
+            inv[(size_t)i * kw + i] = 1;
+        }
+        for (int i = 0; i < kw; i++)
+        {
+            int j = i;
+            while (j < kw && mat[(size_t)j * kw + i] == 0)
+            {
+                j++;
+            }
+            if (j == kw)
+            {
+                return c;
+            }
+            if (j != i)
+            {
+                std::swap_ranges(mat.begin() + (size_t)i * kw, mat.begin() + (size_t)(i + 1) * kw, mat.begin() + (size_t)j * kw);
+                std::swap_ranges(inv.begin() + (size_t)i * kw, inv.begin() + (size_t)(i + 1) * kw, inv.begin() + (size_t)j * kw);
+            }
+            for (j = 0; j < kw; j++)
+            {
+                if (j == i || mat[(size_t)j * kw + i] == 0)
+                {
+                    continue;
+                }
+                for (int x = 0; x < kw; x++)
+                {
+                    mat[(size_t)j * kw + x] ^= mat[(size_t)i * kw + x];
+                    inv[(size_t)j * kw + x] ^= inv[(size_t)i * kw + x];
+                }
+            }
+        }
+
+        std::vector<char> rows;
+        std::vector<char *> dst;
+        for (int d : lost_data)
+        {
+            rows.insert(rows.end(), inv.begin() + (size_t)d * w * kw, inv.begin() + (size_t)(d + 1) * w * kw);
+            dst.push_back(data[d]);
+        }
+        multiply(rows, dst.size() * w, kw, src.data(), dst.data(), size, packetsize);
+        c += schedule(rows, dst.size() * w, kw, size, packetsize, programmed, p.parallel_tiles);
+    }
+
+    std::vector<char> rows;
+    std::vector<char *> dst;
+    for (int i = 0; i < m; i++)
+    {
+        if (erased[k + i])
+        {
+            rows.insert(rows.end(), bitmatrix + (size_t)i * w * kw, bitmatrix + (size_t)(i + 1) * w * kw);
+            dst.push_back(coding[i]);
+        }
+    }
+    if (!dst.empty())
+    {
+        multiply(rows, dst.size() * w, kw, data, dst.data(), size, packetsize);
+        c += schedule(rows, dst.size() * w, kw, size, packetsize, programmed, p.parallel_tiles);
+    }
+    // 两部分同属一个解码矩阵
+    c.tile_hits = programmed ? 1 : 0;
+    c.tile_misses = programmed ? 0 : 1;
+    return c;
+}
+
+void reram_model::record_encode(const cost &c, long cpu_ns)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    encoded.stripes++;
+    encoded.cpu_ns += cpu_ns;
+    encoded.model += c;
+}
+
+void reram_model::record_decode(const cost &c, long cpu_ns)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    decoded.stripes++;
+    decoded.cpu_ns += cpu_ns;
+    decoded.model += c;
+}
+
+reram_model::totals reram_model::encode_totals() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return encoded;
+}
+
+reram_model::totals reram_model::decode_totals() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return decoded;
+}
+
+/**
+ * 输出累计的模型代价与 Jerasure 实测时间
+ */
+void reram_model::report() const
+{
+    const totals &e = encode_totals();
+    const totals &d = decode_totals();
+    const char *names[] = {"encode", "decode"};
+    const totals *all[] = {&e, &d};
+    for (int i = 0; i < 2; i++)
+    {
+        const totals &t = *all[i];
+        printf("reram %s: %lld stripes, jerasure cpu %.3f ms, model latency %.3f ms, energy %.3f uJ, "
+               "row writes %lld, row reads %lld, xors %lld, bytes moved %lld\n",
+               names[i], t.stripes, t.cpu_ns / 1e6, t.model.latency_ns / 1e6, t.model.energy_pj / 1e6,
+               t.model.row_writes, t.model.row_reads, t.model.xors, t.model.bytes_moved);
+        const long long programs = t.model.tile_hits + t.model.tile_misses;
+        printf("reram %s tiles: hit rate %.2f%% (%lld hits, %lld misses)\n",
+               names[i], programs == 0 ? 0.0 : 100.0 * t.model.tile_hits / programs, t.model.tile_hits, t.model.tile_misses);
+    }
+    printf("reram tiles: %d resident of %d\n", resident_count(), p.resident_tiles);
+}
+
+/**
+ * 单个 stripe 编码的有效吞吐随并行 tile 数的变化，tile 数从 1 倍增到 max_tiles 或不少于块数
+ * @param size 每个 erasure share 的大小
+ */
+void reram_model::scaling_report(int k, int m, int w, const int *bitmatrix, int size, int packetsize, int max_tiles) const
+{
+    std::vector<char> rows(bitmatrix, bitmatrix + k * m * w * w);
+    printf("reram scaling: k %d, m %d, bitmatrix %d x %d in %d blocks, erasure share %d bytes\n",
+           k, m, m * w, k * w, blocks(m * w, k * w), size);
+    double base = 0;
+    for (int tiles = 1; tiles <= max_tiles; tiles *= 2)
+    {
+        const cost &warm = schedule(rows, m * w, k * w, size, packetsize, true, tiles);
+        const cost &cold = schedule(rows, m * w, k * w, size, packetsize, false, tiles);
+        if (tiles == 1)
+        {
+            base = warm.latency_ns;
+        }
+        // 每 ns 的字节数即 GB/s，换算为 MB/s
+        printf("reram scaling: %d tiles, resident %.0f ns %.2f MB/s (speedup %.2f), reprogrammed %.0f ns %.2f MB/s\n",
+               tiles, warm.latency_ns, (double)k * size / warm.latency_ns * 1e9 / 1024 / 1024, base / warm.latency_ns,
+               cold.latency_ns, (double)k * size / cold.latency_ns * 1e9 / 1024 / 1024);
+        // 每块一个 tile 之后不再有可并行的块
+        if (tiles >= blocks(m * w, k * w))
+        {
+            break;
+        }
+    }
+}
+
+int reram_model::resident_count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident.size();
+}
+
+void reram_model::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    encoded = totals();
+    decoded = totals();
+}
@@ -0,0 +1,122 @@
+//
+// ReRAM crossbar 纠删码加速器的周期近似模型
+//
+
+#ifndef STORJ_EMULATOR_RERAM_MODEL_H
+#define STORJ_EMULATOR_RERAM_MODEL_H
+
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace storj
+{
+    /**
+     * 在软件中按 bitmatrix 逐 packet 异或完成编解码，结果与 Jerasure 逐位一致；
+     * 同时按 crossbar 的操作统计代价：
+     * <ol>
+     * <li> 写入 bitmatrix：每行按 crossbar 宽度分段写入
+     * <li> 读取：输入的 erasure share 按 crossbar 宽度逐行读出
+     * <li> 存内异或：每个 packet 的异或按 crossbar 宽度计次
+     * <li> 数据搬运：输入与输出 erasure share 的字节数
+     * </ol>
+     * 各项的延迟与能耗来自参数文件。
+     * 编码矩阵与常见丢失模式的解码矩阵常驻在有限个 crossbar tile 中，按 LRU 替换，
+     * 只有未命中时才计入写入 bitmatrix 的代价。
+     * 超过一个 crossbar 的 bitmatrix 按 crossbar_size × crossbar_size 分块，各块的部分异或积调度到多个 tile 上并行计算，
+     * 同一输出行的部分结果再按归约树两两异或
+     */
+    class reram_model
+    {
+    public:
+        struct params
+        {
+            // crossbar 一行的位数
+            int crossbar_size = 512;
+            // 写入一行，data_processor 中的估算为 1 ms
+            double write_latency_ns = 1000000;
+            double write_energy_pj = 1024;
+            // 读出一行
+            double read_latency_ns = 100;
+            double read_energy_pj = 51.2;
+            // 一行宽度的存内异或
+            double xor_latency_ns = 100;
+            double xor_energy_pj = 76.8;
+            // 每字节的数据搬运
+            double move_latency_ns = 0.1;
+            double move_energy_pj = 8;
+            // 常驻 bitmatrix 的 tile 数，每个 tile 存放 bitmatrix 的一块；0 表示每个 stripe 都重新写入
+            int resident_tiles = 4;
+            // 并行计算的 tile 数
+            int parallel_tiles = 1;
+        };
+
+        struct cost
+        {
+            long long row_writes = 0;
+            long long row_reads = 0;
+            long long xors = 0;
+            long long bytes_moved = 0;
+            // bitmatrix 是否已常驻
+            long long tile_hits = 0;
+            long long tile_misses = 0;
+            double latency_ns = 0;
+            double energy_pj = 0;
+
+            cost &operator+=(const cost &other);
+        };
+
+        struct totals
+        {
+            long long stripes = 0;
+            // 同一批 stripe 上 Jerasure 实测的 CPU 时间
+            long long cpu_ns = 0;
+            cost model;
+        };
+
+    private:
+        const params p;
+        mutable std::mutex mutex;
+        totals encoded;
+        totals decoded;
+        // 常驻的 bitmatrix 及其占用的 tile 数，表头最近使用
+        std::list<std::pair<std::string, int>> resident;
+        std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> resident_index;
+        int resident_used = 0;
+
+        int blocks(int rows, int cols) const;
+        bool program(const std::string &key, int rows, int cols);
+        void multiply(const std::vector<char> &rows, int nrows, int ncols, char **src, char **dst, int size, int packetsize) const;
+        cost schedule(const std::vector<char> &rows, int nrows, int ncols, int size, int packetsize, bool programmed, int tiles) const;
+        static double makespan(std::vector<double> times, int tiles);
+
+    public:
+        explicit reram_model(const params &p);
+        reram_model(const reram_model &) = delete;
+        reram_model &operator=(const reram_model &) = delete;
+
+        static params load_params(const std::string &path);
+        static reram_model &instance();
+
+        const params &get_params() const {
+            return p;
+        }
+
+        cost encode(int k, int m, int w, const int *bitmatrix, char **data, char **coding, int size, int packetsize);
+        cost decode(int k, int m, int w, const int *bitmatrix, const int *erasures, char **data, char **coding, int size, int packetsize);
+
+        void record_encode(const cost &c, long cpu_ns);
+        void record_decode(const cost &c, long cpu_ns);
+        totals encode_totals() const;
+        totals decode_totals() const;
+        int resident_count() const;
+        void report() const;
+        void scaling_report(int k, int m, int w, const int *bitmatrix, int size, int packetsize, int max_tiles) const;
+        void reset();
+    };
+}
+
+#endif //STORJ_EMULATOR_RERAM_MODEL_H
@@ -0,0 +1,80 @@
+//
+// 按节点抽样审计的统计
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "sampling_auditor.h"
+
+using namespace storj;
+
+/**
+ * @param threshold 可容忍的丢失率，置信下界超过该值时升级为全量审计
+ * @param z 置信水平对应的正态分位数，1.96 为 95%
+ */
+sampling_auditor::sampling_auditor(double threshold, double z) : threshold(threshold), z(z)
+{}
+
+void sampling_auditor::record(const std::string &node_id, bool ok)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    node_stats &stats = nodes[node_id];
+    stats.audited++;
+    if (!ok)
+    {
+        stats.failed++;
+    }
+}
+
+sampling_auditor::estimate sampling_auditor::get_estimate(const std::string &node_id) const
+{
+    estimate res;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = nodes.find(node_id);
+        if (it != nodes.end())
+        {
+            res.audited = it->second.audited;
+            res.failed = it->second.failed;
+        }
+    }
+    wilson_interval(res.failed, res.audited, z, &res.lower, &res.upper);
+    return res;
+}
+
+bool sampling_auditor::should_escalate(const std::string &node_id) const
+{
+    return get_estimate(node_id).lower > threshold;
+}
+
+/**
+ * 全量审计之后重新开始统计
+ */
+void sampling_auditor::reset(const std::string &node_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nodes.erase(node_id);
+}
+
+/**
+ * 二项比例的 Wilson 置信区间，样本很少或比例接近 0、1 时仍然可靠
+ * @param failed 失败次数
+ * @param audited 审计次数，为 0 时区间为 [0, 1]
+ */
+void sampling_auditor::wilson_interval(long failed, long audited, double z, double *lower, double *upper)
+{
+    if (audited == 0)
+    {
+        *lower = 0;
+        *upper = 1;
+        return;
+    }
+    const double n = audited;
+    const double p = failed / n;
+    const double z2 = z * z;
+    const double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+    const double margin = z * std::sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+    *lower = std::max(0.0, center - margin);
+    *upper = std::min(1.0, center + margin);
+}
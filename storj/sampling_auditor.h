@@ -0,0 +1,57 @@
+//
+// 按节点抽样审计的统计
+//
+
+#ifndef STORJ_EMULATOR_SAMPLING_AUDITOR_H
+#define STORJ_EMULATOR_SAMPLING_AUDITOR_H
+
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace storj
+{
+    /**
+     * 记录每个节点抽样审计的结果，用 Wilson 区间估计节点丢失 piece 的比例。
+     * 丢失率的置信下界超过阈值时，即有足够把握认为节点已损坏，升级为对该节点的全量审计
+     */
+    class sampling_auditor
+    {
+    public:
+        struct estimate
+        {
+            long audited = 0;
+            long failed = 0;
+            // 丢失率的置信区间
+            double lower = 0;
+            double upper = 1;
+        };
+
+    private:
+        struct node_stats
+        {
+            long audited = 0;
+            long failed = 0;
+        };
+
+        const double threshold;
+        const double z;
+        std::unordered_map<std::string, node_stats> nodes;
+        mutable std::mutex mutex;
+
+    public:
+        sampling_auditor(double threshold, double z);
+        sampling_auditor(const sampling_auditor &) = delete;
+        sampling_auditor &operator=(const sampling_auditor &) = delete;
+
+        void record(const std::string &node_id, bool ok);
+        estimate get_estimate(const std::string &node_id) const;
+        bool should_escalate(const std::string &node_id) const;
+        void reset(const std::string &node_id);
+
+        static void wilson_interval(long failed, long audited, double z, double *lower, double *upper);
+    };
+}
+
+#endif //STORJ_EMULATOR_SAMPLING_AUDITOR_H
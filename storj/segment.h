@@ -1,27 +1,33 @@
-//
-// Created by ousing9 on 2022/3/9.
-//
-
-#ifndef STORJ_EMULATOR_SEGMENT_H
-#define STORJ_EMULATOR_SEGMENT_H
-
-
-#include <vector>
-
-#include <boost/uuid/uuid.hpp>
-
-namespace storj
-{
-    struct segment
-    {
-        boost::uuids::uuid id;
-        boost::uuids::uuid file_id;
-        int index;
-        std::vector<char> data;
-
-        segment();
-        segment(std::vector<char> data);
-    };
-}
-
-#endif //STORJ_EMULATOR_SEGMENT_H
+//
+// Created by ousing9 on 2022/3/9.
+//
+
+#ifndef STORJ_EMULATOR_SEGMENT_H
+#define STORJ_EMULATOR_SEGMENT_H
+
+
+#include <vector>
+
+#include <boost/uuid/uuid.hpp>
+
+#include "memory.h"
+
+namespace storj
+{
+    struct segment
+    {
+        boost::uuids::uuid id;
+        boost::uuids::uuid file_id;
+        int index;
+        // 实际数据长度，最后一个 segment 不补 0
+        int length = 0;
+        // 当前生效的 pieces 代数，每次修复发布新一代后加一
+        int generation = 0;
+        segment_buffer data;
+
+        segment();
+        segment(segment_buffer data);
+    };
+}
+
+#endif //STORJ_EMULATOR_SEGMENT_H
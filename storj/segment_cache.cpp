@@ -0,0 +1,103 @@
+//
+// 解码后的 segment 缓存
+//
+
+#include "metrics.h"
+#include "segment_cache.h"
+
+using namespace storj;
+
+segment_cache::segment_cache(long long capacity) : capacity(capacity)
+{}
+
+void segment_cache::evict(std::list<entry>::iterator it)
+{
+    size -= it->second->size();
+    index.erase(it->first);
+    lru.erase(it);
+}
+
+/**
+ * 查询缓存，命中时移到 LRU 链表头部
+ * @param segment_id segment id
+ * @param bytes_served 命中时实际返回给调用方的字节数（如范围读取的长度），小于 0 时按整个 segment 计
+ * @return 解码后的 segment 数据，未命中时为空
+ */
+std::shared_ptr<const segment_buffer> segment_cache::get(const std::string &segment_id, long long bytes_served)
+{
+    static metrics::counter &hits = metrics::instance().get_counter("cache.hits");
+    static metrics::counter &misses = metrics::instance().get_counter("cache.misses");
+    static metrics::counter &bytes_saved = metrics::instance().get_counter("cache.bytes_saved");
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(segment_id);
+    if (it == index.end())
+    {
+        counters.misses++;
+        misses.add();
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    const long long saved = bytes_served < 0 ? (long long)it->second->second->size() : bytes_served;
+    counters.hits++;
+    counters.bytes_saved += saved;
+    hits.add();
+    bytes_saved.add(saved);
+    return it->second->second;
+}
+
+/**
+ * 加入缓存，超出容量时从 LRU 链表尾部淘汰；大于总容量的 segment 不缓存
+ * @param segment_id segment id
+ * @param data 解码后的 segment 数据
+ */
+void segment_cache::put(const std::string &segment_id, std::shared_ptr<const segment_buffer> data)
+{
+    if (data == nullptr || (long long)data->size() > capacity)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(segment_id);
+    if (it != index.end())
+    {
+        evict(it->second);
+    }
+    while (!lru.empty() && size + (long long)data->size() > capacity)
+    {
+        evict(std::prev(lru.end()));
+    }
+    size += data->size();
+    lru.emplace_front(segment_id, std::move(data));
+    index[segment_id] = lru.begin();
+}
+
+/**
+ * segment 的 pieces 被修复或删除后调用
+ * @param segment_id segment id
+ */
+void segment_cache::invalidate(const std::string &segment_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(segment_id);
+    if (it != index.end())
+    {
+        evict(it->second);
+    }
+}
+
+void segment_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    size = 0;
+}
+
+segment_cache::stats segment_cache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats res = counters;
+    res.bytes = size;
+    res.entries = lru.size();
+    return res;
+}
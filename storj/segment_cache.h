@@ -0,0 +1,63 @@
+//
+// 解码后的 segment 缓存
+//
+
+#ifndef STORJ_EMULATOR_SEGMENT_CACHE_H
+#define STORJ_EMULATOR_SEGMENT_CACHE_H
+
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.h"
+
+namespace storj
+{
+    /**
+     * 以 segment id 为 key、按字节数限制容量的 LRU 缓存，可被多个读线程并发访问。
+     * 命中、未命中与节省的读取字节数同时记到 metrics 的 cache.hits、cache.misses、cache.bytes_saved 计数器
+     */
+    class segment_cache
+    {
+    public:
+        struct stats
+        {
+            long long hits = 0;
+            long long misses = 0;
+            long long bytes_saved = 0;
+            long long bytes = 0;
+            long long entries = 0;
+
+            double hit_rate() const {
+                return hits + misses == 0 ? 0 : (double)hits / (hits + misses);
+            }
+        };
+
+    private:
+        typedef std::pair<std::string, std::shared_ptr<const segment_buffer>> entry;
+
+        long long capacity;
+        long long size = 0;
+        std::list<entry> lru;
+        std::unordered_map<std::string, std::list<entry>::iterator> index;
+        stats counters;
+        mutable std::mutex mutex;
+
+        void evict(std::list<entry>::iterator it);
+
+    public:
+        explicit segment_cache(long long capacity);
+
+        std::shared_ptr<const segment_buffer> get(const std::string &segment_id, long long bytes_served = -1);
+        void put(const std::string &segment_id, std::shared_ptr<const segment_buffer> data);
+        void invalidate(const std::string &segment_id);
+        void clear();
+        stats get_stats() const;
+    };
+}
+
+#endif //STORJ_EMULATOR_SEGMENT_CACHE_H
@@ -0,0 +1,70 @@
+//
+// SQLite 只读连接池
+//
+
+#include <cstdio>
+
+#include "sqlite_pool.h"
+
+using namespace storj;
+
+sqlite_pool::connection::connection(sqlite_pool *pool, sqlite3 *db) : pool(pool), db(db)
+{}
+
+sqlite_pool::connection::connection(connection &&other) noexcept : pool(other.pool), db(other.db)
+{
+    other.pool = nullptr;
+    other.db = nullptr;
+}
+
+sqlite_pool::connection::~connection()
+{
+    if (pool != nullptr && db != nullptr)
+    {
+        pool->release(db);
+    }
+}
+
+sqlite_pool::sqlite_pool(std::string path, int size) : path(std::move(path)), size(size)
+{}
+
+sqlite_pool::~sqlite_pool()
+{
+    for (sqlite3 *db : idle)
+    {
+        sqlite3_close_v2(db);
+    }
+}
+
+sqlite_pool::connection sqlite_pool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty())
+        {
+            sqlite3 *db = idle.back();
+            idle.pop_back();
+            return connection(this, db);
+        }
+    }
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+    {
+        printf("sqlite pool: Failed to open %s: %s\n", path.c_str(), sqlite3_errmsg(db));
+    }
+    sqlite3_busy_timeout(db, 5000);
+    return connection(this, db);
+}
+
+void sqlite_pool::release(sqlite3 *db)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < size)
+        {
+            idle.push_back(db);
+            return;
+        }
+    }
+    sqlite3_close_v2(db);
+}
@@ -0,0 +1,62 @@
+//
+// SQLite 只读连接池
+//
+
+#ifndef STORJ_EMULATOR_SQLITE_POOL_H
+#define STORJ_EMULATOR_SQLITE_POOL_H
+
+
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+namespace storj
+{
+    /**
+     * 按需打开的只读连接，借出的连接用完后归还，空闲连接最多保留 size 个。
+     * 连接池耗尽时直接打开新连接而不是等待，避免同一线程嵌套借用时死锁
+     */
+    class sqlite_pool
+    {
+    public:
+        /**
+         * 借出的连接，析构时归还；pool 为空时表示借用的是写连接，不归还
+         */
+        class connection
+        {
+        private:
+            sqlite_pool *pool;
+            sqlite3 *db;
+
+        public:
+            connection(sqlite_pool *pool, sqlite3 *db);
+            connection(connection &&other) noexcept;
+            connection(const connection &) = delete;
+            connection &operator=(const connection &) = delete;
+            virtual ~connection();
+
+            operator sqlite3 *() const {
+                return db;
+            }
+        };
+
+    private:
+        std::string path;
+        int size;
+        std::vector<sqlite3 *> idle;
+        std::mutex mutex;
+
+        void release(sqlite3 *db);
+
+    public:
+        sqlite_pool(std::string path, int size);
+        virtual ~sqlite_pool();
+        sqlite_pool(const sqlite_pool &) = delete;
+        sqlite_pool &operator=(const sqlite_pool &) = delete;
+
+        connection acquire();
+    };
+}
+
+#endif //STORJ_EMULATOR_SQLITE_POOL_H
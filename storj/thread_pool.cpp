@@ -0,0 +1,67 @@
+//
+// 固定线程数的任务池
+//
+
+#include "memory.h"
+#include "thread_pool.h"
+
+using namespace storj;
+
+thread_pool::thread_pool(int threads)
+{
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&thread_pool::work, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+    // 任务中分配的缓冲区记到提交线程所在的操作上
+    const std::shared_ptr<memory::usage> &op = memory::current_operation();
+    if (op != nullptr)
+    {
+        task = [op, task = std::move(task)]
+        {
+            memory::bind bind(op);
+            task();
+        };
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+void thread_pool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stop || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
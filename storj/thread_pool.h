@@ -0,0 +1,42 @@
+//
+// 固定线程数的任务池
+//
+
+#ifndef STORJ_EMULATOR_THREAD_POOL_H
+#define STORJ_EMULATOR_THREAD_POOL_H
+
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace storj
+{
+    /**
+     * 任务按提交顺序由固定数量的工作线程执行，析构时执行完剩余任务后退出
+     */
+    class thread_pool
+    {
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stop = false;
+
+        void work();
+
+    public:
+        explicit thread_pool(int threads);
+        virtual ~thread_pool();
+        thread_pool(const thread_pool &) = delete;
+        thread_pool &operator=(const thread_pool &) = delete;
+
+        void submit(std::function<void()> task);
+    };
+}
+
+#endif //STORJ_EMULATOR_THREAD_POOL_H
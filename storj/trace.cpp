@@ -0,0 +1,184 @@
+//
+// Chrome trace-event 格式的时间线
+//
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "config.h"
+#include "metrics.h"
+#include "trace.h"
+
+using namespace storj;
+
+trace::span::span(const char *name, std::string detail) : name(name), start(metrics::now_ns()), detail(std::move(detail))
+{}
+
+trace::span::~span()
+{
+    if (enabled())
+    {
+        instance().record(name, start, metrics::now_ns() - start, std::move(detail));
+    }
+}
+
+trace &trace::instance()
+{
+    static trace registry;
+    return registry;
+}
+
+bool trace::enabled()
+{
+    return config::trace_spans;
+}
+
+/**
+ * 当前线程的缓冲区，第一次使用时注册；线程退出后缓冲区仍由 trace 持有，直到输出
+ */
+trace::buffer &trace::local()
+{
+    thread_local std::shared_ptr<buffer> local;
+    if (local == nullptr)
+    {
+        local = std::make_shared<buffer>();
+        std::lock_guard<std::mutex> lock(mutex);
+        local->tid = buffers.size() + 1;
+        buffers.push_back(local);
+    }
+    return *local;
+}
+
+/**
+ * @param name 静态字符串或生命周期不短于 trace 的字符串
+ * @param detail 附加信息，如节点 id，输出到 args
+ */
+void trace::record(const char *name, long long start_ns, long long duration_ns, std::string detail)
+{
+    buffer &b = local();
+    std::lock_guard<std::mutex> lock(b.mutex);
+    if (b.events.size() >= max_events_per_thread)
+    {
+        b.dropped++;
+        return;
+    }
+    b.events.push_back(event{name, start_ns, duration_ns, std::move(detail)});
+}
+
+long long trace::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    long long res = 0;
+    for (const auto &b : buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(b->mutex);
+        res += b->events.size();
+    }
+    return res;
+}
+
+long long trace::dropped()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    long long res = 0;
+    for (const auto &b : buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(b->mutex);
+        res += b->dropped;
+    }
+    return res;
+}
+
+/**
+ * 按名字前缀归类，便于在时间线中筛选
+ */
+static const char *category_of(const char *name)
+{
+    if (strncmp(name, "db.", 3) == 0)
+    {
+        return "sqlite";
+    }
+    if (strncmp(name, "piece_", 6) == 0)
+    {
+        return "io";
+    }
+    if (strncmp(name, "memory.", 7) == 0)
+    {
+        return "memory";
+    }
+    if (strncmp(name, "repair", 6) == 0)
+    {
+        return "repair";
+    }
+    if (strncmp(name, "upload", 6) == 0 || strncmp(name, "download", 8) == 0 || strncmp(name, "segment_", 8) == 0)
+    {
+        return "pipeline";
+    }
+    return "codec";
+}
+
+static void write_escaped(std::ofstream &out, const std::string &s)
+{
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\';
+        }
+        out << c;
+    }
+}
+
+/**
+ * 输出全部 span 为 complete event (ph = X)，时间单位为 us
+ */
+bool trace::dump(const std::string &path)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        perror("Failed to dump trace");
+        return false;
+    }
+    out.precision(3);
+    out << std::fixed << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    const char *sep = "\n";
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &b : buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(b->mutex);
+        out << sep << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+            << ", \"args\": {\"name\": \"thread " << b->tid << "\"}}";
+        sep = ",\n";
+        for (const auto &e : b->events)
+        {
+            out << sep << "{\"name\": \"" << e.name << "\", \"cat\": \"" << category_of(e.name)
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid << ", \"ts\": " << e.start_ns / 1000.0
+                << ", \"dur\": " << e.duration_ns / 1000.0;
+            if (!e.detail.empty())
+            {
+                out << ", \"args\": {\"detail\": \"";
+                write_escaped(out, e.detail);
+                out << "\"}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    return true;
+}
+
+/**
+ * 丢弃已记录的 span，缓冲区保留给各线程继续使用
+ */
+void trace::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &b : buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(b->mutex);
+        b->events.clear();
+        b->dropped = 0;
+    }
+}
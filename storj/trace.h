@@ -0,0 +1,76 @@
+//
+// Chrome trace-event 格式的时间线
+//
+
+#ifndef STORJ_EMULATOR_TRACE_H
+#define STORJ_EMULATOR_TRACE_H
+
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace storj
+{
+    /**
+     * 记录各阶段的起止时间，输出为 Chrome trace-event JSON，可用 chrome://tracing 或 Perfetto 打开。
+     * 每个线程写自己的缓冲区，只在输出时与其他线程同步；缓冲区满后丢弃新的 span 并计数
+     */
+    class trace
+    {
+    public:
+        struct event
+        {
+            const char *name;
+            long long start_ns;
+            long long duration_ns;
+            std::string detail;
+        };
+
+        /**
+         * 作用域内为一个 span
+         */
+        class span
+        {
+            const char *name;
+            const long long start;
+            std::string detail;
+
+        public:
+            explicit span(const char *name, std::string detail = std::string());
+            span(const span &) = delete;
+            span &operator=(const span &) = delete;
+            ~span();
+        };
+
+    private:
+        struct buffer
+        {
+            int tid;
+            std::mutex mutex;
+            std::vector<event> events;
+            long long dropped = 0;
+        };
+
+        std::mutex mutex;
+        std::vector<std::shared_ptr<buffer>> buffers;
+
+        buffer &local();
+
+    public:
+        // 每个线程最多缓存的 span 数
+        static const int max_events_per_thread = 1 << 18;
+
+        static trace &instance();
+        static bool enabled();
+
+        void record(const char *name, long long start_ns, long long duration_ns, std::string detail = std::string());
+        long long size();
+        long long dropped();
+        bool dump(const std::string &path);
+        void clear();
+    };
+}
+
+#endif //STORJ_EMULATOR_TRACE_H
@@ -11,12 +11,33 @@
 #include <sstream>
 
 #include "storj/data_processor.h"
+#include "storj/metrics.h"
+#include "storj/trace.h"
 
 const std::string &FILENAME_IN = "datatest_2.txt";
 const std::string &FILENAME_OUT = "datatest_3.txt";
 
 storj::data_manager *manager = new storj::data_manager();
 bool running = true;
+int scan_round = 0;
+
+/**
+ * 每轮输出一个 trace 文件（trace_scan_<轮次>.json）后清空，长时间运行的扫描不累积 spans，
+ * 也不会因为超出每个线程的上限而丢弃后面轮次的 spans
+ */
+void dump_trace()
+{
+    if (!storj::config::trace_spans)
+    {
+        return;
+    }
+    std::string path = storj::config::trace_file;
+    const size_t dot = path.rfind('.');
+    path.insert(dot == std::string::npos ? path.size() : dot, "_" + std::to_string(scan_round));
+    storj::trace::instance().dump(path);
+    std::cout << "trace: " << path << ", " << storj::trace::instance().dropped() << " spans dropped" << std::endl;
+    storj::trace::instance().clear();
+}
 
 // int Find_erasure_size()
 // {
@@ -62,52 +83,19 @@ void thread_scanner_func()
     while (running)
     {
         std::cout << "new loop !\n";
-        // 扫描出需要修复的 segments
-        std::tuple<std::vector<std::string>, std::vector<int>, std::vector<int>, std::unordered_map<std::string, int>> tuple = manager->scan_corrupted_segments();
-        std::vector<std::string> &segment_ids = std::get<0>(tuple);
-        std::vector<int> &ks = std::get<1>(tuple);
-        std::vector<int> &rs = std::get<2>(tuple);
-        std::unordered_map<std::string, int> &corrupted_segmetn_size = std::get<3>(tuple);
-        // segments 排序
-        storj::data_manager::sort_segments(segment_ids, ks, rs);
-        //修复 segments
-        std::cout << "scan the segment size is : " << segment_ids.size() << std::endl;
-        if (segment_ids.size() == 0)
+        scan_round++;
+        // 先抽样审计每个节点，只全量审计估计丢失率超过阈值的节点；
+        // 发现的损坏 segments 进入有界的修复队列，按紧急程度修复，不等审计完
+        const int repaired = manager->sample_and_repair(1024, [](const std::string &segment_id)
+                                                        { std::cout << "this segment is repaired : " << segment_id << std::endl; });
+        std::cout << "repaired segment num : " << repaired << std::endl;
+        if (repaired == 0)
         {
             break;
         }
-        // for (const auto &segment_id: segment_ids) {
-        //     manager->repair_segment(segment_id);
-        //  }
-        //打印需要的semgents ->
-        for (const auto &one_segment : segment_ids)
-        {
-            std::cout << "this segment must be repair : " << one_segment << std::endl;
-            //  clock_t start,stop;
-            // double duration;
-            // start=clock();
-
-            std::ofstream mycout("test_data.txt", std::ios::app);
-            auto iter = corrupted_segmetn_size.begin();
-            while (iter != corrupted_segmetn_size.end())
-            {
-                mycout << "file & corrupted size" << iter->first << "," << iter->second << std::endl;
-                ++iter;
-            }
-
-            manager->repair_segment(one_segment);
-            //    stop=clock();
-            //    duration=((double)(stop-start))/CLOCK_TAI;
-            //    std::cout<<"!time:"<<duration<<std::endl;
-
-            // std::ofstream mycout("test_data.txt",std::ios::app);
-            // int erasure_size=Find_erasure_size()
-            // //int reram_time = std::min(erasure_size*8/512,1);
-            // mycout<<"Jerasure Repair time:"<<duration<<std::endl;
-            // mycout<<"Reram Repair time:"<<duration+reram_time-reram_reduce<<std::endl;
-            // mycout<<"Reram Repair time:"<<duration+reram_time<<std::endl;
-            // mycout.close();
-        }
+        // 每轮修复后输出一次，扫描可能一直运行
+        storj::metrics::instance().dump(storj::config::metrics_file);
+        dump_trace();
         // 等待 30s
         sleep(30);
         // std::this_thread::sleep_for(std::chrono::seconds(10));
@@ -118,6 +106,11 @@ int main()
 {
     // std::thread t2(thread_scanner_func);
     // t2.join();
+    // 与上传程序的输出分开
+    storj::config::metrics_file = "metrics_scan.json";
+    storj::config::trace_file = "trace_scan.json";
     thread_scanner_func();
+    storj::metrics::instance().dump(storj::config::metrics_file);
+    dump_trace();
     return 0;
 }